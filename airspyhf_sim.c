@@ -0,0 +1,284 @@
+//
+//  airspyhf_sim.c
+//
+//  A simulated libairspyhf, see airspyhf_sim.h
+//
+//    Each open device runs a thread that makes a tone plus noise
+//    and hands it to the callback in 1024 sample blocks, paced by
+//    the monotonic clock at the selected rate.  Blocks that fall
+//    more than a few blocks behind real time are skipped and
+//    reported in dropped_samples, as the real library does.
+//
+//   re-distribution under the BSD 3 clause license permitted
+//
+
+#define _POSIX_C_SOURCE 200112L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "airspyhf_sim.h"
+
+#define SIM_MAX_DEVICES     (8)
+#define SIM_BLOCK           (1024)      // samples per transfer
+#define SIM_LATE_BLOCKS     (4)         // skip ahead past this
+#define SIM_SERIAL_BASE     (0x3b52ab5dac5e0000ULL)
+
+struct airspyhf_device {
+    int                         in_use;
+    int                         index;
+    atomic_int                  streaming;
+    uint32_t                    rate;
+    uint32_t                    freq;
+    pthread_t                   thread;
+    airspyhf_sample_block_cb_fn callback;
+    void                        *ctx;
+};
+
+static struct airspyhf_device   sim_devices[SIM_MAX_DEVICES];
+static const uint32_t           sim_rates[] = { 768000, 384000, 256000, 192000 };
+static pthread_mutex_t          sim_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double sim_env(const char *name, double dflt)
+{
+    char *s = getenv(name);
+    return((s != NULL) ? atof(s) : dflt);
+}
+
+static int sim_count(void)
+{
+    int n = (int)sim_env("HFP_SIM_DEVICES", 1.0);
+    if (n < 0) { n = 0; }
+    if (n > SIM_MAX_DEVICES) { n = SIM_MAX_DEVICES; }
+    return(n);
+}
+
+//  xorshift32 and a sum of uniforms, close enough to gaussian here
+
+static float sim_noise(uint32_t *s)
+{
+    float sum = 0.0f;
+    for (int k=0; k<4; k++) {
+        uint32_t x = *s;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        *s = x;
+        sum += (float)x * (1.0f / 4294967296.0f);
+    }
+    return((sum - 2.0f) * 1.7320508f);      // unit variance
+}
+
+static void ts_add_ns(struct timespec *t, long long ns)
+{
+    ns += t->tv_nsec;
+    t->tv_sec  += ns / 1000000000LL;
+    t->tv_nsec  = ns % 1000000000LL;
+}
+
+static void sleep_until(const struct timespec *t)
+{
+#ifdef __APPLE__                        // no clock_nanosleep
+    struct timespec now, d;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long ns = 1000000000LL * (t->tv_sec - now.tv_sec)
+                   + (t->tv_nsec - now.tv_nsec);
+    if (ns <= 0) { return; }
+    d.tv_sec  = ns / 1000000000LL;
+    d.tv_nsec = ns % 1000000000LL;
+    nanosleep(&d, NULL);
+#else
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, t, NULL);
+#endif
+}
+
+static void *sim_run(void *param)
+{
+    struct airspyhf_device *d = (struct airspyhf_device *)param;
+    airspyhf_complex_float_t *buf
+        = (airspyhf_complex_float_t *)malloc(sizeof(*buf) * SIM_BLOCK);
+    double   tone  = sim_env("HFP_SIM_TONE", 10000.0)
+                     + 1000.0 * d->index;      // tells devices apart
+    float    amp   = (float)sim_env("HFP_SIM_AMPLITUDE", 0.25);
+    float    noise = (float)sim_env("HFP_SIM_NOISE", 0.001);
+    uint32_t seed  = 0x9e3779b9u + d->index;
+    double   re = 1.0, im = 0.0;                // tone phasor
+    uint64_t dropped = 0;
+    struct timespec next, now;
+
+    if (buf == NULL) { return(NULL); }
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (atomic_load(&d->streaming)) {
+        uint32_t rate  = d->rate;
+        long long blk  = 1000000000LL * SIM_BLOCK / rate;   // ns per block
+        double   w     = 2.0 * 3.14159265358979 * tone / rate;
+        double   dre   = cos(w), dim = sin(w);
+
+        ts_add_ns(&next, blk);
+        sleep_until(&next);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long late = 1000000000LL * (now.tv_sec - next.tv_sec)
+                         + (now.tv_nsec - next.tv_nsec);
+        if (late > SIM_LATE_BLOCKS * blk) {     // the callback fell behind
+            long long skip = late / blk;
+            dropped += (uint64_t)skip * SIM_BLOCK;
+            ts_add_ns(&next, skip * blk);
+        }
+
+        for (int i=0; i<SIM_BLOCK; i++) {
+            buf[i].re = amp * (float)re + noise * sim_noise(&seed);
+            buf[i].im = amp * (float)im + noise * sim_noise(&seed);
+            double t = re * dre - im * dim;
+            im = re * dim + im * dre;
+            re = t;
+        }
+        double g = 1.5 - 0.5 * (re * re + im * im);  // keep |phasor| = 1
+        re *= g;
+        im *= g;
+
+        airspyhf_transfer_t transfer;
+        transfer.device          = d;
+        transfer.ctx             = d->ctx;
+        transfer.samples         = buf;
+        transfer.sample_count    = SIM_BLOCK;
+        transfer.dropped_samples = dropped;
+        if (d->callback(&transfer) != 0) {
+            atomic_store(&d->streaming, 0);
+        }
+    }
+    free(buf);
+    return(NULL);
+}
+
+void airspyhf_lib_version(airspyhf_lib_version_t *lib_version)
+{
+    lib_version->major_version = 1;
+    lib_version->minor_version = 6;
+    lib_version->revision      = 8;
+}
+
+int airspyhf_list_devices(uint64_t *serials, int count)
+{
+    int n = sim_count();
+    for (int i=0; i<n && i<count && serials != NULL; i++) {
+        serials[i] = SIM_SERIAL_BASE + i;
+    }
+    return(n);
+}
+
+int airspyhf_open_sn(airspyhf_device_t **device, uint64_t serial_number)
+{
+    int i = (int)(serial_number - SIM_SERIAL_BASE);
+    if (serial_number < SIM_SERIAL_BASE || i >= sim_count()) {
+        return(AIRSPYHF_ERROR);
+    }
+    pthread_mutex_lock(&sim_lock);
+    struct airspyhf_device *d = &sim_devices[i];
+    if (d->in_use) {
+        pthread_mutex_unlock(&sim_lock);
+        return(AIRSPYHF_ERROR);
+    }
+    bzero((char *)d, sizeof(*d));
+    d->in_use = 1;
+    d->index  = i;
+    d->rate   = sim_rates[0];
+    d->freq   = 10000000;
+    pthread_mutex_unlock(&sim_lock);
+    *device = d;
+    return(AIRSPYHF_SUCCESS);
+}
+
+int airspyhf_open(airspyhf_device_t **device)
+{
+    for (int i=0; i<sim_count(); i++) {
+        if (airspyhf_open_sn(device, SIM_SERIAL_BASE + i) == 0) {
+            return(AIRSPYHF_SUCCESS);
+        }
+    }
+    return(AIRSPYHF_ERROR);
+}
+
+int airspyhf_close(airspyhf_device_t *device)
+{
+    airspyhf_stop(device);
+    pthread_mutex_lock(&sim_lock);
+    device->in_use = 0;
+    pthread_mutex_unlock(&sim_lock);
+    return(AIRSPYHF_SUCCESS);
+}
+
+int airspyhf_start(airspyhf_device_t *device,
+                   airspyhf_sample_block_cb_fn callback, void *ctx)
+{
+    if (atomic_load(&device->streaming)) { return(AIRSPYHF_ERROR); }
+    device->callback = callback;
+    device->ctx      = ctx;
+    atomic_store(&device->streaming, 1);
+    if (pthread_create(&device->thread, NULL, sim_run, device) != 0) {
+        atomic_store(&device->streaming, 0);
+        return(AIRSPYHF_ERROR);
+    }
+    return(AIRSPYHF_SUCCESS);
+}
+
+int airspyhf_stop(airspyhf_device_t *device)
+{
+    if (device->thread != 0) {
+        atomic_store(&device->streaming, 0);
+        if (!pthread_equal(device->thread, pthread_self())) {
+            pthread_join(device->thread, NULL);
+        }
+        device->thread = 0;
+    }
+    return(AIRSPYHF_SUCCESS);
+}
+
+int airspyhf_is_streaming(airspyhf_device_t *device)
+{
+    return(atomic_load(&device->streaming));
+}
+
+int airspyhf_set_freq(airspyhf_device_t *device, const uint32_t freq_hz)
+{
+    device->freq = freq_hz;
+    return(AIRSPYHF_SUCCESS);
+}
+
+int airspyhf_get_samplerates(airspyhf_device_t *device, uint32_t *buffer,
+                             const uint32_t len)
+{
+    uint32_t n = sizeof(sim_rates) / sizeof(sim_rates[0]);
+    if (len == 0) {
+        buffer[0] = n;
+        return(AIRSPYHF_SUCCESS);
+    }
+    if (len < n) { return(AIRSPYHF_ERROR); }
+    memcpy(buffer, sim_rates, sizeof(sim_rates));
+    return(AIRSPYHF_SUCCESS);
+}
+
+int airspyhf_set_samplerate(airspyhf_device_t *device, uint32_t samplerate)
+{
+    uint32_t n = sizeof(sim_rates) / sizeof(sim_rates[0]);
+    for (uint32_t i=0; i<n; i++) {
+        if (sim_rates[i] == samplerate) {
+            device->rate = samplerate;
+            return(AIRSPYHF_SUCCESS);
+        }
+    }
+    return(AIRSPYHF_ERROR);
+}
+
+int airspyhf_version_string_read(airspyhf_device_t *device,
+                                 char *version, uint8_t length)
+{
+    snprintf(version, length, "simulated HF+ #%d", device->index);
+    return(AIRSPYHF_SUCCESS);
+}
+
+// eof
@@ -0,0 +1,68 @@
+//
+//  airspyhf_sim.h
+//
+//  A simulated libairspyhf for running hfp_tcp without an HF+.
+//    Same names and callback contract as the subset of airspyhf.h
+//    the server uses; build with -DHFP_SIM (make sim).
+//
+//  Environment :
+//    HFP_SIM_DEVICES     number of devices listed (default 1)
+//    HFP_SIM_TONE        tone offset from the tuned frequency, Hz (10000),
+//                        1 kHz higher for each device after the first
+//    HFP_SIM_AMPLITUDE   tone amplitude, full scale 1.0 (0.25)
+//    HFP_SIM_NOISE       gaussian noise rms per component (0.001)
+//
+//   re-distribution under the BSD 3 clause license permitted
+//
+
+#ifndef AIRSPYHF_SIM_H
+#define AIRSPYHF_SIM_H
+
+#include <stdint.h>
+
+enum airspyhf_error {
+    AIRSPYHF_SUCCESS = 0,
+    AIRSPYHF_ERROR = -1,
+    AIRSPYHF_UNSUPPORTED = -2
+};
+
+typedef struct airspyhf_device airspyhf_device_t;
+
+typedef struct {
+    float re;
+    float im;
+} airspyhf_complex_float_t;
+
+typedef struct {
+    airspyhf_device_t           *device;
+    void                        *ctx;
+    airspyhf_complex_float_t    *samples;
+    int                         sample_count;
+    uint64_t                    dropped_samples;
+} airspyhf_transfer_t;
+
+typedef struct {
+    uint32_t major_version;
+    uint32_t minor_version;
+    uint32_t revision;
+} airspyhf_lib_version_t;
+
+typedef int (*airspyhf_sample_block_cb_fn)(airspyhf_transfer_t *transfer_fn);
+
+void airspyhf_lib_version(airspyhf_lib_version_t *lib_version);
+int  airspyhf_list_devices(uint64_t *serials, int count);
+int  airspyhf_open(airspyhf_device_t **device);
+int  airspyhf_open_sn(airspyhf_device_t **device, uint64_t serial_number);
+int  airspyhf_close(airspyhf_device_t *device);
+int  airspyhf_start(airspyhf_device_t *device,
+                    airspyhf_sample_block_cb_fn callback, void *ctx);
+int  airspyhf_stop(airspyhf_device_t *device);
+int  airspyhf_is_streaming(airspyhf_device_t *device);
+int  airspyhf_set_freq(airspyhf_device_t *device, const uint32_t freq_hz);
+int  airspyhf_get_samplerates(airspyhf_device_t *device, uint32_t *buffer,
+                              const uint32_t len);
+int  airspyhf_set_samplerate(airspyhf_device_t *device, uint32_t samplerate);
+int  airspyhf_version_string_read(airspyhf_device_t *device,
+                                  char *version, uint8_t length);
+
+#endif  // AIRSPYHF_SIM_H
@@ -0,0 +1,951 @@
+//
+//  hfp_bench.c
+//
+//  Microbenchmarks for the hfp_tcp hot paths : ring writes and reads,
+//    the sample format conversions, the filters, mixer, decimator,
+//    resampler and spectrum FFT, at usb block size (1024 IQ pairs).
+//
+//    hfp_bench [-t seconds per kernel] [-j results.json] [-k name filter]
+//
+//  Reports ns per IQ sample, MS/s and cycles per sample (x86 TSC,
+//    reference cycles; not available elsewhere).  The JSON output
+//    is meant for comparing one commit against another.
+//  Also checks the block floating point format end to end : the SNR
+//    after quantize_bfp and bfp_decode, for tones from full scale
+//    down to -100 dBFS, against 8-bit at nominal gain.  Exits with 1
+//    if block floating point falls below BFP_MIN_SNR anywhere, or
+//    the SIMD dither, IIR cascade, mixer or FFT stray from their
+//    reference versions, a codec frame doesn't decode to its input,
+//    or a resampler ratio misses its passband ripple or stopband.
+//
+//   re-distribution under the BSD 3 clause license permitted
+//
+
+#define _POSIX_C_SOURCE 200112L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <math.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
+#include "hfp_dsp.h"
+#include "hfp_ring.h"
+#include "hfp_resamp.h"
+#include "hfp_codec.h"
+#include "hfp_fft.h"
+
+#define BLOCK       (1024)                  // IQ pairs, one usb transfer
+#define MAX_OUT     (2 * BLOCK + 8)         // resampler output room
+#define BFP_MIN_SNR (40.0)                  // dB, 8-bit mantissas
+#define NCO_MIN_SNR (90.0)                  // dB, float rounding apart
+#define FFT_MIN_SNR (100.0)                 // dB, against a double DFT
+#define DITHER_BINS (12)                    // error histogram, -1.5..1.5 LSB
+#define DITHER_TOL  (0.01)                  // LSB, LSB^2 or bin fraction
+
+typedef void (*kernel_fn)(void *arg);
+
+double      benchSeconds    =  0.2;
+char        *filter         =  NULL;
+FILE        *json           =  NULL;
+int         results         =  0;
+
+float       src[2 * BLOCK];                 // tone plus noise, |x| < 1
+float       work[2 * MAX_OUT];
+uint8_t     out8[8 * MAX_OUT];
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(1e9 * ts.tv_sec + ts.tv_nsec);
+}
+
+static unsigned long long cycles(void)
+{
+#ifdef HAVE_TSC
+    return(__rdtsc());
+#else
+    return(0);
+#endif
+}
+
+//  Time fn over calls of 'pairs' input IQ samples until benchSeconds
+//    have passed, and report.
+
+static void bench(const char *name, const char *variant, int pairs,
+                  kernel_fn fn, void *arg)
+{
+    if (filter != NULL && strstr(name, filter) == NULL) { return; }
+    for (int i=0; i<16; i++) { fn(arg); }       // warm caches and branches
+    long long calls = 0;
+    double    t0 = now_ns(), t1 = t0;
+    unsigned long long c0 = cycles();
+    while (t1 - t0 < 1e9 * benchSeconds) {
+        for (int i=0; i<64; i++) { fn(arg); }
+        calls += 64;
+        t1 = now_ns();
+    }
+    unsigned long long c1 = cycles();
+    double samples = (double)calls * pairs;
+    double ns      = (t1 - t0) / samples;
+    double cyc     = (double)(c1 - c0) / samples;
+    printf("%-24s %-22s %9.3f ns %9.2f MS/s", name, variant, ns, 1e3 / ns);
+#ifdef HAVE_TSC
+    printf(" %8.2f cyc", cyc);
+#endif
+    printf("\n");
+    if (json != NULL) {
+        fprintf(json, "%s\n    {\"kernel\": \"%s\", \"variant\": \"%s\", "
+                "\"pairs\": %d, \"ns_per_sample\": %.4f, \"msps\": %.3f, ",
+                (results > 0) ? "," : "", name, variant, pairs, ns, 1e3 / ns);
+#ifdef HAVE_TSC
+        fprintf(json, "\"cycles_per_sample\": %.3f}", cyc);
+#else
+        fprintf(json, "\"cycles_per_sample\": null}");
+#endif
+    }
+    results += 1;
+    (void)cyc;
+}
+
+//  Record a check_* result : kernel and variant, then the check's own
+//    JSON fields, printf style in fmt.
+
+static void report_check(const char *kernel, const char *variant,
+                         const char *fmt, ...)
+{
+    if (json != NULL) {
+        va_list ap;
+        va_start(ap, fmt);
+        fprintf(json, "%s\n    {\"kernel\": \"%s\", \"variant\": \"%s\", ",
+                (results > 0) ? "," : "", kernel, variant);
+        vfprintf(json, fmt, ap);
+        fprintf(json, "}");
+        va_end(ap);
+    }
+    results += 1;
+}
+
+//  kernels
+
+typedef struct ringArg {
+    ring_t          ring;
+    ring_reader_t   rd;
+    long            bytes;
+    uint8_t         *data;
+    int             read;       // 0 write only, 1 view, 2 copy out
+} ringArg;
+
+static void k_ring(void *arg)
+{
+    ringArg *a = (ringArg *)arg;
+    ring_write(&a->ring, a->data, a->bytes);
+    if (a->read) {
+        uint8_t *p = NULL;
+        long n = ring_view(&a->rd, &p, a->bytes);
+        if (a->read == 2) { memcpy(out8, p, n); }
+        ring_consume(&a->rd, n);
+    }
+}
+
+typedef struct qArg {
+    quantize_8_fn   fn;
+    dither_t        d;
+    int             bits;
+} qArg;
+
+static void k_quantize(void *arg)
+{
+    qArg *a = (qArg *)arg;
+    if (a->bits == 8) {
+        a->fn(src, BLOCK, 64.0f, out8, &a->d);
+    } else if (a->bits == 16) {
+        quantize_16(src, BLOCK, 64.0f, out8);
+    } else if (a->bits == 12) {
+        quantize_12(src, BLOCK, 64.0f, out8);
+    } else if (a->bits == 18) {
+        for (int i=0; i<BLOCK; i+=BFP_PAIRS) {
+            quantize_bfp(&src[2*i], 0, out8 + i / BFP_PAIRS * BFP_FRAME);
+        }
+    } else if (a->bits == 1) {
+        volatile float pk = peak_abs(src, BLOCK);
+        (void)pk;
+    } else {
+        memcpy(out8, src, 8 * BLOCK);
+    }
+}
+
+typedef struct iirArg {
+    int             order;
+    int             decim;
+    int             cntr;
+    iirParams       bq[IIR_MAX_STAGES];
+    iirCascade      c;
+    iir_cascade_fn  fn;
+} iirArg;
+
+static void k_iir_fbc(void *arg)
+{
+    iirArg *a = (iirArg *)arg;
+    iir_fbc(work, 2 * BLOCK, a->order);
+}
+
+static void k_iir_biquads(void *arg)
+{
+    iirArg *a = (iirArg *)arg;
+    iir_biquads(work, 2 * BLOCK, a->bq, a->order);
+}
+
+static void k_iir_cascade(void *arg)
+{
+    iirArg *a = (iirArg *)arg;
+    a->fn(work, 2 * BLOCK, &a->c);
+}
+
+static void k_iir_filter(void *arg)
+{
+    iirArg *a = (iirArg *)arg;
+    iir_filter(work, 2 * BLOCK, &a->c);
+}
+
+//  the -F iir channel path : filter at the input rate, keep 1 in decim
+
+static void k_iir_decimate(void *arg)
+{
+    iirArg *a = (iirArg *)arg;
+    memcpy(work, src, 8 * BLOCK);
+    iir_filter(work, 2 * BLOCK, &a->c);
+    decimate_iq(work, BLOCK, a->decim, &a->cntr);
+}
+
+typedef struct ncoArg {
+    nco_t       o;
+    nco_mix_fn  fn;
+} ncoArg;
+
+static void k_nco(void *arg)
+{
+    ncoArg *a = (ncoArg *)arg;
+    a->fn(work, src, BLOCK, &a->o);
+}
+
+typedef struct fftArg {
+    fft_plan_t  plan;
+    fft_fn      fn;
+    float       x[2 * FFT_MAX_SIZE];
+} fftArg;
+
+static void k_fft(void *arg)
+{
+    fftArg *a = (fftArg *)arg;
+    memcpy(a->x, src, sizeof(float) * 2 * BLOCK);
+    a->fn(&a->plan, a->x);
+}
+
+static void k_resamp(void *arg)
+{
+    resamp_process((resamp_t *)arg, src, BLOCK, work);
+}
+
+typedef struct codecArg {
+    codec_t         z;
+    int             bits;
+    uint8_t         raw[4 * BLOCK];
+    uint8_t         frame[CODEC_HEADER + 12 * BLOCK + 64];
+    int             decode;
+} codecArg;
+
+static void k_codec(void *arg)
+{
+    codecArg *a = (codecArg *)arg;
+    if (a->decode) {
+        codec_decode(&a->z, a->frame, out8);
+    } else {
+        codec_encode(&a->z, a->raw, BLOCK, a->bits, a->frame);
+    }
+}
+
+static void run_ring(void)
+{
+    static ringArg a;
+    static const char *reads[] = { "write", "write+view", "write+copy" };
+    static const int frames[] = { 2, 3, 4, 8 };
+    static const char *fmts[] = { "8-bit", "12-bit", "16-bit", "float" };
+    for (int f=0; f<4; f++) {
+        for (int r=0; r<3; r++) {
+            if (ring_init(&a.ring, 16L * 1024L * 1024L, frames[f]) < 0) {
+                printf("ring_init failed\n");
+                return;
+            }
+            ring_reader_attach(&a.rd, &a.ring);
+            a.bytes = (long)frames[f] * BLOCK;
+            a.data  = out8;
+            a.read  = r;
+            char v[64];
+            snprintf(v, sizeof(v), "%s %s", fmts[f], reads[r]);
+            bench("ring", v, BLOCK, k_ring, &a);
+            ring_reader_detach(&a.rd);
+            // the ring's pages are left mapped, this is a short run
+        }
+    }
+}
+
+static void run_quantize(void)
+{
+    static qArg a;
+    dither_init(&a.d, 12345);
+    a.bits = 8;
+    a.fn = quantize_8_ref;     bench("quantize_8", "ref", BLOCK, k_quantize, &a);
+    a.fn = quantize_8_scalar;  bench("quantize_8", "scalar", BLOCK, k_quantize, &a);
+#if defined(__SSE2__)
+    a.fn = quantize_8_sse2;    bench("quantize_8", "sse2", BLOCK, k_quantize, &a);
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        a.fn = quantize_8_avx2; bench("quantize_8", "avx2", BLOCK, k_quantize, &a);
+    }
+#endif
+#endif
+#if defined(__ARM_NEON)
+    a.fn = quantize_8_neon;    bench("quantize_8", "neon", BLOCK, k_quantize, &a);
+#endif
+    a.bits = 16;               bench("quantize_16", "scalar", BLOCK, k_quantize, &a);
+    a.bits = 12;               bench("quantize_12", "scalar", BLOCK, k_quantize, &a);
+    a.bits = 18;               bench("quantize_bfp", "peak scan + 8-bit", BLOCK,
+                                     k_quantize, &a);
+    a.bits = 1;                bench("peak_abs", "", BLOCK, k_quantize, &a);
+    a.bits = 32;               bench("float_copy", "memcpy", BLOCK, k_quantize, &a);
+}
+
+static void run_iir(void)
+{
+    static iirArg a;
+    char v[64];
+    memcpy(work, src, 8 * BLOCK);
+    init_ipbc(192000.0, 16000.0);
+    for (int order=2; order<=12; order+=2) {
+        a.order = order;
+        snprintf(v, sizeof(v), "order %d", order);
+        bench("iir_fbc", v, BLOCK, k_iir_fbc, &a);
+        iir_biquads_init(a.bq, order, 192000.0, 16000.0);
+        bench("iir_biquads", v, BLOCK, k_iir_biquads, &a);
+        iir_cascade_init(&a.c, order, 192000.0, 16000.0);
+        a.fn = iir_cascade_scalar;
+        snprintf(v, sizeof(v), "order %d scalar", order);
+        bench("iir_cascade", v, BLOCK, k_iir_cascade, &a);
+#if defined(__SSE2__)
+        a.fn = iir_cascade_sse2;
+        snprintf(v, sizeof(v), "order %d sse2", order);
+        bench("iir_cascade", v, BLOCK, k_iir_cascade, &a);
+#endif
+#if defined(__ARM_NEON)
+        a.fn = iir_cascade_neon;
+        snprintf(v, sizeof(v), "order %d neon", order);
+        bench("iir_cascade", v, BLOCK, k_iir_cascade, &a);
+#endif
+        snprintf(v, sizeof(v), "order %d %s", order,
+                 a.c.pipe ? "pipeline" : "stages");
+        bench("iir_filter", v, BLOCK, k_iir_filter, &a);
+    }
+    static const int decims[] = { 2, 3, 4, 8, 16 };
+    for (int order=2; order<=12; order+=2) {
+        for (int k=0; k<5; k++) {
+            a.order = order;
+            a.decim = decims[k];
+            a.cntr  = 0;
+            iir_cascade_init(&a.c, order, 768000.0, 0.4 * 768000.0 / a.decim);
+            snprintf(v, sizeof(v), "order %d decim %d", order, a.decim);
+            bench("iir_decimate", v, BLOCK, k_iir_decimate, &a);
+        }
+    }
+}
+
+//  The pipelined cascade against iir_biquads(), IIR_PIPE_DELAY samples
+//    apart, over several blocks so the state carries across calls;
+//    and iir_filter(), whichever way it runs, c->delay apart.
+
+#define IIR_CHECK_BLOCKS    (4)
+#define IIR_MAX_DIFF        (1e-6)          // of full scale, float rounding
+
+static double iir_diff(iir_cascade_fn fn, int order, int dispatched)
+{
+    static float x[2 * BLOCK * IIR_CHECK_BLOCKS], y[2 * BLOCK * IIR_CHECK_BLOCKS];
+    iirParams  bq[IIR_MAX_STAGES];
+    iirCascade c;
+    double     worst = 0.0;
+    int        n = BLOCK * IIR_CHECK_BLOCKS;
+    for (int k=0; k<IIR_CHECK_BLOCKS; k++) {
+        memcpy(&x[2 * BLOCK * k], src, 8 * BLOCK);
+    }
+    memcpy(y, x, 8L * n);
+    iir_biquads_init(bq, order, 192000.0, 16000.0);
+    iir_cascade_init(&c, order, 192000.0, 16000.0);
+    int delay = dispatched ? c.delay : IIR_PIPE_DELAY;
+    for (int k=0; k<IIR_CHECK_BLOCKS; k++) {
+        iir_biquads(&x[2 * BLOCK * k], 2 * BLOCK, bq, order);
+        if (dispatched) {
+            iir_filter(&y[2 * BLOCK * k], 2 * BLOCK, &c);
+        } else {
+            fn(&y[2 * BLOCK * k], 2 * BLOCK, &c);
+        }
+    }
+    for (int i=0; i+delay<n; i++) {
+        for (int j=0; j<2; j++) {
+            double d = fabs((double)y[2*(i+delay)+j] - x[2*i+j]);
+            if (d > worst) { worst = d; }
+        }
+    }
+    return(worst);
+}
+
+static int check_iir(void)
+{
+    static const struct { const char *name; iir_cascade_fn fn; } v[] = {
+        { "dispatched", NULL },
+        { "scalar", iir_cascade_scalar },
+#if defined(__SSE2__)
+        { "sse2", iir_cascade_sse2 },
+#endif
+#if defined(__ARM_NEON)
+        { "neon", iir_cascade_neon },
+#endif
+    };
+    int fails = 0;
+    for (int k=0; k<(int)(sizeof(v) / sizeof(v[0])); k++) {
+        double worst = 0.0;
+        for (int order=2; order<=12; order+=2) {
+            double d = iir_diff(v[k].fn, order, v[k].fn == NULL);
+            if (d > worst) { worst = d; }
+        }
+        printf("%-24s %-22s max diff %.3g, orders 2 to 12\n", "iir_check",
+               v[k].name, worst);
+        report_check("iir_check", v[k].name, "\"max_diff\": %.3g", worst);
+        if (worst > IIR_MAX_DIFF) {
+            printf("iir_check : %s strays from iir_biquads\n", v[k].name);
+            fails += 1;
+        }
+    }
+    return(fails);
+}
+
+static void run_codec(void)
+{
+    static codecArg a;
+    static dither_t d;
+    static const int bits[] = { 8, 12, 16 };
+    char v[64];
+    dither_init(&d, 54321);
+    for (int b=0; b<3; b++) {
+        a.bits = bits[b];
+        int sz = (a.bits == 8)  ? quantize_8_scalar(src, BLOCK, 64.0f, a.raw, &d)
+               : (a.bits == 12) ? quantize_12(src, BLOCK, 64.0f, a.raw)
+                                : quantize_16(src, BLOCK, 64.0f, a.raw);
+        long zsz = codec_encode(&a.z, a.raw, BLOCK, a.bits, a.frame);
+        snprintf(v, sizeof(v), "%d-bit ratio %.2f", a.bits, (double)sz / zsz);
+        a.decode = 0;
+        bench("codec_encode", v, BLOCK, k_codec, &a);
+        a.decode = 1;
+        bench("codec_decode", v, BLOCK, k_codec, &a);
+    }
+}
+
+//  codec_decode() must give back every byte codec_encode() was given,
+//    at each width : one pair up to CODEC_MAX_PAIRS, partitions whole
+//    and cut short, for a tone, full scale extremes swinging end to
+//    end every sample, random bytes, and the tone with a random byte
+//    every 64, whose residuals are certain to escape.
+//    Frames must fit codec_max_bytes(); the bytes after it are
+//    watched for overruns.
+
+#define CODEC_CHECK_FRAMES  (24)            // per width and signal
+#define CODEC_CANARY        (64)            // bytes past codec_max_bytes()
+
+static int check_codec(void)
+{
+    static codec_t  z;
+    static dither_t d;
+    static float    x[2 * CODEC_MAX_PAIRS];
+    static uint8_t  raw[4 * CODEC_MAX_PAIRS], back[4 * CODEC_MAX_PAIRS];
+    static const int   bits[] = { 8, 12, 16 };
+    static const char *sigs[] = { "tone", "extremes", "noise", "impulses" };
+    long     room  = codec_max_bytes(CODEC_MAX_PAIRS) + CODEC_CANARY;
+    uint8_t  *frame = (uint8_t *)malloc(room);
+    uint32_t seed  = 7;
+    int      fails = 0;
+    if (frame == NULL) { printf("codec_check : no memory\n"); return(1); }
+    dither_init(&d, 2468);
+    for (int b=0; b<3; b++) {
+        int    frames = 0, bad = 0;
+        double fill   = 0.0;
+        for (int g=0; g<4; g++) {
+            for (int f=0; f<CODEC_CHECK_FRAMES; f++) {
+                seed = seed * 1664525u + 1013904223u;
+                int pairs = (f == 0) ? 1
+                          : (f == 1) ? CODEC_PART - 1
+                          : (f == 2) ? CODEC_PART
+                          : (f == 3) ? CODEC_MAX_PAIRS
+                          : 1 + (int)((seed >> 8) % CODEC_MAX_PAIRS);
+                for (int i=0; i<pairs; i++) {
+                    x[2*i  ] = src[2 * (i % BLOCK)    ];
+                    x[2*i+1] = src[2 * (i % BLOCK) + 1];
+                    if (g == 1) {           // clipped, flipping each sample
+                        x[2*i  ] = (i & 1) ? 2.0f : -2.0f;
+                        x[2*i+1] = (i & 1) ? -2.0f : 2.0f;
+                    }
+                }
+                float gain = (g == 1) ? 65536.0f : 64.0f;
+                int sz = (bits[b] == 8)  ? quantize_8_scalar(x, pairs, gain, raw, &d)
+                       : (bits[b] == 12) ? quantize_12(x, pairs, gain, raw)
+                                         : quantize_16(x, pairs, gain, raw);
+                for (int i=0; g>=2 && i<sz; i++) {
+                    seed = seed * 1664525u + 1013904223u;
+                    if (g == 2 || (seed & 0x3f0000) == 0) {
+                        raw[i] = (uint8_t)(seed >> 24);
+                    }
+                }
+                memset(frame, 0xa5, room);
+                long zsz  = codec_encode(&z, raw, pairs, bits[b], frame);
+                long max  = codec_max_bytes(pairs);
+                int  over = 0;
+                for (long i=max; i<room; i++) { over |= (frame[i] != 0xa5); }
+                long n = (zsz > 0 && zsz <= max && !over)
+                         ? codec_decode(&z, frame, back) : -1;
+                if (n != sz || memcmp(raw, back, sz) != 0) {
+                    printf("codec_check : %d-bit %s, %d pairs, frame %ld of "
+                           "%ld bytes%s, %s\n", bits[b], sigs[g], pairs,
+                           zsz, max, over ? " and past it" : "",
+                           (n == sz) ? "decodes differently" : "won't decode");
+                    bad += 1;
+                }
+                if ((double)zsz / max > fill) { fill = (double)zsz / max; }
+                frames += 1;
+            }
+        }
+        char v[64];
+        snprintf(v, sizeof(v), "%d-bit", bits[b]);
+        printf("%-24s %-22s %d of %d frames lossless, largest %.0f%% "
+               "of codec_max_bytes\n", "codec_check", v, frames - bad,
+               frames, 100.0 * fill);
+        report_check("codec_check", v, "\"frames\": %d, \"mismatches\": %d, "
+                     "\"max_fill\": %.3f", frames, bad, fill);
+        fails += bad;
+    }
+    free(frame);
+    return(fails);
+}
+
+//  signal to quantization noise after a round trip, in dB
+
+static double snr_db(const float *x, const float *y, int n)
+{
+    double sig = 0.0, err = 0.0;
+    for (int i=0; i<2*n; i++) {
+        sig += (double)x[i] * x[i];
+        err += (double)(y[i] - x[i]) * (y[i] - x[i]);
+    }
+    if (err == 0.0) { return(200.0); }
+    return(10.0 * log10(sig / err));
+}
+
+static void report_snr(const char *variant, double bfp, double q8)
+{
+    printf("%-24s %-22s %9.1f dB, 8-bit %6.1f dB\n", "bfp_roundtrip",
+           variant, bfp, q8);
+    report_check("bfp_roundtrip", variant,
+                 "\"snr_db\": %.2f, \"snr_8bit_db\": %.2f", bfp, q8);
+}
+
+static int check_bfp(void)
+{
+    static float   x[2 * BLOCK], y[2 * BLOCK];
+    static uint8_t blk[BFP_FRAME], q[2 * BLOCK];
+    dither_t d;
+    int fails = 0;
+    dither_init(&d, 777);
+    for (int level=0; level>=-100; level-=20) {
+        float a = powf(10.0f, level / 20.0f);
+        for (int i=0; i<BLOCK; i++) {      // a tone, and a burst on top
+            float b = (i >= BLOCK/2 && i < BLOCK/2 + 100) ? 4.0f : 1.0f;
+            x[2*i  ] = 0.99f * a / b * cosf(0.0123f * i);
+            x[2*i+1] = 0.99f * a / b * sinf(0.0123f * i);
+        }
+        int seq = 0;
+        for (int i=0; i<BLOCK; i+=BFP_PAIRS) {
+            quantize_bfp(&x[2*i], (uint8_t)seq, blk);
+            if (bfp_decode(blk, &y[2*i]) != seq) { fails += 1; }
+            seq += 1;
+        }
+        double sb = snr_db(x, y, BLOCK);
+        quantize_8_scalar(x, BLOCK, 64.0f, q, &d);  // nominal gain
+        for (int i=0; i<2*BLOCK; i++) { y[i] = (q[i] - 128.0f) / 64.0f; }
+        double s8 = snr_db(x, y, BLOCK);
+        char v[64];
+        snprintf(v, sizeof(v), "%d dBFS", level);
+        report_snr(v, sb, s8);
+        if (sb < BFP_MIN_SNR) {
+            printf("bfp_roundtrip : %.1f dB at %d dBFS, below %.0f dB\n",
+                   sb, level, BFP_MIN_SNR);
+            fails += 1;
+        }
+    }
+    return(fails);
+}
+
+//  8-bit dither statistics : the error against gain * x, in LSB,
+//    over DITHER_BLOCKS of the test tone.  TPDF dither plus rounding
+//    has mean 0, variance 1/6 + 1/12 = 0.25 and a triangular spread.
+
+#define DITHER_BLOCKS   (400)
+
+static void dither_stats(quantize_8_fn fn, double *mean, double *var,
+                         double *hist)
+{
+    dither_t d;
+    double   sum = 0.0, sum2 = 0.0;
+    long     n   = 0;
+    dither_init(&d, 4242);
+    bzero((char *)hist, sizeof(double) * DITHER_BINS);
+    for (int k=0; k<DITHER_BLOCKS; k++) {
+        fn(src, BLOCK, 64.0f, out8, &d);
+        for (int i=0; i<2*BLOCK; i++) {
+            double e = (out8[i] - 128.0) - 64.0 * src[i];
+            int    b = (int)floor((e + 1.5) * DITHER_BINS / 3.0);
+            if (b < 0) { b = 0; }
+            if (b >= DITHER_BINS) { b = DITHER_BINS - 1; }
+            hist[b] += 1.0;
+            sum     += e;
+            sum2    += e * e;
+            n       += 1;
+        }
+    }
+    *mean = sum / n;
+    *var  = sum2 / n - *mean * *mean;
+    for (int b=0; b<DITHER_BINS; b++) { hist[b] /= n; }
+}
+
+static int check_dither_one(const char *variant, quantize_8_fn fn,
+                            double rmean, double rvar, const double *rhist)
+{
+    double mean, var, hist[DITHER_BINS], worst = 0.0;
+    dither_stats(fn, &mean, &var, hist);
+    for (int b=0; b<DITHER_BINS; b++) {
+        double h = fabs(hist[b] - rhist[b]);
+        if (h > worst) { worst = h; }
+    }
+    printf("%-24s %-22s mean %+.4f var %.4f, histogram %.4f from ref\n",
+           "dither_check", variant, mean, var, worst);
+    report_check("dither_check", variant,
+                 "\"mean\": %.5f, \"variance\": %.5f, \"hist_diff\": %.5f",
+                 mean, var, worst);
+    if (fabs(mean - rmean) > DITHER_TOL || fabs(var - rvar) > DITHER_TOL
+        || worst > DITHER_TOL) {
+        printf("dither_check : %s strays from quantize_8_ref\n", variant);
+        return(1);
+    }
+    return(0);
+}
+
+//  every 8-bit kernel built here against the rand() reference
+
+static int check_dither(void)
+{
+    double rmean, rvar, rhist[DITHER_BINS];
+    int    fails = 0;
+    dither_stats(quantize_8_ref, &rmean, &rvar, rhist);
+    fails += check_dither_one("ref", quantize_8_ref, rmean, rvar, rhist);
+    if (fabs(rvar - 0.25) > 2 * DITHER_TOL) {
+        printf("dither_check : ref variance %.4f, not 0.25\n", rvar);
+        fails += 1;
+    }
+    fails += check_dither_one("scalar", quantize_8_scalar, rmean, rvar, rhist);
+#if defined(__SSE2__)
+    fails += check_dither_one("sse2", quantize_8_sse2, rmean, rvar, rhist);
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        fails += check_dither_one("avx2", quantize_8_avx2, rmean, rvar, rhist);
+    }
+#endif
+#endif
+#if defined(__ARM_NEON)
+    fails += check_dither_one("neon", quantize_8_neon, rmean, rvar, rhist);
+#endif
+    return(fails);
+}
+
+static void run_nco(void)
+{
+    static ncoArg a;
+    nco_set(&a.o, 123456.0, 768000.0);
+    a.fn = nco_mix_scalar;     bench("nco_mix", "scalar", BLOCK, k_nco, &a);
+#if defined(__SSE2__)
+    a.fn = nco_mix_sse2;       bench("nco_mix", "sse2", BLOCK, k_nco, &a);
+#endif
+#if defined(__ARM_NEON)
+    a.fn = nco_mix_neon;       bench("nco_mix", "neon", BLOCK, k_nco, &a);
+#endif
+}
+
+//  the SIMD mixer against the scalar one, block by block from the same
+//    phasor (both drift over time, differently), over a second of
+//    blocks with a retune halfway and odd lengths for the tails
+
+static int check_nco(void)
+{
+    static float y[2 * BLOCK];
+    nco_t  s, v;
+    double sig = 0.0, err = 0.0;
+    bzero((char *)&s, sizeof(s));
+    nco_set(&s, 123456.0, 768000.0);
+    for (int k=0; k<750; k++) {
+        int n = BLOCK - (k % 7);
+        if (k == 375) { nco_set(&s, -54321.0, 768000.0); }
+        v = s;
+        nco_mix_scalar(work, src, n, &s);
+        nco_mix(y, src, n, &v);
+        for (int i=0; i<2*n; i++) {
+            sig += (double)work[i] * work[i];
+            err += (double)(y[i] - work[i]) * (y[i] - work[i]);
+        }
+    }
+    double snr = (err > 0.0) ? 10.0 * log10(sig / err) : 200.0;
+    printf("%-24s %-22s %9.1f dB against scalar\n", "nco_mix_check",
+           "dispatched", snr);
+    report_check("nco_mix_check", "dispatched", "\"snr_db\": %.2f", snr);
+    if (snr < NCO_MIN_SNR) {
+        printf("nco_mix_check : %.1f dB, below %.0f dB\n", snr, NCO_MIN_SNR);
+        return(1);
+    }
+    return(0);
+}
+
+static void run_fft(void)
+{
+    static fftArg a;
+    fft_plan_init(&a.plan, BLOCK);
+    a.fn = fft_forward_scalar; bench("fft", "scalar", BLOCK, k_fft, &a);
+#if defined(__SSE2__)
+    a.fn = fft_forward_sse2;   bench("fft", "sse2", BLOCK, k_fft, &a);
+#endif
+#if defined(__ARM_NEON)
+    a.fn = fft_forward_neon;   bench("fft", "neon", BLOCK, k_fft, &a);
+#endif
+    fft_plan_free(&a.plan);
+}
+
+//  the dispatched FFT against a DFT in double precision, at every
+//    size the spectrum stream takes up to 1024 points
+
+static int check_fft(void)
+{
+    static float x[2 * BLOCK];
+    fft_plan_t p;
+    int fails = 0;
+    for (int n=FFT_MIN_SIZE; n<=BLOCK; n*=2) {
+        double sig = 0.0, err = 0.0;
+        fft_plan_init(&p, n);
+        memcpy(x, src, sizeof(float) * 2 * n);
+        p.exec(&p, x);
+        for (int k=0; k<n; k++) {
+            double re = 0.0, im = 0.0;
+            for (int i=0; i<n; i++) {
+                double a = -2.0 * 3.14159265358979 * (double)i * k / n;
+                re += src[2*i] * cos(a) - src[2*i+1] * sin(a);
+                im += src[2*i] * sin(a) + src[2*i+1] * cos(a);
+            }
+            sig += re * re + im * im;
+            err += (x[2*k] - re) * (x[2*k] - re)
+                   + (x[2*k+1] - im) * (x[2*k+1] - im);
+        }
+        fft_plan_free(&p);
+        double snr = (err > 0.0) ? 10.0 * log10(sig / err) : 200.0;
+        char v[64];
+        snprintf(v, sizeof(v), "%d points", n);
+        printf("%-24s %-22s %9.1f dB against a DFT\n", "fft_check", v, snr);
+        report_check("fft_check", v, "\"snr_db\": %.2f", snr);
+        if (snr < FFT_MIN_SNR) {
+            printf("fft_check : %.1f dB at %d points, below %.0f dB\n",
+                   snr, n, FFT_MIN_SNR);
+            fails += 1;
+        }
+    }
+    return(fails);
+}
+
+//  every hardware rate against the rates clients commonly ask for
+
+static const long rsHw[] = { 768000, 384000, 256000, 192000 };
+static const long rsClient[] = {
+    24000, 48000, 96000, 100000, 192000, 240000, 250000, 256000,
+    288000, 384000, 768000, 1024000, 1536000
+};
+
+static void run_resamp(void)
+{
+    static resamp_t r;
+    char v[64];
+    for (int i=0; i<4; i++) {
+        for (int j=0; j<13; j++) {
+            long hw = rsHw[i], client = rsClient[j];
+            if (client == hw) { continue; }
+            if (resamp_init(&r, (double)hw, (double)client) < 0) {
+                continue;
+            }
+            snprintf(v, sizeof(v), "%ld to %ld", hw, client);
+            bench("resamp", v, BLOCK, k_resamp, &r);
+            resamp_free(&r);
+        }
+    }
+}
+
+//  Unit tones through the whole chain, halfbands included.  Passband
+//    tones out to RS_PASS of the lower rate should come out at unit
+//    gain, whatever else comes out with them (images going up) is
+//    leakage; stopband tones, from RS_STOP of the output rate to the
+//    input's edge, should leave next to nothing after aliasing down.
+//    The state carries from tone to tone; RS_CHECK_SKIP covers it.
+
+#define RS_CHECK_IN     (32 * BLOCK)        // input pairs per tone
+#define RS_CHECK_SKIP   (256)               // output pairs, filters settling
+#define RS_MAX_RIPPLE   (0.05)              // dB, peak to peak
+#define RS_MIN_ATTEN    (RS_ATTEN - 6.0)    // dB, Kaiser estimate's margin
+
+static double rs_tone(resamp_t *r, double f, double *gain)
+{
+    static float x[2 * RS_CHECK_IN], y[4 * RS_CHECK_IN + 16];
+    for (int i=0; i<RS_CHECK_IN; i++) {
+        double a = 2.0 * 3.14159265358979 * f * i / r->in_rate;
+        x[2*i  ] = (float)cos(a);
+        x[2*i+1] = (float)sin(a);
+    }
+    int n = resamp_process(r, x, RS_CHECK_IN, y) - RS_CHECK_SKIP;
+    float *z = &y[2 * RS_CHECK_SKIP];
+    double ci = 0.0, cq = 0.0, total = 0.0, rest = 0.0;
+    for (int k=0; k<n; k++) {                   // correlate against f
+        double a = -2.0 * 3.14159265358979 * f * k / r->out_rate;
+        ci += z[2*k] * cos(a) - z[2*k+1] * sin(a);
+        cq += z[2*k] * sin(a) + z[2*k+1] * cos(a);
+        total += z[2*k] * z[2*k] + z[2*k+1] * z[2*k+1];
+    }
+    ci /= n;
+    cq /= n;
+    for (int k=0; k<n; k++) {                   // and what isn't f
+        double a = 2.0 * 3.14159265358979 * f * k / r->out_rate;
+        double ei = z[2*k  ] - (ci * cos(a) - cq * sin(a));
+        double eq = z[2*k+1] - (ci * sin(a) + cq * cos(a));
+        rest += ei * ei + eq * eq;
+    }
+    if (gain == NULL) { return(total / n); }
+    *gain = sqrt(ci * ci + cq * cq);
+    return(rest / n);
+}
+
+static int check_resamp(void)
+{
+    static resamp_t r;
+    int fails = 0;
+    char v[64];
+    for (int i=0; i<4; i++) {
+        for (int j=0; j<13; j++) {
+            long hw = rsHw[i], client = rsClient[j];
+            if (client == hw) { continue; }
+            if (resamp_init(&r, (double)hw, (double)client) < 0) {
+                continue;
+            }
+            double lo   = (client < hw) ? client : hw;
+            double gmin = 1e9, gmax = 0.0, leak = 0.0, g;
+            for (int t=-4; t<=4; t++) {
+                double p = rs_tone(&r, 0.25 * t * RS_PASS * lo, &g);
+                if (g < gmin) { gmin = g; }
+                if (g > gmax) { gmax = g; }
+                if (p > leak) { leak = p; }
+            }
+            double edge = 0.5 * hw - RS_STOP * client;
+            for (int t=0; client<hw && t<3; t++) {
+                for (int s=-1; s<=1; s+=2) {
+                    double f = s * (RS_STOP * client + 0.49 * t * edge);
+                    double p = rs_tone(&r, f, NULL);   // aliases land anywhere
+                    if (p > leak) { leak = p; }
+                }
+            }
+            resamp_free(&r);
+            double ripple = 20.0 * log10(gmax / gmin);
+            double atten  = (leak > 0.0) ? -10.0 * log10(leak) : 200.0;
+            snprintf(v, sizeof(v), "%ld to %ld", hw, client);
+            printf("%-24s %-22s ripple %.4f dB, stopband %.1f dB\n",
+                   "resamp_check", v, ripple, atten);
+            report_check("resamp_check", v, "\"ripple_db\": %.4f, "
+                         "\"stopband_db\": %.2f", ripple, atten);
+            if (ripple > RS_MAX_RIPPLE || atten < RS_MIN_ATTEN) {
+                printf("resamp_check : %s outside %.2f dB ripple, "
+                       "%.0f dB stopband\n", v, RS_MAX_RIPPLE, RS_MIN_ATTEN);
+                fails += 1;
+            }
+        }
+    }
+    return(fails);
+}
+
+int main(int argc, char *argv[])
+{
+    char *jsonPath = NULL;
+    for (int arg=1; arg+1<argc; arg+=2) {
+        if      (strcmp(argv[arg], "-t") == 0) { benchSeconds = atof(argv[arg+1]); }
+        else if (strcmp(argv[arg], "-j") == 0) { jsonPath = argv[arg+1]; }
+        else if (strcmp(argv[arg], "-k") == 0) { filter = argv[arg+1]; }
+        else {
+            printf("Usage: hfp_bench [-t seconds per kernel] "
+                   "[-j results.json] [-k name filter]\n");
+            exit(0);
+        }
+    }
+    const char *kernels = dsp_init();
+    printf("dsp kernels: %s, %d IQ pairs per call\n", kernels, BLOCK);
+
+    uint32_t seed = 1;
+    for (int i=0; i<BLOCK; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        float noise = 0.01f * ((float)(seed >> 8) / 16777216.0f - 0.5f);
+        src[2*i  ] = 0.5f * cosf(0.01f * i) + noise;
+        src[2*i+1] = 0.5f * sinf(0.01f * i) - noise;
+    }
+    if (jsonPath != NULL) {
+        json = fopen(jsonPath, "w");
+        if (json == NULL) {
+            printf("can't write %s\n", jsonPath);
+            exit(-1);
+        }
+        fprintf(json, "{\n  \"dsp_kernels\": \"%s\",\n  \"pairs\": %d,\n"
+                "  \"results\": [", kernels, BLOCK);
+    }
+
+    run_ring();
+    run_quantize();
+    run_iir();
+    run_codec();
+    run_nco();
+    run_fft();
+    run_resamp();
+    int fails = check_bfp();
+    fails += check_dither();
+    fails += check_codec();
+    fails += check_iir();
+    fails += check_nco();
+    fails += check_fft();
+    fails += check_resamp();
+
+    if (json != NULL) {
+        fprintf(json, "\n  ]\n}\n");
+        fclose(json);
+        printf("%d results written to %s\n", results, jsonPath);
+    }
+    return((fails > 0) ? 1 : 0);
+}
+
+// eof
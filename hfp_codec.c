@@ -0,0 +1,235 @@
+//
+//  hfp_codec.c
+//
+//  lossless frame codec for the hfp_tcp compressed stream,
+//    see hfp_codec.h for the format.  The decoder is the reference
+//    for clients; hfp_load uses it.
+//
+//   re-distribution under the BSD 3 clause license permitted
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hfp_codec.h"
+
+typedef struct bitWriter {
+    uint8_t     *p;
+    uint64_t    acc;
+    int         n;              // bits in acc not yet stored
+} bitWriter;
+
+typedef struct bitReader {
+    const uint8_t *p, *end;
+    uint64_t    acc;
+    int         n;
+} bitReader;
+
+static inline void put_bits(bitWriter *w, uint32_t v, int n)   // n <= 32
+{
+    w->acc = (w->acc << n) | (v & (uint32_t)((1ULL << n) - 1));
+    w->n  += n;
+    while (w->n >= 8) {
+        w->n -= 8;
+        *w->p++ = (uint8_t)(w->acc >> w->n);
+    }
+}
+
+static inline uint32_t get_bits(bitReader *r, int n)
+{
+    while (r->n < n) {
+        r->acc = (r->acc << 8) | ((r->p < r->end) ? *r->p++ : 0);
+        r->n  += 8;
+    }
+    r->n -= n;
+    return((uint32_t)(r->acc >> r->n) & (uint32_t)((1ULL << n) - 1));
+}
+
+static inline uint32_t zigzag(int32_t r)
+{
+    return(((uint32_t)r << 1) ^ (uint32_t)(r >> 31));
+}
+
+static inline int32_t unzigzag(uint32_t u)
+{
+    return((int32_t)(u >> 1) ^ -(int32_t)(u & 1));
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return(p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+//  one component (0 : I, 1 : Q) of the wire format, as signed ints
+
+static void unpack(const uint8_t *in, int pairs, int bits, int ch, int32_t *x)
+{
+    if (bits == 8) {
+        for (int i=0; i<pairs; i++) { x[i] = (int32_t)in[2*i+ch] - 128; }
+    } else if (bits == 16) {
+        for (int i=0; i<pairs; i++) {
+            x[i] = (int16_t)(in[4*i+2*ch] | (in[4*i+2*ch+1] << 8));
+        }
+    } else if (ch == 0) {       // 12-bit packed, see quantize_12
+        for (int i=0; i<pairs; i++) {
+            int32_t v = in[3*i] | ((in[3*i+1] & 0x0f) << 8);
+            x[i] = (v & 0x800) ? v - 4096 : v;
+        }
+    } else {
+        for (int i=0; i<pairs; i++) {
+            int32_t v = (in[3*i+1] >> 4) | (in[3*i+2] << 4);
+            x[i] = (v & 0x800) ? v - 4096 : v;
+        }
+    }
+}
+
+static void pack(const int32_t *xi, const int32_t *xq, int pairs, int bits,
+                 uint8_t *out)
+{
+    for (int i=0; i<pairs; i++) {
+        if (bits == 8) {
+            out[2*i  ] = (uint8_t)(xi[i] + 128);
+            out[2*i+1] = (uint8_t)(xq[i] + 128);
+        } else if (bits == 16) {
+            out[4*i  ] = (uint8_t)xi[i];
+            out[4*i+1] = (uint8_t)(xi[i] >> 8);
+            out[4*i+2] = (uint8_t)xq[i];
+            out[4*i+3] = (uint8_t)(xq[i] >> 8);
+        } else {
+            out[3*i  ] = (uint8_t)xi[i];
+            out[3*i+1] = (uint8_t)((xi[i] >> 8) & 0x0f) | (uint8_t)(xq[i] << 4);
+            out[3*i+2] = (uint8_t)(xq[i] >> 4);
+        }
+    }
+}
+
+long codec_max_bytes(int pairs)         // 6 bytes per escaped sample
+{
+    return(CODEC_HEADER + 12L * pairs + 2L * (pairs / CODEC_PART + 1) + 8);
+}
+
+//  Encodes pairs IQ samples of the given width, returns the frame size
+
+long codec_encode(codec_t *z, const uint8_t *in, int pairs, int bits,
+                  uint8_t *out)
+{
+    if (pairs > CODEC_MAX_PAIRS) { pairs = CODEC_MAX_PAIRS; }
+    bitWriter w = { out + CODEC_HEADER, 0, 0 };
+    for (int ch=0; ch<2; ch++) {
+        int32_t  *x = z->x[0];
+        uint32_t *u = z->u;
+        unpack(in, pairs, bits, ch, x);
+        uint64_t e0 = 0, e1 = 0, e2 = 0;    // pick the order by |residual|
+        int32_t  x1 = 0, x2 = 0;
+        for (int i=0; i<pairs; i++) {
+            int32_t d1 = x[i] - x1, d2 = d1 - (x1 - x2);
+            e0 += (uint32_t)abs(x[i]);
+            e1 += (uint32_t)abs(d1);
+            e2 += (uint32_t)abs(d2);
+            x2  = x1;
+            x1  = x[i];
+        }
+        int order = (e1 < e0) ? ((e2 < e1) ? 2 : 1) : ((e2 < e0) ? 2 : 0);
+        x1 = 0; x2 = 0;
+        for (int i=0; i<pairs; i++) {
+            int32_t r = x[i];
+            if (order == 1) { r = x[i] - x1; }
+            if (order == 2) { r = x[i] - 2 * x1 + x2; }
+            u[i] = zigzag(r);
+            x2   = x1;
+            x1   = x[i];
+        }
+        put_bits(&w, order, 2);
+        for (int p=0; p<pairs; p+=CODEC_PART) {
+            int n = pairs - p;
+            if (n > CODEC_PART) { n = CODEC_PART; }
+            uint64_t sum = 0;
+            for (int i=0; i<n; i++) { sum += u[p+i]; }
+            int k = 0;
+            while (k < CODEC_MAX_K && ((uint64_t)n << (k + 1)) < sum) { k++; }
+            put_bits(&w, k, 5);
+            for (int i=0; i<n; i++) {
+                uint32_t q = u[p+i] >> k;
+                if (q < CODEC_ESC) {
+                    put_bits(&w, ((1u << q) - 1) << 1, q + 1);
+                    if (k > 0) { put_bits(&w, u[p+i], k); }
+                } else {
+                    put_bits(&w, (1u << CODEC_ESC) - 1, CODEC_ESC);
+                    put_bits(&w, u[p+i], 24);
+                }
+            }
+        }
+    }
+    if (w.n > 0) { put_bits(&w, 0, 8 - w.n); }
+    long payload = (long)(w.p - out) - CODEC_HEADER;
+    memcpy(out, "HFPZ", 4);
+    out[4] = CODEC_VERSION;
+    out[5] = (uint8_t)bits;
+    out[6] = 0;
+    out[7] = 0;
+    put32(out + 8, (uint32_t)pairs);
+    put32(out + 12, (uint32_t)payload);
+    return(CODEC_HEADER + payload);
+}
+
+//  Checks a frame header, returns the whole frame's size or -1
+
+long codec_frame_bytes(const uint8_t *hdr, int *pairs, int *bits)
+{
+    if (memcmp(hdr, "HFPZ", 4) != 0 || hdr[4] != CODEC_VERSION) { return(-1); }
+    int  b = hdr[5];
+    long n = (long)get32(hdr + 8);
+    long m = (long)get32(hdr + 12);
+    if (b != 8 && b != 12 && b != 16) { return(-1); }
+    if (n > CODEC_MAX_PAIRS || m > codec_max_bytes((int)n)) { return(-1); }
+    *pairs = (int)n;
+    *bits  = b;
+    return(CODEC_HEADER + m);
+}
+
+//  Decodes a whole frame back to the wire format, returns bytes written,
+//    or -1 for a bad header
+
+long codec_decode(codec_t *z, const uint8_t *frame, uint8_t *out)
+{
+    int  pairs = 0, bits = 0;
+    long sz = codec_frame_bytes(frame, &pairs, &bits);
+    if (sz < 0) { return(-1); }
+    bitReader r = { frame + CODEC_HEADER, frame + sz, 0, 0 };
+    for (int ch=0; ch<2; ch++) {
+        int32_t *x = z->x[ch];
+        int32_t x1 = 0, x2 = 0;
+        int order = (int)get_bits(&r, 2);
+        for (int p=0; p<pairs; p+=CODEC_PART) {
+            int n = pairs - p;
+            if (n > CODEC_PART) { n = CODEC_PART; }
+            int k = (int)get_bits(&r, 5);
+            for (int i=0; i<n; i++) {
+                uint32_t q = 0;
+                while (q < CODEC_ESC && get_bits(&r, 1)) { q++; }
+                uint32_t u;
+                if (q == CODEC_ESC) {
+                    u = get_bits(&r, 24);
+                } else {
+                    u = (q << k) | ((k > 0) ? get_bits(&r, k) : 0);
+                }
+                int32_t v = unzigzag(u);
+                if (order == 1) { v += x1; }
+                if (order == 2) { v += 2 * x1 - x2; }
+                x[p+i] = v;
+                x2 = x1;
+                x1 = v;
+            }
+        }
+    }
+    pack(z->x[0], z->x[1], pairs, bits, out);
+    return((long)pairs * ((bits == 8) ? 2 : ((bits == 12) ? 3 : 4)));
+}
+
+// eof
@@ -0,0 +1,49 @@
+//
+//  hfp_codec.h
+//
+//  lossless compression of the integer sample formats for hfp_tcp :
+//    fixed polynomial prediction (order 0, 1 or 2, chosen per frame
+//    and per component), then Rice coded residuals with a parameter
+//    per partition, as in FLAC.  Frames are self contained.
+//
+//  frame : 16 byte header, little end first
+//     0  "HFPZ"
+//     4  version (1)
+//     5  sample bits (8, 12 or 16)
+//     6  reserved (0, 2 bytes)
+//     8  IQ pairs in the frame (4 bytes)
+//    12  payload bytes that follow (4 bytes)
+//  payload : a bit stream, most significant bit first, for I and then Q :
+//    predictor order (2 bits), then per partition of CODEC_PART samples
+//    the Rice parameter (5 bits) and the residuals, zigzag mapped.
+//    A quotient of CODEC_ESC or more is sent as CODEC_ESC ones
+//    followed by the value in 24 bits.  The stream is zero padded
+//    to a whole byte.
+//
+//   re-distribution under the BSD 3 clause license permitted
+//
+
+#ifndef HFP_CODEC_H
+#define HFP_CODEC_H
+
+#include <stdint.h>
+
+#define CODEC_HEADER    (16)
+#define CODEC_VERSION   (1)
+#define CODEC_MAX_PAIRS (16384) // per frame
+#define CODEC_PART      (256)   // samples per Rice parameter
+#define CODEC_MAX_K     (20)
+#define CODEC_ESC       (24)    // unary length that escapes to raw
+
+typedef struct codec_t {        // scratch, one per encoding or decoding thread
+    int32_t     x[2][CODEC_MAX_PAIRS];
+    uint32_t    u[CODEC_MAX_PAIRS];
+} codec_t;
+
+long    codec_max_bytes(int pairs);
+long    codec_encode(codec_t *z, const uint8_t *in, int pairs, int bits,
+                     uint8_t *out);
+long    codec_frame_bytes(const uint8_t *hdr, int *pairs, int *bits);
+long    codec_decode(codec_t *z, const uint8_t *frame, uint8_t *out);
+
+#endif  // HFP_CODEC_H
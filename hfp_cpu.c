@@ -0,0 +1,46 @@
+//
+//  hfp_cpu.c
+//
+//  Thread placement for hfp_tcp, see hfp_cpu.h
+//
+//   re-distribution under the BSD 3 clause license permitted
+//
+
+#ifdef __linux__
+#define _GNU_SOURCE             // pthread_setaffinity_np, CPU_SET
+#include <sched.h>
+#endif
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "hfp_cpu.h"
+
+int cpu_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return((n > 0) ? (int)n : 1);
+}
+
+//  Linux only; macOS has affinity tags, not cores, and nothing
+//    here is worth a hint that may be ignored
+
+int cpu_pin(int cpu)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int m = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (m != 0) {
+        printf("could not pin a thread to cpu %d, error %d\n", cpu, m);
+        return(-1);
+    }
+    return(0);
+#else
+    (void)cpu;
+    return(-1);
+#endif
+}
+
+// eof
@@ -0,0 +1,18 @@
+//
+//  hfp_cpu.h
+//
+//  Thread placement for hfp_tcp : with several HF+ in one process,
+//    each one's usb transfer thread and dsp worker get a core of
+//    their own, so one receiver's bursts don't evict the other's
+//    tiles and filter state, or delay its transfers.
+//
+//   re-distribution under the BSD 3 clause license permitted
+//
+
+#ifndef HFP_CPU_H
+#define HFP_CPU_H
+
+int     cpu_count(void);        // cores online, at least 1
+int     cpu_pin(int cpu);       // the calling thread; 0, or -1 if not supported
+
+#endif  // HFP_CPU_H
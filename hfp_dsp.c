@@ -0,0 +1,940 @@
+//
+//  hfp_dsp.c
+//
+//  sample processing for hfp_tcp
+//
+//   re-distribution under the BSD 3 clause license permitted
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "hfp_dsp.h"
+
+float rand_float_co(void)
+{
+    Float32_t x;
+    x.i = 0x3f800000 | (rand() & 0x007fffff);
+    return(x.f - 1.0f);
+}
+
+void iir_f2(float *s, int n, iirParams *p) // IQ or stereo
+{
+    float	a0, a1, a2, b0, b1, b2;
+    float 	x2L,x1L,x0L,y2L,y1L,y0L;
+    float 	x2R,x1R,x0R,y2R,y1R,y0R;
+    int   	i, k;
+
+    a0 = p->a0 ;
+    a1 = p->a1 ;
+    a2 = p->a2 ;
+    b0 = p->b0 ;
+    b1 = p->b1 ;
+    b2 = p->b2 ;
+    k  = p->ftype;
+
+    x1L = p->xs_1L;			// recover history
+    x0L = p->xs_0L;
+    y1L = p->ys_1L;
+    y0L = p->ys_0L;
+    x1R = p->xs_1R;			// recover history
+    x0R = p->xs_0R;
+    y1R = p->ys_1R;
+    y0R = p->ys_0R;
+    if (k == 1) {			/* type 1 = lowpass  */
+      for (i=0; i<n; i+=2) { 		// +=2 for interleaved
+        x2L = s[i  ]; 
+	y2L = b0 * x2L + b1 * x1L + b2 * x0L - a1 * y1L - a2 * y0L;
+        s[i  ] = y2L;
+        y0L = y1L; y1L = y2L;
+        x0L = x1L; x1L = x2L;
+	//
+        x2R = s[i+1]; 
+	y2R = b0 * x2R + b1 * x1R + b2 * x0R - a1 * y1R - a2 * y0R;
+        s[i+1] = y2R;
+        y0R = y1R; y1R = y2R;
+        x0R = x1R; x1R = x2R;
+      }
+    }
+    p->xs_1L = x1L;		// save history
+    p->xs_0L = x0L;
+    p->ys_1L = y1L;
+    p->ys_0L = y0L;
+    p->xs_1R = x1R;		// save history
+    p->xs_0R = x0R;
+    p->ys_1R = y1R;
+    p->ys_0R = y0R;
+}
+
+void calc_iir_coefs(int ftype, float cf, float q, float sr, iirParams *p)
+{
+    double        w0, alpha;
+    double        b0,b1,b2,a0,a1,a2;
+    double	  g1, dbg;		// dB gain
+    double        y;
+
+    a0 = 0.0;
+    a1 = 0.0;
+    a2 = 0.0;
+    b0 = 0.0;
+    b1 = 0.0;
+    b2 = 0.0;
+    if (ftype == 3) {              // bandpass w/ 0 gain
+	dbg = 0.0;
+	g1 = sqrt(pow(10.0, (dbg / 20.0)));
+        w0 = 2.0 * 3.14159265358979 * cf / sr;
+	alpha = sin(w0)/(2.0 * q);
+	b0 =  alpha;
+	b1 =  0.0;
+	b2 = -alpha;
+	a0 =  1.0 + alpha;
+	a1 = -2.0 * cos(w0);
+	a2 =  1.0 - alpha;
+    } else if (ftype == 1) {  // lowpass
+	dbg = 0.0;
+	g1 = sqrt(pow(10.0, (dbg / 20.0)));
+        w0 = 2.0 * 3.14159265358979 * cf / sr;
+	alpha = sin(w0)/(2.0 * q);
+	if (ftype == 1) y = 1.0 - cos(w0);
+	else            y = 1.0 + cos(w0);
+	b0 =  y / 2.0;
+	b1 =  y;
+	b2 =  y / 2.0;
+	a0 =  1.0 + alpha;
+	a1 = -2.0 * cos(w0);
+	a2 =  1.0 - alpha;
+    }
+    p->a0 = a0;
+    p->a1 = a1/a0;
+    p->a2 = a2/a0;
+    p->b0 = b0/a0;
+    p->b1 = b1/a0;
+    p->b2 = b2/a0;
+    p->ys_1L =  0.0;
+    p->ys_0L =  0.0;
+    p->xs_1L =  0.0;
+    p->xs_0L =  0.0;
+    p->ys_1R =  0.0;
+    p->ys_0R =  0.0;
+    p->xs_1R =  0.0;
+    p->xs_0R =  0.0;
+    p->sr    =  sr;
+    p->cf    =  cf;
+    p->q     =  q;
+    p->ftype =  ftype;
+}
+
+// iir float biquad cascade
+// butterworth biquad cascade
+double bbcascade[36] = {
+  0.70710678, 0.0,0.0, 0.0,0.0,0.0,
+  0.54119610, 1.3065630, 0.0, 0.0,0.0,0.0,
+  0.51763809, 0.70710678, 1.9318517, 0.0,0.0,0.0,
+  0.50979558, 0.60134489, 0.89997622, 2.5629154, 0.0, 0.0,
+  0.50623256, 0.56116312, 0.70710678, 1.1013446, 3.1962266, 0.0,
+  0.50431448, 0.54119610, 0.63023621, 0.82133982, 1.3065630, 3.8306488
+};
+
+struct iirParams ipbc[36];
+
+void init_ipbc(double sr, double cf)
+{
+    int i,j;
+    for (j=0;j<6;j++) {
+       for (i=0;i<6;i++) {
+	  int ftype = 0;
+	  int k = 6*j + i;
+	  iirParams *p = &ipbc[k];
+	  float q = bbcascade[k];
+	  if (q > 0.0) { ftype = 1; }	// low pass
+	  calc_iir_coefs(ftype, cf, q, sr, p);
+       }
+    }
+}
+
+void iir_fbc(float *s, int n, int order)
+{
+    int num_biquads = order / 2;
+    int k = 0;
+    int batch = 4096; // 16384 fits in dcache
+    while (k < n) {
+        int m = batch;
+	if (k + batch > n) { m = n - k; }
+        for (int b=0;b<6;b++) {
+            int j = 6*(num_biquads-1) + b;
+            iirParams *p = &ipbc[j];
+            if (p->ftype == 1) {
+	        iir_f2(&s[k], m, p);
+            }
+        }
+	k += batch;
+    }
+}
+
+void init_iir(void)
+{
+    double        sr, bw;
+    sr =  192000.0;
+    bw =   16000.0;
+    	// int type = 1; // lowpass
+        // call calc_iir_coefs(type, bw, q, sr, &pp);
+        //   with 6 sets of 6 coeffs for 2nd to 12th order filtering
+    init_ipbc(sr, bw);
+        // int order =  12;		// set filter order
+        // iir_fbc(&uu[0], n, order);
+}
+
+//  stage by stage reference : each biquad makes its own pass
+
+void iir_biquads_init(iirParams *bq, int order, double sr, double cf)
+{
+    int nb = order / 2;
+    if (nb < 1) { nb = 1; }
+    if (nb > 6) { nb = 6; }
+    for (int b=0; b<nb; b++) {
+        float q = bbcascade[6*(nb-1) + b];
+        calc_iir_coefs(1, cf, q, sr, &bq[b]);	// low pass
+    }
+}
+
+void iir_biquads(float *s, int n, iirParams *bq, int order)
+{
+    int nb = order / 2;
+    int k = 0;
+    int batch = 4096;
+    while (k < n) {
+        int m = batch;
+	if (k + batch > n) { m = n - k; }
+        for (int b=0;b<nb;b++) {
+	    iir_f2(&s[k], m, &bq[b]);
+        }
+	k += batch;
+    }
+}
+
+//  Pipelined cascade : all stages in one pass over the data.
+//    Stage k works on the sample stage k-1 finished on the previous
+//    step, so the stages of one step are independent and sit side by
+//    side in SIMD lanes (2k = I, 2k+1 = Q).  Unused stages pass their
+//    input through, so the output is the iir_biquads() result,
+//    to the bit, delayed by IIR_PIPE_DELAY samples.
+//    Every stage runs whatever the order, so below iir_pipe_order
+//    (set by dsp_init from the kernel's speed) iir_filter() runs
+//    the stages one by one instead, with no delay.
+
+void iir_cascade_init(iirCascade *c, int order, double sr, double cf)
+{
+    iirParams bq[IIR_MAX_STAGES];
+    int nb = order / 2;
+    if (nb < 1) { nb = 1; }
+    if (nb > IIR_MAX_STAGES) { nb = IIR_MAX_STAGES; }
+    iir_biquads_init(bq, 2 * nb, sr, cf);
+    bzero((char *)c, sizeof(iirCascade));
+    for (int k=0; k<IIR_MAX_STAGES; k++) {
+        for (int j=2*k; j<2*k+2; j++) {
+            if (k < nb) {
+                c->b0[j] = bq[k].b0;
+                c->b1[j] = bq[k].b1;
+                c->b2[j] = bq[k].b2;
+                c->a1[j] = bq[k].a1;
+                c->a2[j] = bq[k].a2;
+            } else {
+                c->b0[j] = 1.0f;    // pass through
+            }
+        }
+    }
+    c->order = 2 * nb;
+    c->pipe  = (c->order >= iir_pipe_order);
+    c->delay = c->pipe ? IIR_PIPE_DELAY : 0;
+    iir_biquads_init(c->bq, c->order, sr, cf);
+}
+
+void iir_filter(float *s, int n, iirCascade *c)
+{
+    if (c->pipe) {
+        iir_cascade(s, n, c);
+    } else {
+        iir_biquads(s, n, c->bq, c->order);
+    }
+}
+
+void iir_cascade_scalar(float *s, int n, iirCascade *c)
+{
+    float x1[IIR_LANES], x0[IIR_LANES], y1[IIR_LANES], y0[IIR_LANES];
+    float x[IIR_LANES];
+    memcpy(x1, c->x1, sizeof(x1));
+    memcpy(x0, c->x0, sizeof(x0));
+    memcpy(y1, c->y1, sizeof(y1));
+    memcpy(y0, c->y0, sizeof(y0));
+    for (int i=0; i<n; i+=2) {
+        x[0] = s[i  ];
+        x[1] = s[i+1];
+        for (int j=2; j<IIR_LANES; j++) { x[j] = y1[j-2]; }
+        for (int j=0; j<IIR_LANES; j++) {
+            float y = c->b0[j] * x[j] + c->b1[j] * x1[j] + c->b2[j] * x0[j]
+                      - c->a1[j] * y1[j] - c->a2[j] * y0[j];
+            x0[j] = x1[j]; x1[j] = x[j];
+            y0[j] = y1[j]; y1[j] = y;
+        }
+        s[i  ] = y1[IIR_LANES-2];
+        s[i+1] = y1[IIR_LANES-1];
+    }
+    memcpy(c->x1, x1, sizeof(x1));
+    memcpy(c->x0, x0, sizeof(x0));
+    memcpy(c->y1, y1, sizeof(y1));
+    memcpy(c->y0, y0, sizeof(y0));
+}
+
+#if defined(__SSE2__)
+
+//  3 vectors of 2 stages each, same operation order as iir_f2()
+
+void iir_cascade_sse2(float *s, int n, iirCascade *c)
+{
+    __m128 b0[3], b1[3], b2[3], a1[3], a2[3];
+    __m128 x1[3], x0[3], y1[3], y0[3], x[3];
+    for (int v=0; v<3; v++) {
+        b0[v] = _mm_loadu_ps(&c->b0[4*v]);
+        b1[v] = _mm_loadu_ps(&c->b1[4*v]);
+        b2[v] = _mm_loadu_ps(&c->b2[4*v]);
+        a1[v] = _mm_loadu_ps(&c->a1[4*v]);
+        a2[v] = _mm_loadu_ps(&c->a2[4*v]);
+        x1[v] = _mm_loadu_ps(&c->x1[4*v]);
+        x0[v] = _mm_loadu_ps(&c->x0[4*v]);
+        y1[v] = _mm_loadu_ps(&c->y1[4*v]);
+        y0[v] = _mm_loadu_ps(&c->y0[4*v]);
+    }
+    for (int i=0; i<n; i+=2) {
+        __m128 in = _mm_castpd_ps(_mm_load_sd((double *)&s[i]));
+        // each stage's input is the previous stage's last output
+        x[0] = _mm_shuffle_ps(in,    y1[0], _MM_SHUFFLE(1,0,1,0));
+        x[1] = _mm_shuffle_ps(y1[0], y1[1], _MM_SHUFFLE(1,0,3,2));
+        x[2] = _mm_shuffle_ps(y1[1], y1[2], _MM_SHUFFLE(1,0,3,2));
+        for (int v=0; v<3; v++) {
+            __m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(b0[v], x[v]),
+                                             _mm_mul_ps(b1[v], x1[v])),
+                                  _mm_mul_ps(b2[v], x0[v]));
+            y = _mm_sub_ps(_mm_sub_ps(y, _mm_mul_ps(a1[v], y1[v])),
+                           _mm_mul_ps(a2[v], y0[v]));
+            x0[v] = x1[v]; x1[v] = x[v];
+            y0[v] = y1[v]; y1[v] = y;
+        }
+        _mm_storeh_pi((__m64 *)&s[i], y1[2]);
+    }
+    for (int v=0; v<3; v++) {
+        _mm_storeu_ps(&c->x1[4*v], x1[v]);
+        _mm_storeu_ps(&c->x0[4*v], x0[v]);
+        _mm_storeu_ps(&c->y1[4*v], y1[v]);
+        _mm_storeu_ps(&c->y0[4*v], y0[v]);
+    }
+}
+#endif  // __SSE2__
+
+#if defined(__ARM_NEON)
+
+void iir_cascade_neon(float *s, int n, iirCascade *c)
+{
+    float32x4_t b0[3], b1[3], b2[3], a1[3], a2[3];
+    float32x4_t x1[3], x0[3], y1[3], y0[3], x[3];
+    for (int v=0; v<3; v++) {
+        b0[v] = vld1q_f32(&c->b0[4*v]);
+        b1[v] = vld1q_f32(&c->b1[4*v]);
+        b2[v] = vld1q_f32(&c->b2[4*v]);
+        a1[v] = vld1q_f32(&c->a1[4*v]);
+        a2[v] = vld1q_f32(&c->a2[4*v]);
+        x1[v] = vld1q_f32(&c->x1[4*v]);
+        x0[v] = vld1q_f32(&c->x0[4*v]);
+        y1[v] = vld1q_f32(&c->y1[4*v]);
+        y0[v] = vld1q_f32(&c->y0[4*v]);
+    }
+    for (int i=0; i<n; i+=2) {
+        float32x2_t in = vld1_f32(&s[i]);
+        x[0] = vextq_f32(vcombine_f32(in, in), y1[0], 2);
+        x[1] = vextq_f32(y1[0], y1[1], 2);
+        x[2] = vextq_f32(y1[1], y1[2], 2);
+        for (int v=0; v<3; v++) {
+            // separate multiplies and adds, no fused rounding
+            float32x4_t y = vaddq_f32(vaddq_f32(vmulq_f32(b0[v], x[v]),
+                                                vmulq_f32(b1[v], x1[v])),
+                                      vmulq_f32(b2[v], x0[v]));
+            y = vsubq_f32(vsubq_f32(y, vmulq_f32(a1[v], y1[v])),
+                          vmulq_f32(a2[v], y0[v]));
+            x0[v] = x1[v]; x1[v] = x[v];
+            y0[v] = y1[v]; y1[v] = y;
+        }
+        vst1_f32(&s[i], vget_high_f32(y1[2]));
+    }
+    for (int v=0; v<3; v++) {
+        vst1q_f32(&c->x1[4*v], x1[v]);
+        vst1q_f32(&c->x0[4*v], x0[v]);
+        vst1q_f32(&c->y1[4*v], y1[v]);
+        vst1q_f32(&c->y0[4*v], y0[v]);
+    }
+}
+#endif  // __ARM_NEON
+
+//  frequency shift by -freq : moves a signal at +freq to 0 Hz
+
+void nco_set(nco_t *o, double freq, double sr)
+{
+    double w = -2.0 * 3.14159265358979 * freq / sr;
+    o->dre  = cos(w);
+    o->dim  = sin(w);
+    o->dre4 = cos(4.0 * w);
+    o->dim4 = sin(4.0 * w);
+    o->freq = freq;
+    if (o->re == 0.0f && o->im == 0.0f) { o->re = 1.0f; }
+}
+
+//  pairs i..n one at a time, then the phasor is renormalized once
+
+static void nco_mix_tail(float *d, const float *s, int i, int n,
+                         float re, float im, nco_t *o)
+{
+    float dre = o->dre, dim = o->dim;
+    for (; i<n; i++) {
+        float x = s[2*i  ];
+        float y = s[2*i+1];
+        d[2*i  ] = x * re - y * im;
+        d[2*i+1] = x * im + y * re;
+        float t = re * dre - im * dim;
+        im      = re * dim + im * dre;
+        re      = t;
+    }
+    float mag = sqrtf(re * re + im * im);	// renormalize once per block
+    o->re = re / mag;
+    o->im = im / mag;
+}
+
+void nco_mix_scalar(float *d, const float *s, int n, nco_t *o)
+{
+    nco_mix_tail(d, s, 0, n, o->re, o->im, o);
+}
+
+//  The SIMD versions run 4 phasors, one sample apart, each stepped
+//    by 4 samples' rotation, so there is no serial dependency from
+//    one sample to the next.  Lane 0 carries on into the tail.
+
+static void nco_lanes(const nco_t *o, float *lr, float *li)
+{
+    float re = o->re, im = o->im;
+    for (int k=0; k<4; k++) {
+        lr[k] = re;
+        li[k] = im;
+        float t = re * o->dre - im * o->dim;
+        im      = re * o->dim + im * o->dre;
+        re      = t;
+    }
+}
+
+#if defined(__SSE2__)
+
+void nco_mix_sse2(float *d, const float *s, int n, nco_t *o)
+{
+    float  lr[4], li[4];
+    nco_lanes(o, lr, li);
+    __m128 re  = _mm_loadu_ps(lr);
+    __m128 im  = _mm_loadu_ps(li);
+    __m128 dr4 = _mm_set1_ps(o->dre4);
+    __m128 di4 = _mm_set1_ps(o->dim4);
+    int    i   = 0;
+    for (; i+4<=n; i+=4) {
+        __m128 a = _mm_loadu_ps(&s[2*i]);
+        __m128 b = _mm_loadu_ps(&s[2*i+4]);
+        __m128 x = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0));
+        __m128 y = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1));
+        __m128 oi = _mm_sub_ps(_mm_mul_ps(x, re), _mm_mul_ps(y, im));
+        __m128 oq = _mm_add_ps(_mm_mul_ps(x, im), _mm_mul_ps(y, re));
+        _mm_storeu_ps(&d[2*i],   _mm_unpacklo_ps(oi, oq));
+        _mm_storeu_ps(&d[2*i+4], _mm_unpackhi_ps(oi, oq));
+        __m128 t = _mm_sub_ps(_mm_mul_ps(re, dr4), _mm_mul_ps(im, di4));
+        im = _mm_add_ps(_mm_mul_ps(re, di4), _mm_mul_ps(im, dr4));
+        re = t;
+    }
+    _mm_storeu_ps(lr, re);
+    _mm_storeu_ps(li, im);
+    nco_mix_tail(d, s, i, n, lr[0], li[0], o);
+}
+#endif  // __SSE2__
+
+#if defined(__ARM_NEON)
+
+void nco_mix_neon(float *d, const float *s, int n, nco_t *o)
+{
+    float  lr[4], li[4];
+    nco_lanes(o, lr, li);
+    float32x4_t re  = vld1q_f32(lr);
+    float32x4_t im  = vld1q_f32(li);
+    float32x4_t dr4 = vdupq_n_f32(o->dre4);
+    float32x4_t di4 = vdupq_n_f32(o->dim4);
+    int i = 0;
+    for (; i+4<=n; i+=4) {
+        float32x4x2_t v = vld2q_f32(&s[2*i]);   // I and Q apart
+        float32x4x2_t w;
+        w.val[0] = vsubq_f32(vmulq_f32(v.val[0], re), vmulq_f32(v.val[1], im));
+        w.val[1] = vaddq_f32(vmulq_f32(v.val[0], im), vmulq_f32(v.val[1], re));
+        vst2q_f32(&d[2*i], w);
+        float32x4_t t = vsubq_f32(vmulq_f32(re, dr4), vmulq_f32(im, di4));
+        im = vaddq_f32(vmulq_f32(re, di4), vmulq_f32(im, dr4));
+        re = t;
+    }
+    vst1q_f32(lr, re);
+    vst1q_f32(li, im);
+    nco_mix_tail(d, s, i, n, lr[0], li[0], o);
+}
+#endif  // __ARM_NEON
+
+//  keep every decim'th IQ pair, in place; cntr carries across blocks
+
+int decimate_iq(float *s, int n, int decim, int *cntr)
+{
+    int j = 0;
+    int c = *cntr;
+    if (decim <= 1) { return(n); }
+    for (int i=0; i<n; i++) {
+        if (c == 0) {
+            s[2*j  ] = s[2*i  ];
+            s[2*j+1] = s[2*i+1];
+            j += 1;
+        }
+        c += 1;
+        if (c >= decim) { c = 0; }
+    }
+    *cntr = c;
+    return(j);
+}
+
+//  8-bit quantization with triangular (TPDF) dither.
+//    Each component gets u[i] - u[i-2], the difference of successive
+//    uniform [0..1) values for that component, which is triangular
+//    on (-1..1) and pushes the rounding noise up in frequency.
+//    Output is clipped to 0..255, 128 = zero.
+
+static inline uint8_t clip_u8(int k)
+{
+    k += 128;                  // 8-bit unsigned DC offset
+    if (k <   0) { k =   0; }
+    if (k > 255) { k = 255; }
+    return((uint8_t)k);
+}
+
+//  reference version, libc rand() per sample
+
+int quantize_8_ref(const float *p, int n, float gain, uint8_t *out,
+                   dither_t *d)
+{
+    float  g8  =  gain; // GAIN8;
+    // gain is typically 64.0
+    // should be 128.0 or 2X larger, so 1-bit missing
+    float rnd0A = rand_float_co();
+    float rnd0B = rand_float_co();
+    float acc   = d->acc;
+    for (int i=0; i<2*n; i++) {
+        float x;
+        x    = p[i];
+        float y = g8 * x;
+        // add triangular noise
+        // for noise filtered rounding
+        float rnd1 = rand_float_co(); // noise with pdf [0..1)
+        float r = rnd1 - (((i&1)==1) ? rnd0A : rnd0B);
+        y = y + r;
+        float ry = roundf(y);
+        acc += (y - ry);       // for future noise filtering
+        out[i] = clip_u8((int)ry);
+        if ((i&1) == 1) {      // round I
+            rnd0A = rnd1;      // save for next iteration
+        } else {               // round Q
+            rnd0B = rnd1;      // save for next iteration
+        }
+    }
+    d->acc = acc;
+    return(2 * n);
+}
+
+//  xorshift32 : 3 shifts and 3 xors per 32 random bits,
+//    easy to run in several SIMD lanes at once
+
+static inline uint32_t xorshift32(uint32_t x)
+{
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x <<  5;
+    return(x);
+}
+
+static inline float xs_float_co(uint32_t x)   // [0..1) from the top bits
+{
+    Float32_t f;
+    f.i = 0x3f800000 | (x >> 9);
+    return(f.f - 1.0f);
+}
+
+void dither_init(dither_t *d, uint32_t seed)
+{
+    uint32_t x = seed ? seed : 0x2545f491;
+    for (int i=0; i<8; i++) {
+        x = xorshift32(x + 0x9e3779b9);
+        d->s[i] = x ? x : 1;
+    }
+    d->prev[0] = 0.5f;
+    d->prev[1] = 0.5f;
+    d->acc     = 0.0f;
+}
+
+//  scalar xorshift version, also finishes the SIMD kernels' tails
+
+static int quantize_8_tail(const float *p, int i, int n2, float g8,
+                           uint8_t *out, dither_t *d)
+{
+    uint32_t x = d->s[0];
+    for ( ; i<n2; i++) {
+        x = xorshift32(x);
+        float u = xs_float_co(x);
+        float y = g8 * p[i] + (u - d->prev[i&1]);
+        d->prev[i&1] = u;
+        out[i] = clip_u8((int)roundf(y));
+    }
+    d->s[0] = x;
+    return(n2);
+}
+
+int quantize_8_scalar(const float *p, int n, float gain, uint8_t *out,
+                      dither_t *d)
+{
+    return(quantize_8_tail(p, 0, 2*n, gain, out, d));
+}
+
+#if defined(__SSE2__)
+
+//  16 components per pass : 4 lanes of xorshift, each vector's
+//    u[i-2] comes from the top of the previous vector
+
+int quantize_8_sse2(const float *p, int n, float gain, uint8_t *out,
+                    dither_t *d)
+{
+    int n2 = 2 * n;
+    int i  = 0;
+    __m128i s    = _mm_loadu_si128((__m128i *)&d->s[0]);
+    __m128i one  = _mm_set1_epi32(0x3f800000);
+    __m128i k128 = _mm_set1_epi16(128);
+    __m128  g    = _mm_set1_ps(gain);
+    __m128  fone = _mm_set1_ps(1.0f);
+    __m128  last = _mm_setr_ps(0.0f, 0.0f, d->prev[0], d->prev[1]);
+    for ( ; i + 16 <= n2; i += 16) {
+        __m128i k[4];
+        for (int j=0; j<4; j++) {
+            s = _mm_xor_si128(s, _mm_slli_epi32(s, 13));
+            s = _mm_xor_si128(s, _mm_srli_epi32(s, 17));
+            s = _mm_xor_si128(s, _mm_slli_epi32(s,  5));
+            __m128 u  = _mm_sub_ps(_mm_castsi128_ps(
+                            _mm_or_si128(_mm_srli_epi32(s, 9), one)), fone);
+            __m128 u2 = _mm_shuffle_ps(last, u, _MM_SHUFFLE(1,0,3,2));
+            __m128 y  = _mm_add_ps(_mm_mul_ps(g, _mm_loadu_ps(&p[i+4*j])),
+                                   _mm_sub_ps(u, u2));
+            k[j] = _mm_cvtps_epi32(y);          // round to nearest
+            last = u;
+        }
+        __m128i a = _mm_adds_epi16(_mm_packs_epi32(k[0], k[1]), k128);
+        __m128i b = _mm_adds_epi16(_mm_packs_epi32(k[2], k[3]), k128);
+        _mm_storeu_si128((__m128i *)&out[i], _mm_packus_epi16(a, b));
+    }
+    _mm_storeu_si128((__m128i *)&d->s[0], s);
+    float lf[4];
+    _mm_storeu_ps(lf, last);
+    d->prev[0] = lf[2];
+    d->prev[1] = lf[3];
+    return(quantize_8_tail(p, i, n2, gain, out, d));
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#define HFP_HAVE_AVX2   1
+
+//  32 components per pass, 8 lanes; built with a target attribute
+//    so the rest of the file does not require AVX2
+
+__attribute__((target("avx2")))
+int quantize_8_avx2(const float *p, int n, float gain, uint8_t *out,
+                    dither_t *d)
+{
+    int n2 = 2 * n;
+    int i  = 0;
+    __m256i s    = _mm256_loadu_si256((__m256i *)&d->s[0]);
+    __m256i one  = _mm256_set1_epi32(0x3f800000);
+    __m256i k128 = _mm256_set1_epi16(128);
+    __m256i perm = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    __m256  g    = _mm256_set1_ps(gain);
+    __m256  fone = _mm256_set1_ps(1.0f);
+    __m256  last = _mm256_setr_ps(0.0f, 0.0f, 0.0f, 0.0f,
+                                  0.0f, 0.0f, d->prev[0], d->prev[1]);
+    for ( ; i + 32 <= n2; i += 32) {
+        __m256i k[4];
+        for (int j=0; j<4; j++) {
+            s = _mm256_xor_si256(s, _mm256_slli_epi32(s, 13));
+            s = _mm256_xor_si256(s, _mm256_srli_epi32(s, 17));
+            s = _mm256_xor_si256(s, _mm256_slli_epi32(s,  5));
+            __m256 u  = _mm256_sub_ps(_mm256_castsi256_ps(
+                         _mm256_or_si256(_mm256_srli_epi32(s, 9), one)), fone);
+            // u[i-2] : last[6], last[7], u[0] .. u[5]
+            __m256 t  = _mm256_permute2f128_ps(last, u, 0x21);
+            __m256 u2 = _mm256_shuffle_ps(t, u, _MM_SHUFFLE(1,0,3,2));
+            __m256 y  = _mm256_add_ps(
+                            _mm256_mul_ps(g, _mm256_loadu_ps(&p[i+8*j])),
+                            _mm256_sub_ps(u, u2));
+            k[j] = _mm256_cvtps_epi32(y);
+            last = u;
+        }
+        __m256i a = _mm256_adds_epi16(_mm256_packs_epi32(k[0], k[1]), k128);
+        __m256i b = _mm256_adds_epi16(_mm256_packs_epi32(k[2], k[3]), k128);
+        __m256i c = _mm256_packus_epi16(a, b);  // packs work per 128-bit lane
+        _mm256_storeu_si256((__m256i *)&out[i],
+                            _mm256_permutevar8x32_epi32(c, perm));
+    }
+    _mm256_storeu_si256((__m256i *)&d->s[0], s);
+    float lf[8];
+    _mm256_storeu_ps(lf, last);
+    d->prev[0] = lf[6];
+    d->prev[1] = lf[7];
+    return(quantize_8_tail(p, i, n2, gain, out, d));
+}
+#endif  // gcc or clang
+#endif  // __SSE2__
+
+#if defined(__ARM_NEON)
+
+int quantize_8_neon(const float *p, int n, float gain, uint8_t *out,
+                    dither_t *d)
+{
+    int n2 = 2 * n;
+    int i  = 0;
+    uint32x4_t s    = vld1q_u32(&d->s[0]);
+    uint32x4_t one  = vdupq_n_u32(0x3f800000);
+    int16x8_t  k128 = vdupq_n_s16(128);
+    float32x4_t fone = vdupq_n_f32(1.0f);
+    float32x4_t last = vdupq_n_f32(0.0f);
+    last = vsetq_lane_f32(d->prev[0], last, 2);
+    last = vsetq_lane_f32(d->prev[1], last, 3);
+    for ( ; i + 16 <= n2; i += 16) {
+        int32x4_t k[4];
+        for (int j=0; j<4; j++) {
+            s = veorq_u32(s, vshlq_n_u32(s, 13));
+            s = veorq_u32(s, vshrq_n_u32(s, 17));
+            s = veorq_u32(s, vshlq_n_u32(s,  5));
+            float32x4_t u  = vsubq_f32(vreinterpretq_f32_u32(
+                                 vorrq_u32(vshrq_n_u32(s, 9), one)), fone);
+            float32x4_t u2 = vextq_f32(last, u, 2);
+            float32x4_t y  = vmlaq_n_f32(vsubq_f32(u, u2),
+                                         vld1q_f32(&p[i+4*j]), gain);
+#if defined(__aarch64__)
+            k[j] = vcvtnq_s32_f32(y);           // round to nearest
+#else
+            uint32x4_t sgn = vandq_u32(vreinterpretq_u32_f32(y),
+                                       vdupq_n_u32(0x80000000));
+            float32x4_t h  = vreinterpretq_f32_u32(
+                                 vorrq_u32(sgn, vreinterpretq_u32_f32(
+                                                 vdupq_n_f32(0.5f))));
+            k[j] = vcvtq_s32_f32(vaddq_f32(y, h));  // round half away
+#endif
+            last = u;
+        }
+        int16x8_t a = vqaddq_s16(vcombine_s16(vqmovn_s32(k[0]),
+                                              vqmovn_s32(k[1])), k128);
+        int16x8_t b = vqaddq_s16(vcombine_s16(vqmovn_s32(k[2]),
+                                              vqmovn_s32(k[3])), k128);
+        vst1q_u8(&out[i], vcombine_u8(vqmovun_s16(a), vqmovun_s16(b)));
+    }
+    vst1q_u32(&d->s[0], s);
+    d->prev[0] = vgetq_lane_f32(last, 2);
+    d->prev[1] = vgetq_lane_f32(last, 3);
+    return(quantize_8_tail(p, i, n2, gain, out, d));
+}
+#endif  // __ARM_NEON
+
+quantize_8_fn  quantize_8  = quantize_8_scalar;
+iir_cascade_fn iir_cascade = iir_cascade_scalar;
+int            iir_pipe_order = 10;     // scalar, 6 with SIMD
+nco_mix_fn     nco_mix     = nco_mix_scalar;
+
+//  pick the fastest kernels this cpu can run, returns their name
+
+const char *dsp_init(void)
+{
+    const char *name = "scalar";
+    quantize_8  = quantize_8_scalar;
+    iir_cascade = iir_cascade_scalar;
+    iir_pipe_order = 10;
+    nco_mix     = nco_mix_scalar;
+#if defined(__SSE2__)
+    quantize_8  = quantize_8_sse2;
+    iir_cascade = iir_cascade_sse2;
+    iir_pipe_order = 6;
+    nco_mix     = nco_mix_sse2;
+    name = "sse2";
+#if defined(HFP_HAVE_AVX2)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        quantize_8 = quantize_8_avx2;
+        name = "avx2";
+    }
+#endif
+#elif defined(__ARM_NEON)
+    quantize_8  = quantize_8_neon;
+    iir_cascade = iir_cascade_neon;
+    iir_pipe_order = 6;
+    nco_mix     = nco_mix_neon;
+    name = "neon";
+#endif
+    if (getenv("HFP_NO_SIMD") != NULL) {      // for comparisons
+        quantize_8  = quantize_8_scalar;
+        iir_cascade = iir_cascade_scalar;
+        iir_pipe_order = 10;
+        nco_mix     = nco_mix_scalar;
+        name = "scalar";
+    }
+    return(name);
+}
+
+int quantize_16(const float *p, int n, float gain, uint8_t *out)
+{
+    int16_t *tmp16ptr = (int16_t *)out;
+    float  g16  =   64.0 * gain; // GAIN16;
+    // gain is typically 64.0 * 64.0 = 4096.0
+    // should be 32768.0 or 8X larger, so 3-bits missing
+    for (int i=0; i<2*n; i++) {
+        float x = g16 * p[i];
+        int   k = (int)roundf(x);
+        tmp16ptr[i] = k;
+    }
+    return(4 * n);
+}
+
+//  packed 12-bit : 3 bytes per IQ pair, signed, little end first,
+//    I bits 0-7, then I bits 8-11 with Q bits 0-3 in the high nibble,
+//    then Q bits 4-11 (the SoapySDR CS12 layout).
+//  Nominal gain puts a full scale input at half of the 12-bit range,
+//    the same headroom as quantize_8 with 4 more bits below it.
+
+int quantize_12(const float *p, int n, float gain, uint8_t *out)
+{
+    float  g12  =   16.0f * gain;
+    for (int i=0; i<n; i++) {
+        float x = g12 * p[2*i  ];
+        float y = g12 * p[2*i+1];
+        if (x >  2047.0f) { x =  2047.0f; }
+        if (x < -2048.0f) { x = -2048.0f; }
+        if (y >  2047.0f) { y =  2047.0f; }
+        if (y < -2048.0f) { y = -2048.0f; }
+        int   k = (int)lrintf(x);
+        int   m = (int)lrintf(y);
+        out[3*i  ] = (uint8_t)( k       & 0xff);
+        out[3*i+1] = (uint8_t)((k >> 8) & 0x0f) | (uint8_t)((m & 0x0f) << 4);
+        out[3*i+2] = (uint8_t)((m >> 4) & 0xff);
+    }
+    return(3 * n);
+}
+
+//  block floating point : BFP_PAIRS IQ pairs share one power of two
+//    scale.  Each block is a 2 byte header, the exponent e (signed)
+//    and a block counter (mod 256), then signed 8-bit I,Q mantissas m,
+//    x = m * 2^(e - 7), with 1.0 the HF+ full scale.  e is the smallest
+//    that keeps the block's peak within +-127, so weak signals keep
+//    all 8 bits and strong ones don't clip.  Gain doesn't apply.
+
+//  largest |x| over n IQ pairs
+float peak_abs(const float *p, int n)
+{
+    int   i  = 0;
+    float mx = 0.0f;
+#if defined(__SSE2__)
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 m0 = _mm_setzero_ps(), m1 = _mm_setzero_ps();
+    for ( ; i+8 <= 2*n; i+=8) {
+        m0 = _mm_max_ps(m0, _mm_andnot_ps(sign, _mm_loadu_ps(&p[i  ])));
+        m1 = _mm_max_ps(m1, _mm_andnot_ps(sign, _mm_loadu_ps(&p[i+4])));
+    }
+    m0 = _mm_max_ps(m0, m1);
+    m0 = _mm_max_ps(m0, _mm_movehl_ps(m0, m0));
+    m0 = _mm_max_ss(m0, _mm_shuffle_ps(m0, m0, 1));
+    mx = _mm_cvtss_f32(m0);
+#elif defined(__ARM_NEON)
+    float32x4_t m0 = vdupq_n_f32(0.0f), m1 = vdupq_n_f32(0.0f);
+    for ( ; i+8 <= 2*n; i+=8) {
+        m0 = vmaxq_f32(m0, vabsq_f32(vld1q_f32(&p[i  ])));
+        m1 = vmaxq_f32(m1, vabsq_f32(vld1q_f32(&p[i+4])));
+    }
+    m0 = vmaxq_f32(m0, m1);
+    float32x2_t h = vmax_f32(vget_low_f32(m0), vget_high_f32(m0));
+    mx = vget_lane_f32(vpmax_f32(h, h), 0);
+#endif
+    for ( ; i < 2*n; i++) {
+        float a = fabsf(p[i]);
+        mx = (a > mx) ? a : mx;
+    }
+    return(mx);
+}
+
+//  one block of BFP_PAIRS pairs, returns BFP_FRAME
+int quantize_bfp(const float *p, uint8_t seq, uint8_t *out)
+{
+    float mx = peak_abs(p, BFP_PAIRS);
+    int   e  = BFP_EXP_MIN;
+    if (mx > 0.0f) {
+        frexpf(mx / 127.0f, &e);        // mx / 127 < 2^e
+        e += 7;
+        if (ldexpf(mx, 7 - (e - 1)) <= 127.0f) { e -= 1; }
+        if (e < BFP_EXP_MIN) { e = BFP_EXP_MIN; }
+        if (e > BFP_EXP_MAX) { e = BFP_EXP_MAX; }
+    }
+    float  g  = ldexpf(1.0f, 7 - e);
+    int8_t *m = (int8_t *)(out + BFP_HEADER);
+    int    i  = 0;
+#if defined(__SSE2__)
+    const __m128 vg = _mm_set1_ps(g), lo = _mm_set1_ps(-127.0f);
+    for ( ; i+16 <= 2*BFP_PAIRS; i+=16) {  // packs saturate above 127
+        __m128i a = _mm_cvtps_epi32(_mm_max_ps(lo, _mm_mul_ps(vg, _mm_loadu_ps(&p[i   ]))));
+        __m128i b = _mm_cvtps_epi32(_mm_max_ps(lo, _mm_mul_ps(vg, _mm_loadu_ps(&p[i+ 4]))));
+        __m128i c = _mm_cvtps_epi32(_mm_max_ps(lo, _mm_mul_ps(vg, _mm_loadu_ps(&p[i+ 8]))));
+        __m128i d = _mm_cvtps_epi32(_mm_max_ps(lo, _mm_mul_ps(vg, _mm_loadu_ps(&p[i+12]))));
+        _mm_storeu_si128((__m128i *)&m[i],
+                         _mm_packs_epi16(_mm_packs_epi32(a, b),
+                                         _mm_packs_epi32(c, d)));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for ( ; i+8 <= 2*BFP_PAIRS; i+=8) {     // saturating narrows
+        int32x4_t a = vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(&p[i  ]), g));
+        int32x4_t b = vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(&p[i+4]), g));
+        int16x8_t h = vcombine_s16(vqmovn_s32(a), vqmovn_s32(b));
+        vst1_s8(&m[i], vmax_s8(vqmovn_s16(h), vdup_n_s8(-127)));
+    }
+#endif
+    for ( ; i<2*BFP_PAIRS; i++) {
+        float x = g * p[i];
+        x = (x >  127.0f) ?  127.0f : x;
+        x = (x < -127.0f) ? -127.0f : x;
+        m[i] = (int8_t)lrintf(x);
+    }
+    out[0] = (uint8_t)(int8_t)e;
+    out[1] = seq;
+    return(BFP_FRAME);
+}
+
+//  reference decoder for clients : one block back to float IQ,
+//    returns the block counter
+int bfp_decode(const uint8_t *in, float *out)
+{
+    int          e = (int8_t)in[0];
+    float        g = ldexpf(1.0f, e - 7);
+    const int8_t *m = (const int8_t *)(in + BFP_HEADER);
+    for (int i=0; i<2*BFP_PAIRS; i++) { out[i] = g * m[i]; }
+    return(in[1]);
+}
+
+// eof
@@ -0,0 +1,150 @@
+//
+//  hfp_dsp.h
+//
+//  sample processing for hfp_tcp :
+//    biquad filters, mixing, decimation and quantization
+//    of interleaved float32 IQ data
+//
+//   re-distribution under the BSD 3 clause license permitted
+//
+
+#ifndef HFP_DSP_H
+#define HFP_DSP_H
+
+#include <stdint.h>
+
+typedef union
+{
+    uint32_t i;
+    float    f;
+} Float32_t;
+
+typedef struct iirParams {
+    float 	a0;
+    float 	a1;
+    float 	a2;
+    float 	b0;	
+    float 	b1;	
+    float 	b2;	
+    float 	ys_2L;	// saved history
+    float 	ys_1L;
+    float 	ys_0L;	// last output
+    float 	xs_2L;
+    float 	xs_1L;
+    float 	xs_0L;	// last input
+    float 	ys_2R;	// saved history
+    float 	ys_1R;
+    float 	ys_0R;	// last output
+    float 	xs_2R;
+    float 	xs_1R;
+    float 	xs_0R;	// last input
+    float	sr;
+    float	cf;
+    float	q;
+    int32_t 	ftype;
+} iirParams;
+
+#define IIR_MAX_STAGES  (6)                     // 12th order
+#define IIR_LANES       (2 * IIR_MAX_STAGES)    // I and Q per stage
+#define IIR_PIPE_DELAY  (IIR_MAX_STAGES - 1)    // samples, see iir_cascade
+
+typedef struct iirCascade {     // lowpass biquads run as one pipeline
+    float       b0[IIR_LANES], b1[IIR_LANES], b2[IIR_LANES];
+    float       a1[IIR_LANES], a2[IIR_LANES];
+    float       x1[IIR_LANES], x0[IIR_LANES];   // per stage history
+    float       y1[IIR_LANES], y0[IIR_LANES];   // y1 : last output
+    int         order;
+    int         pipe;           // order >= iir_pipe_order : the pipeline
+    int         delay;          // samples, IIR_PIPE_DELAY or 0
+    iirParams   bq[IIR_MAX_STAGES];     // otherwise stage by stage
+} iirCascade;
+
+typedef struct dither_t {      // TPDF dither state for quantize_8
+    uint32_t    s[8];           // xorshift32, one per SIMD lane
+    float       prev[2];        // last uniform value for I and Q
+    float       acc;            // accumulated rounding (reference only)
+} dither_t;
+
+typedef struct nco_t {          // complex oscillator for frequency shifts
+    float       re, im;         // current phasor
+    float       dre, dim;       // rotation per sample
+    float       dre4, dim4;     // and per 4 samples, for the SIMD lanes
+    double      freq;
+} nco_t;
+
+float   rand_float_co(void);
+
+void    iir_f2(float *s, int n, iirParams *p);
+void    calc_iir_coefs(int ftype, float cf, float q, float sr, iirParams *p);
+void    init_ipbc(double sr, double cf);
+void    iir_fbc(float *s, int n, int order);
+void    init_iir(void);
+
+//  lowpass butterworth cascade of order/2 biquads (order 2..12),
+//    s is n interleaved floats (n/2 IQ pairs)
+void    iir_biquads_init(iirParams *bq, int order, double sr, double cf);
+void    iir_biquads(float *s, int n, iirParams *bq, int order);
+
+//  the same filter, all stages in one pass, IIR_PIPE_DELAY samples later
+typedef void (*iir_cascade_fn)(float *s, int n, iirCascade *c);
+extern iir_cascade_fn iir_cascade;      // set by dsp_init()
+extern int iir_pipe_order;              // lowest order it pays off at
+void    iir_cascade_init(iirCascade *c, int order, double sr, double cf);
+void    iir_filter(float *s, int n, iirCascade *c);     // c->delay later
+void    iir_cascade_scalar(float *s, int n, iirCascade *c);
+#if defined(__SSE2__)
+void    iir_cascade_sse2(float *s, int n, iirCascade *c);
+#endif
+#if defined(__ARM_NEON)
+void    iir_cascade_neon(float *s, int n, iirCascade *c);
+#endif
+
+//  nco_set keeps the phasor, so a new frequency is phase continuous
+void    nco_set(nco_t *o, double freq, double sr);
+typedef void (*nco_mix_fn)(float *d, const float *s, int n, nco_t *o);
+extern nco_mix_fn nco_mix;              // set by dsp_init(), d may be s
+void    nco_mix_scalar(float *d, const float *s, int n, nco_t *o);
+#if defined(__SSE2__)
+void    nco_mix_sse2(float *d, const float *s, int n, nco_t *o);
+#endif
+#if defined(__ARM_NEON)
+void    nco_mix_neon(float *d, const float *s, int n, nco_t *o);
+#endif
+int     decimate_iq(float *s, int n, int decim, int *cntr);
+
+//  float IQ (n pairs) to rtl_tcp style samples, returns bytes written
+typedef int (*quantize_8_fn)(const float *p, int n, float gain,
+                             uint8_t *out, dither_t *d);
+extern quantize_8_fn quantize_8;        // set by dsp_init()
+int     quantize_8_ref(const float *p, int n, float gain, uint8_t *out,
+                       dither_t *d);
+int     quantize_8_scalar(const float *p, int n, float gain, uint8_t *out,
+                          dither_t *d);
+#if defined(__SSE2__)
+int     quantize_8_sse2(const float *p, int n, float gain, uint8_t *out,
+                        dither_t *d);
+#if defined(__GNUC__) || defined(__clang__)
+int     quantize_8_avx2(const float *p, int n, float gain, uint8_t *out,
+                        dither_t *d);
+#endif
+#endif
+#if defined(__ARM_NEON)
+int     quantize_8_neon(const float *p, int n, float gain, uint8_t *out,
+                        dither_t *d);
+#endif
+int     quantize_16(const float *p, int n, float gain, uint8_t *out);
+int     quantize_12(const float *p, int n, float gain, uint8_t *out);
+
+#define BFP_PAIRS       (64)    // IQ pairs per block floating point block
+#define BFP_HEADER      (2)     // exponent, block counter
+#define BFP_FRAME       (BFP_HEADER + 2 * BFP_PAIRS)
+#define BFP_EXP_MIN     (-100)
+#define BFP_EXP_MAX     (  20)
+float   peak_abs(const float *p, int n);
+int     quantize_bfp(const float *p, uint8_t seq, uint8_t *out);
+int     bfp_decode(const uint8_t *in, float *out);
+void    dither_init(dither_t *d, uint32_t seed);
+
+const char *dsp_init(void);             // selects SIMD kernels at runtime
+
+#endif  // HFP_DSP_H
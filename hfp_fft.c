@@ -0,0 +1,189 @@
+//
+//  hfp_fft.c
+//
+//  complex FFT for hfp_tcp, see hfp_fft.h
+//
+//   re-distribution under the BSD 3 clause license permitted
+//
+
+#define _POSIX_C_SOURCE 200112L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "hfp_fft.h"
+
+//  Twiddles for the stage of half size h (2, 4 .. n/2) start at point
+//    h - 2, two floats per point : wr holds [cos cos] and wi [-sin sin]
+//    of exp(-i pi j / h), so a butterfly's complex multiply is
+//    b * wr + swap(b) * wi, with no shuffles of the twiddles.
+
+int fft_plan_init(fft_plan_t *p, int n)
+{
+    int log2n = 0;
+    while ((1 << log2n) < n) { log2n += 1; }
+    if (n < FFT_MIN_SIZE || n > FFT_MAX_SIZE || (1 << log2n) != n) {
+        printf("fft: size %d is not a power of two, %d to %d\n",
+               n, FFT_MIN_SIZE, FFT_MAX_SIZE);
+        return(-1);
+    }
+    p->n     = n;
+    p->log2n = log2n;
+    p->rev   = (int *)malloc(sizeof(int) * n);
+    p->wr    = (float *)malloc(sizeof(float) * 2 * n);
+    p->wi    = (float *)malloc(sizeof(float) * 2 * n);
+    if (p->rev == NULL || p->wr == NULL || p->wi == NULL) {
+        fft_plan_free(p);
+        return(-1);
+    }
+    for (int i=0; i<n; i++) {
+        int r = 0;
+        for (int b=0; b<log2n; b++) { r |= ((i >> b) & 1) << (log2n - 1 - b); }
+        p->rev[i] = r;
+    }
+    for (int h=2; h<n; h*=2) {
+        for (int j=0; j<h; j++) {
+            double a = 3.14159265358979 * j / h;
+            int    k = 2 * (h - 2 + j);
+            p->wr[k  ] = (float)cos(a);
+            p->wr[k+1] = (float)cos(a);
+            p->wi[k  ] = (float)sin(a);     // -(-sin)
+            p->wi[k+1] = (float)-sin(a);
+        }
+    }
+    p->exec = fft_forward_scalar;
+#if defined(__SSE2__)
+    p->exec = fft_forward_sse2;
+#elif defined(__ARM_NEON)
+    p->exec = fft_forward_neon;
+#endif
+    if (getenv("HFP_NO_SIMD") != NULL) { p->exec = fft_forward_scalar; }
+    return(0);
+}
+
+void fft_plan_free(fft_plan_t *p)
+{
+    free(p->rev);
+    free(p->wr);
+    free(p->wi);
+    p->rev = NULL;
+    p->wr  = NULL;
+    p->wi  = NULL;
+}
+
+//  bit reversal, then the first stage : h = 1, no twiddles
+
+static void fft_first(const fft_plan_t *p, float *x)
+{
+    for (int i=0; i<p->n; i++) {
+        int r = p->rev[i];
+        if (r > i) {
+            float t0 = x[2*i], t1 = x[2*i+1];
+            x[2*i]   = x[2*r];
+            x[2*i+1] = x[2*r+1];
+            x[2*r]   = t0;
+            x[2*r+1] = t1;
+        }
+    }
+    for (int i=0; i<2*p->n; i+=4) {
+        float ar = x[i],   ai = x[i+1];
+        float br = x[i+2], bi = x[i+3];
+        x[i]   = ar + br;
+        x[i+1] = ai + bi;
+        x[i+2] = ar - br;
+        x[i+3] = ai - bi;
+    }
+}
+
+void fft_forward_scalar(const fft_plan_t *p, float *x)
+{
+    fft_first(p, x);
+    for (int h=2; h<p->n; h*=2) {
+        const float *wr = &p->wr[2 * (h - 2)];
+        const float *wi = &p->wi[2 * (h - 2)];
+        for (int k=0; k<p->n; k+=2*h) {
+            float *a = &x[2*k];
+            float *b = &x[2*(k+h)];
+            for (int j=0; j<2*h; j+=2) {
+                float tr = b[j] * wr[j] - b[j+1] * wi[j+1];
+                float ti = b[j] * wi[j+1] + b[j+1] * wr[j];
+                b[j]   = a[j]   - tr;
+                b[j+1] = a[j+1] - ti;
+                a[j]   += tr;
+                a[j+1] += ti;
+            }
+        }
+    }
+}
+
+#if defined(__SSE2__)
+
+void fft_forward_sse2(const fft_plan_t *p, float *x)
+{
+    fft_first(p, x);
+    for (int h=2; h<p->n; h*=2) {
+        const float *wr = &p->wr[2 * (h - 2)];
+        const float *wi = &p->wi[2 * (h - 2)];
+        for (int k=0; k<p->n; k+=2*h) {
+            float *a = &x[2*k];
+            float *b = &x[2*(k+h)];
+            for (int j=0; j<2*h; j+=4) {         // two butterflies
+                __m128 va = _mm_loadu_ps(&a[j]);
+                __m128 vb = _mm_loadu_ps(&b[j]);
+                __m128 sw = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(2,3,0,1));
+                __m128 t  = _mm_add_ps(_mm_mul_ps(vb, _mm_loadu_ps(&wr[j])),
+                                       _mm_mul_ps(sw, _mm_loadu_ps(&wi[j])));
+                _mm_storeu_ps(&a[j], _mm_add_ps(va, t));
+                _mm_storeu_ps(&b[j], _mm_sub_ps(va, t));
+            }
+        }
+    }
+}
+#endif  // __SSE2__
+
+#if defined(__ARM_NEON)
+
+void fft_forward_neon(const fft_plan_t *p, float *x)
+{
+    fft_first(p, x);
+    for (int h=2; h<p->n; h*=2) {
+        const float *wr = &p->wr[2 * (h - 2)];
+        const float *wi = &p->wi[2 * (h - 2)];
+        for (int k=0; k<p->n; k+=2*h) {
+            float *a = &x[2*k];
+            float *b = &x[2*(k+h)];
+            for (int j=0; j<2*h; j+=4) {         // two butterflies
+                float32x4_t va = vld1q_f32(&a[j]);
+                float32x4_t vb = vld1q_f32(&b[j]);
+                float32x4_t sw = vrev64q_f32(vb);
+                float32x4_t t  = vaddq_f32(vmulq_f32(vb, vld1q_f32(&wr[j])),
+                                           vmulq_f32(sw, vld1q_f32(&wi[j])));
+                vst1q_f32(&a[j], vaddq_f32(va, t));
+                vst1q_f32(&b[j], vsubq_f32(va, t));
+            }
+        }
+    }
+}
+#endif  // __ARM_NEON
+
+void fft_window(float *w, int n)
+{
+    double sum = 0.0;
+    for (int i=0; i<n; i++) {
+        double a = 2.0 * 3.14159265358979 * i / n;
+        w[i] = (float)(0.35875 - 0.48829 * cos(a) + 0.14128 * cos(2.0 * a)
+                       - 0.01168 * cos(3.0 * a));
+        sum += w[i];
+    }
+    for (int i=0; i<n; i++) { w[i] = (float)(w[i] / sum); }
+}
+
+// eof
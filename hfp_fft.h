@@ -0,0 +1,44 @@
+//
+//  hfp_fft.h
+//
+//  complex FFT for hfp_tcp's spectrum stream :
+//    in place, radix 2, decimation in time, on interleaved float IQ.
+//    A plan holds the bit reversal table and per-stage twiddles laid
+//    out for the SIMD butterflies, which do two butterflies per
+//    128-bit vector (SSE2 or NEON); the first stage is scalar.
+//
+//   re-distribution under the BSD 3 clause license permitted
+//
+
+#ifndef HFP_FFT_H
+#define HFP_FFT_H
+
+#define FFT_MIN_SIZE    (64)
+#define FFT_MAX_SIZE    (16384)
+
+struct fft_plan_t;
+typedef void (*fft_fn)(const struct fft_plan_t *p, float *x);
+
+typedef struct fft_plan_t {
+    int         n;              // points, a power of two
+    int         log2n;
+    int         *rev;           // bit reversal permutation
+    float       *wr;            // per stage twiddles, [re re] per point
+    float       *wi;            //   and [-im im], see fft_plan_init
+    fft_fn      exec;           // fastest kernel, unless HFP_NO_SIMD
+} fft_plan_t;
+
+int     fft_plan_init(fft_plan_t *p, int n);
+void    fft_plan_free(fft_plan_t *p);
+void    fft_forward_scalar(const fft_plan_t *p, float *x);
+#if defined(__SSE2__)
+void    fft_forward_sse2(const fft_plan_t *p, float *x);
+#endif
+#if defined(__ARM_NEON)
+void    fft_forward_neon(const fft_plan_t *p, float *x);
+#endif
+
+//  4 term Blackman-Harris, scaled so a full scale tone reads 0 dB
+void    fft_window(float *w, int n);
+
+#endif  // HFP_FFT_H
@@ -0,0 +1,324 @@
+//
+//  hfp_load.c
+//
+//  Load test client for hfp_tcp : opens N rtl_tcp sessions, sends
+//    each the same commands, reads for a while, and reports sustained
+//    throughput, receive gaps, and CPU use of this client and,
+//    on Linux, of the server process.
+//
+//    hfp_load [-h host] [-p port] [-n sessions] [-t seconds]
+//             [-r rate] [-f frequency] [-g gain_tenths_dB]
+//             [-G gap_ms] [-w warmup_seconds] [-P server_pid] [-z 1]
+//
+//  -z 1 asks for compressed (HFPZ) frames and decodes every one,
+//    so rates are counted in decoded samples.
+//
+//   re-distribution under the BSD 3 clause license permitted
+//
+
+#define _POSIX_C_SOURCE 200112L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <netdb.h>
+
+#include "hfp_dsp.h"
+#include "hfp_codec.h"
+
+#define MAX_SESSIONS    (64)
+#define CMD_COMPRESS    (0x60)
+
+typedef struct session_t {
+    int         id;
+    int         sockfd;
+    int         bits;           // from the HFP0 header
+    long long   bytes;          // after warmup
+    long long   pairs;          // decoded, -z only
+    long long   frames;
+    int         bad;            // frames that didn't decode, resynced
+    int         gaps;           // receive gaps longer than gapMs
+    double      max_gap;        // seconds
+    double      elapsed;
+    int         error;
+    pthread_t   thread;
+} session_t;
+
+char        *host       =  "localhost";
+char        *port       =  "1234";
+int         nSessions   =  1;
+double      duration    =  10.0;
+double      warmup      =  1.0;
+long        rate        =  0;
+long        freq        =  0;
+long        gain        = -1;
+double      gapMs       =  100.0;
+int         serverPid   =  0;
+int         compress    =  0;
+
+session_t   sessions[MAX_SESSIONS];
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(ts.tv_sec + 1e-9 * ts.tv_nsec);
+}
+
+static int connect_to(const char *h, const char *p)
+{
+    struct addrinfo hints, *res, *ai;
+    int fd = -1;
+    bzero((char *)&hints, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(h, p, &hints, &res) != 0) { return(-1); }
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) { continue; }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) { break; }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return(fd);
+}
+
+static int send_command(int fd, int msg, long data)
+{
+    unsigned char cmd[5];
+    cmd[0] = msg;
+    cmd[1] = (data >> 24) & 0xff;
+    cmd[2] = (data >> 16) & 0xff;
+    cmd[3] = (data >>  8) & 0xff;
+    cmd[4] =  data        & 0xff;
+    return((send(fd, cmd, 5, 0) == 5) ? 0 : -1);
+}
+
+static int recv_all(int fd, unsigned char *p, int n)
+{
+    int k = 0;
+    while (k < n) {
+        int m = recv(fd, p + k, n - k, 0);
+        if (m <= 0) { return(-1); }
+        k += m;
+    }
+    return(0);
+}
+
+static void *session_run(void *param)
+{
+    session_t *s = (session_t *)param;
+    unsigned char header[16];
+    static unsigned char sink[MAX_SESSIONS][256 * 1024];
+
+    s->sockfd = connect_to(host, port);
+    if (s->sockfd < 0) {
+        fprintf(stderr, "session %d: connect failed\n", s->id);
+        s->error = 1;
+        return(NULL);
+    }
+    if (recv_all(s->sockfd, header, 12) < 0) { s->error = 1; return(NULL); }
+    s->bits = header[7] - 0x30;
+    if (memcmp(header, "HFP0", 4) == 0 && s->bits != 8) {
+        if (recv_all(s->sockfd, header + 12, 4) < 0) {
+            s->error = 1;
+            return(NULL);
+        }
+    }
+    if (freq > 0)  { send_command(s->sockfd, 1, freq); }
+    if (rate > 0)  { send_command(s->sockfd, 2, rate); }
+    if (gain >= 0) { send_command(s->sockfd, 4, gain); }
+    if (compress)  { send_command(s->sockfd, CMD_COMPRESS, 1); }
+
+    //  -z : samples sent before the server switched come first,
+    //    so look for the first frame header, then decode frame by frame
+    long      zmax  = 2 * codec_max_bytes(CODEC_MAX_PAIRS);
+    uint8_t   *zin  = compress ? (uint8_t *)malloc(zmax) : NULL;
+    uint8_t   *zout = compress ? (uint8_t *)malloc(4L * CODEC_MAX_PAIRS) : NULL;
+    codec_t   *z    = compress ? (codec_t *)malloc(sizeof(codec_t)) : NULL;
+    long      zlen  = 0;
+    int       synced = 0;
+    if (compress && (zin == NULL || zout == NULL || z == NULL)) {
+        s->error = 1;
+        return(NULL);
+    }
+
+    double t0    = now_sec();
+    double start = t0 + warmup;
+    double end   = start + duration;
+    double last  = 0.0;
+    while (1) {
+        unsigned char *p = compress ? zin + zlen : sink[s->id];
+        long room = compress ? zmax - zlen : (long)sizeof(sink[0]);
+        int m = recv(s->sockfd, p, room, 0);
+        double t = now_sec();
+        if (m <= 0) {
+            fprintf(stderr, "session %d: connection closed\n", s->id);
+            s->error = 1;
+            break;
+        }
+        if (t >= start) {
+            if (last > 0.0 && t - last > 1e-3 * gapMs) {
+                s->gaps += 1;
+            }
+            if (last > 0.0 && t - last > s->max_gap) {
+                s->max_gap = t - last;
+            }
+            s->bytes += m;
+            last = t;
+        }
+        if (compress) {
+            zlen += m;
+            long k = 0;
+            while (zlen - k >= CODEC_HEADER) {
+                int  fp = 0, fb = 0;
+                long sz = codec_frame_bytes(zin + k, &fp, &fb);
+                if (sz < 0) {
+                    if (synced) { s->bad += 1; synced = 0; }
+                    k += 1;
+                    continue;
+                }
+                if (zlen - k < sz) { break; }
+                if (codec_decode(z, zin + k, zout) < 0) { s->bad += 1; }
+                if (t >= start) {
+                    s->pairs  += fp;
+                    s->frames += 1;
+                }
+                synced = 1;
+                k += sz;
+            }
+            memmove(zin, zin + k, zlen - k);
+            zlen -= k;
+        }
+        if (t >= end) { break; }
+    }
+    s->elapsed = now_sec() - start;
+    close(s->sockfd);
+    free(zin);
+    free(zout);
+    free(z);
+    return(NULL);
+}
+
+//  utime + stime of a process, in seconds, Linux only
+
+static double proc_cpu(int pid)
+{
+    char path[64], buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) { return(-1.0); }
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = 0;
+    char *p = strrchr(buf, ')');        // the command name may hold spaces
+    if (p == NULL) { return(-1.0); }
+    unsigned long ut = 0, st = 0;
+    // fields after the name : state ppid pgrp ... utime is the 12th
+    if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+               &ut, &st) != 2) {
+        return(-1.0);
+    }
+    return((double)(ut + st) / sysconf(_SC_CLK_TCK));
+}
+
+static double self_cpu(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return(ru.ru_utime.tv_sec + 1e-6 * ru.ru_utime.tv_usec
+           + ru.ru_stime.tv_sec + 1e-6 * ru.ru_stime.tv_usec);
+}
+
+int main(int argc, char *argv[])
+{
+    for (int arg=1; arg+1<argc; arg+=2) {
+        char *o = argv[arg], *v = argv[arg+1];
+        if      (strcmp(o, "-h") == 0) { host      = v; }
+        else if (strcmp(o, "-p") == 0) { port      = v; }
+        else if (strcmp(o, "-n") == 0) { nSessions = atoi(v); }
+        else if (strcmp(o, "-t") == 0) { duration  = atof(v); }
+        else if (strcmp(o, "-w") == 0) { warmup    = atof(v); }
+        else if (strcmp(o, "-r") == 0) { rate      = atol(v); }
+        else if (strcmp(o, "-f") == 0) { freq      = atol(v); }
+        else if (strcmp(o, "-g") == 0) { gain      = atol(v); }
+        else if (strcmp(o, "-G") == 0) { gapMs     = atof(v); }
+        else if (strcmp(o, "-P") == 0) { serverPid = atoi(v); }
+        else if (strcmp(o, "-z") == 0) { compress  = atoi(v); }
+        else {
+            printf("Usage: hfp_load [-h host] [-p port] [-n sessions] "
+                   "[-t seconds]\n               [-r rate] [-f frequency] "
+                   "[-g gain_tenths_dB]\n               [-G gap_ms] "
+                   "[-w warmup_seconds] [-P server_pid] [-z 1]\n");
+            exit(0);
+        }
+    }
+    if (nSessions < 1 || nSessions > MAX_SESSIONS) {
+        printf("sessions must be 1 to %d\n", MAX_SESSIONS);
+        exit(0);
+    }
+
+    double c0 = self_cpu();
+    double s0 = (serverPid > 0) ? proc_cpu(serverPid) : -1.0;
+    double t0 = now_sec();
+    for (int i=0; i<nSessions; i++) {
+        sessions[i].id = i;
+        pthread_create(&sessions[i].thread, NULL, session_run, &sessions[i]);
+    }
+    for (int i=0; i<nSessions; i++) {
+        pthread_join(sessions[i].thread, NULL);
+    }
+    double wall = now_sec() - t0;
+    double c1 = self_cpu();
+    double s1 = (serverPid > 0) ? proc_cpu(serverPid) : -1.0;
+
+    double total = 0.0;
+    int    errors = 0, gaps = 0;
+    for (int i=0; i<nSessions; i++) {
+        session_t *s = &sessions[i];
+        if (s->error && s->bytes == 0) {
+            printf("session %2d : failed\n", i);
+            errors += 1;
+            continue;
+        }
+        double bps  = (s->bits == 8) ? 2 : ((s->bits == 12) ? 3
+                       : ((s->bits == 16) ? 4 : 8));
+        if (s->bits == 'B' - 0x30) {    // block floating point
+            bps = (double)BFP_FRAME / BFP_PAIRS;
+        }
+        double Bps  = (s->elapsed > 0.0) ? s->bytes / s->elapsed : 0.0;
+        double sps  = Bps / bps;
+        if (compress) {
+            sps = (s->elapsed > 0.0) ? s->pairs / s->elapsed : 0.0;
+        }
+        printf("session %2d : %8.3f MB/s %10.0f samples/s", i, 1e-6 * Bps, sps);
+        if (rate > 0) { printf(" (%5.1f%% of rate)", 100.0 * sps / rate); }
+        if (compress) {
+            printf(", %lld frames, ratio %.2f, %d bad", s->frames,
+                   (s->bytes > 0) ? (double)s->pairs * bps / s->bytes : 0.0,
+                   s->bad);
+        }
+        printf("  %d gaps > %.0f ms, max %.1f ms%s\n", s->gaps, gapMs,
+               1e3 * s->max_gap, s->error ? ", closed early" : "");
+        total += Bps;
+        gaps  += s->gaps;
+        errors += s->error;
+    }
+    printf("total      : %8.3f MB/s, %d gaps, %d errors\n",
+           1e-6 * total, gaps, errors);
+    printf("client cpu : %5.1f%%\n", 100.0 * (c1 - c0) / wall);
+    if (s0 >= 0.0 && s1 >= 0.0) {
+        printf("server cpu : %5.1f%%\n", 100.0 * (s1 - s0) / wall);
+    }
+    return((errors > 0) ? 1 : 0);
+}
+
+// eof
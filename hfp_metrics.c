@@ -0,0 +1,113 @@
+//
+//  hfp_metrics.c
+//
+//  Prometheus text metrics for hfp_tcp, see hfp_metrics.h
+//
+//   re-distribution under the BSD 3 clause license permitted
+//
+
+#define _POSIX_C_SOURCE 200112L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#include "hfp_metrics.h"
+
+#ifdef __APPLE__
+#define MSG_NOSIGNAL    0       // SIGPIPE is ignored by the server
+#endif
+
+static int                  metrics_sockfd  = -1;
+static metrics_format_fn    metrics_format  = NULL;
+static pthread_t            metrics_thread;
+
+//  Append to buf at len, never past size.  Returns the new length.
+
+long metrics_printf(char *buf, long size, long len, const char *fmt, ...)
+{
+    if (len >= size - 1) { return(len); }
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + len, size - len, fmt, ap);
+    va_end(ap);
+    if (n < 0) { return(len); }
+    len += n;
+    if (len > size - 1) { len = size - 1; }
+    return(len);
+}
+
+//  One scrape per connection : read the request, whatever it is,
+//    answer with the current snapshot, and close.
+
+static void *metrics_handler(void *param)
+{
+    char *body = (char *)malloc(METRICS_BUF_SIZE);
+    char request[1024];
+    if (body == NULL) { return(NULL); }
+    while (1) {
+        int fd = accept(metrics_sockfd, NULL, NULL);
+        if (fd < 0) { break; }
+        struct timeval timeout = { 1, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        recv(fd, request, sizeof(request), 0);
+        long len = metrics_format(body, METRICS_BUF_SIZE);
+        char header[160];
+        int hl = snprintf(header, sizeof(header),
+                          "HTTP/1.0 200 OK\r\n"
+                          "Content-Type: text/plain; version=0.0.4\r\n"
+                          "Content-Length: %ld\r\n\r\n", len);
+        if (send(fd, header, hl, MSG_NOSIGNAL) == hl) {
+            long k = 0;
+            while (k < len) {
+                long m = send(fd, body + k, len - k, MSG_NOSIGNAL);
+                if (m <= 0) { break; }
+                k += m;
+            }
+        }
+        close(fd);
+    }
+    free(body);
+    return(NULL);
+}
+
+int metrics_start(int port, metrics_format_fn format)
+{
+    struct sockaddr_in6 addr;
+    int rr = 1;
+    metrics_format = format;
+    metrics_sockfd = socket(AF_INET6, SOCK_STREAM, 0);
+    if (metrics_sockfd < 0) {
+        printf("ERROR opening metrics socket\n");
+        return(-1);
+    }
+    setsockopt(metrics_sockfd, SOL_SOCKET, SO_REUSEADDR,
+               (char *)&rr, sizeof(int));
+    bzero((char *)&addr, sizeof(addr));
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr   = in6addr_loopback;        // local scrapers only
+    addr.sin6_port   = htons(port);
+    if (bind(metrics_sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        printf("ERROR on bind to metrics port %d\n", port);
+        close(metrics_sockfd);
+        return(-1);
+    }
+    listen(metrics_sockfd, 4);
+    if (pthread_create(&metrics_thread, NULL, metrics_handler, NULL) != 0) {
+        printf("could not create metrics thread\n");
+        close(metrics_sockfd);
+        return(-1);
+    }
+    pthread_detach(metrics_thread);
+    printf("metrics on http://[::1]:%d/metrics\n", port);
+    return(0);
+}
+
+// eof
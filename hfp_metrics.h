@@ -0,0 +1,21 @@
+//
+//  hfp_metrics.h
+//
+//  Prometheus text metrics for hfp_tcp, served over plain HTTP
+//    on the loopback interface.  The server supplies a format
+//    function that snapshots its counters into a buffer.
+//
+//   re-distribution under the BSD 3 clause license permitted
+//
+
+#ifndef HFP_METRICS_H
+#define HFP_METRICS_H
+
+#define METRICS_BUF_SIZE    (64 * 1024)
+
+typedef long (*metrics_format_fn)(char *buf, long size);
+
+int     metrics_start(int port, metrics_format_fn format);
+long    metrics_printf(char *buf, long size, long len, const char *fmt, ...);
+
+#endif  // HFP_METRICS_H
@@ -0,0 +1,263 @@
+//
+//  hfp_play.c
+//
+//  File playback for hfp_tcp, see hfp_play.h
+//
+//   re-distribution under the BSD 3 clause license permitted
+//
+
+#define _POSIX_C_SOURCE 200112L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdatomic.h>
+
+#include "hfp_play.h"
+
+static void ts_add_ns(struct timespec *t, long long ns)
+{
+    ns += t->tv_nsec;
+    t->tv_sec  += ns / 1000000000LL;
+    t->tv_nsec  = ns % 1000000000LL;
+}
+
+static void sleep_until(const struct timespec *t)
+{
+#ifdef __APPLE__                        // no clock_nanosleep
+    struct timespec now, d;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long ns = 1000000000LL * (t->tv_sec - now.tv_sec)
+                   + (t->tv_nsec - now.tv_nsec);
+    if (ns <= 0) { return; }
+    d.tv_sec  = ns / 1000000000LL;
+    d.tv_nsec = ns % 1000000000LL;
+    nanosleep(&d, NULL);
+#else
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, t, NULL);
+#endif
+}
+
+static int has_suffix(const char *s, const char *suffix)
+{
+    size_t n = strlen(s), k = strlen(suffix);
+    return((n >= k) && (strcmp(s + n - k, suffix) == 0));
+}
+
+//  Just enough JSON for a SigMF meta file : the value after "key":
+
+static const char *meta_value(const char *json, const char *key)
+{
+    char quoted[64];
+    snprintf(quoted, sizeof(quoted), "\"%s\"", key);
+    const char *s = strstr(json, quoted);
+    if (s == NULL) { return(NULL); }
+    s = strchr(s + strlen(quoted), ':');
+    if (s == NULL) { return(NULL); }
+    s += 1;
+    while (*s == ' ' || *s == '\t' || *s == '\n' || *s == '\r') { s++; }
+    return(s);
+}
+
+static int play_read_meta(player_t *pl, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        printf("playback: can't read %s\n", path);
+        return(-1);
+    }
+    char *json = (char *)calloc(1, 65536);
+    long n = (json != NULL) ? (long)fread(json, 1, 65535, f) : 0;
+    fclose(f);
+    if (n <= 0) {
+        free(json);
+        printf("playback: empty meta file %s\n", path);
+        return(-1);
+    }
+
+    const char *v = meta_value(json, "core:datatype");
+    int ok = 1;
+    if (v == NULL || *v != '"') {
+        ok = 0;
+    } else if (strncmp(v, "\"cf32_le\"", 9) == 0) {
+        pl->dtype = PLAY_CF32;
+    } else if (strncmp(v, "\"ci16_le\"", 9) == 0) {
+        pl->dtype = PLAY_CI16;
+    } else if (strncmp(v, "\"cu8\"", 5) == 0) {
+        pl->dtype = PLAY_CU8;
+    } else if (strncmp(v, "\"ci8\"", 5) == 0) {
+        pl->dtype = PLAY_CI8;
+    } else {
+        ok = 0;
+    }
+    if (!ok) {
+        printf("playback: %s needs a cf32_le, ci16_le, cu8 or ci8 "
+               "core:datatype\n", path);
+        free(json);
+        return(-1);
+    }
+    if ((v = meta_value(json, "core:sample_rate")) != NULL) {
+        pl->rate = strtod(v, NULL);
+    }
+    if ((v = meta_value(json, "core:frequency")) != NULL) {
+        pl->freq = strtod(v, NULL);     // the first capture's
+    }
+    free(json);
+    return(0);
+}
+
+//  path is a raw float32 file, or either half of a SigMF pair.
+//    rate is used for raw files, or meta files without a rate.
+
+int player_open(player_t *pl, const char *path, double rate)
+{
+    char data[600], meta[600];
+
+    bzero((char *)pl, sizeof(player_t));
+    pl->dtype = PLAY_CF32;
+    pl->rate  = rate;
+    pl->speed = 1.0;
+    strncpy(data, path, sizeof(data) - 1);
+    data[sizeof(data) - 1] = 0;
+    if (has_suffix(path, ".sigmf-meta") || has_suffix(path, ".sigmf-data")) {
+        size_t n = strlen(path) - strlen(".sigmf-data");
+        if (n + 16 > sizeof(data)) { return(-1); }
+        snprintf(data, sizeof(data), "%.*s.sigmf-data", (int)n, path);
+        snprintf(meta, sizeof(meta), "%.*s.sigmf-meta", (int)n, path);
+        if (play_read_meta(pl, meta) < 0) { return(-1); }
+    }
+    pl->frame = (pl->dtype == PLAY_CF32) ? 8
+              : ((pl->dtype == PLAY_CI16) ? 4 : 2);
+    if (pl->rate <= 0.0) {
+        printf("playback: no sample rate for %s\n", data);
+        return(-1);
+    }
+
+    int fd = open(data, O_RDONLY);
+    if (fd < 0) {
+        printf("playback: can't open %s\n", data);
+        return(-1);
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < pl->frame) {
+        printf("playback: %s is empty\n", data);
+        close(fd);
+        return(-1);
+    }
+    void *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);                          // the mapping keeps the file
+    if (m == MAP_FAILED) {
+        printf("playback: can't map %s\n", data);
+        return(-1);
+    }
+    posix_madvise(m, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+    pl->map       = (const uint8_t *)m;
+    pl->map_bytes = (long long)st.st_size;
+    pl->pairs     = pl->map_bytes / pl->frame;
+    return(0);
+}
+
+//  n pairs from the file at pos, as floats.  cf32 blocks are handed
+//    over straight from the mapping.
+
+static const float *play_block(player_t *pl, float *buf, int n)
+{
+    const uint8_t *s = pl->map + pl->pos * pl->frame;
+    if (pl->dtype == PLAY_CF32) {
+        return((const float *)s);       // mmap'd, so 8 byte aligned
+    }
+    if (pl->dtype == PLAY_CI16) {
+        const int16_t *x = (const int16_t *)s;
+        for (int i=0; i<2*n; i++) { buf[i] = (1.0f / 32768.0f) * x[i]; }
+    } else if (pl->dtype == PLAY_CU8) {
+        for (int i=0; i<2*n; i++) { buf[i] = (1.0f / 128.0f) * (s[i] - 128); }
+    } else {
+        const int8_t *x = (const int8_t *)s;
+        for (int i=0; i<2*n; i++) { buf[i] = (1.0f / 128.0f) * x[i]; }
+    }
+    return(buf);
+}
+
+static void *play_run(void *param)
+{
+    player_t *pl  = (player_t *)param;
+    float    *buf = (float *)malloc(2 * sizeof(float) * PLAY_BLOCK);
+    struct timespec next, now;
+
+    if (buf == NULL) { return(NULL); }
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (atomic_load(&pl->streaming)) {
+        long long left = pl->pairs - pl->pos;
+        int       n    = (left < PLAY_BLOCK) ? (int)left : PLAY_BLOCK;
+        long long blk  = (long long)(1e9 * n / (pl->rate * pl->speed));
+
+        ts_add_ns(&next, blk);
+        sleep_until(&next);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long late = 1000000000LL * (now.tv_sec - next.tv_sec)
+                         + (now.tv_nsec - next.tv_nsec);
+        if (late > PLAY_LATE_BLOCKS * blk) {
+            // no skipping, every sample is delivered; just no burst after
+            next = now;
+            atomic_fetch_add_explicit(&pl->late, 1, memory_order_relaxed);
+        }
+
+        const float *p = play_block(pl, buf, n);
+        if (pl->callback(p, n, pl->ctx) != 0) {
+            atomic_store(&pl->streaming, 0);
+        }
+        pl->pos += n;
+        if (pl->pos >= pl->pairs) {
+            pl->pos = 0;
+            atomic_fetch_add_explicit(&pl->loops, 1, memory_order_relaxed);
+        }
+    }
+    free(buf);
+    return(NULL);
+}
+
+int player_start(player_t *pl, play_cb_fn callback, void *ctx)
+{
+    if (atomic_load(&pl->streaming)) { return(-1); }
+    pl->callback = callback;
+    pl->ctx      = ctx;
+    atomic_store(&pl->streaming, 1);
+    if (pthread_create(&pl->thread, NULL, play_run, pl) != 0) {
+        atomic_store(&pl->streaming, 0);
+        return(-1);
+    }
+    return(0);
+}
+
+void player_stop(player_t *pl)
+{
+    if (pl->thread != 0) {
+        atomic_store(&pl->streaming, 0);
+        if (!pthread_equal(pl->thread, pthread_self())) {
+            pthread_join(pl->thread, NULL);
+        }
+        pl->thread = 0;
+    }
+}
+
+int player_is_streaming(player_t *pl)
+{
+    return(atomic_load(&pl->streaming));
+}
+
+void player_close(player_t *pl)
+{
+    player_stop(pl);
+    if (pl->map != NULL) {
+        munmap((void *)pl->map, (size_t)pl->map_bytes);
+        pl->map = NULL;
+    }
+}
+
+// eof
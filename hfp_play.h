@@ -0,0 +1,59 @@
+//
+//  hfp_play.h
+//
+//  File playback for hfp_tcp : serves a recording as if it were
+//    the HF+.  The file is mmap'd and a thread hands it to the
+//    same callback as libairspyhf's transfers, in 1024 pair blocks,
+//    paced by the monotonic clock at the file's rate times speed.
+//    It loops at the end of the file.
+//
+//    Raw files are float32 IQ (what -R writes with -Rk raw);
+//    a .sigmf-data or .sigmf-meta path reads the meta file for
+//    core:datatype (cf32_le, ci16_le, cu8 or ci8), core:sample_rate
+//    and the first capture's core:frequency.  Integer samples
+//    are scaled to a full scale of 1.0.
+//
+//   re-distribution under the BSD 3 clause license permitted
+//
+
+#ifndef HFP_PLAY_H
+#define HFP_PLAY_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define PLAY_BLOCK      (1024)      // IQ pairs per transfer, as libairspyhf
+#define PLAY_LATE_BLOCKS (4)        // behind this, restart the schedule
+
+#define PLAY_CF32       (0)         // file sample formats
+#define PLAY_CI16       (1)
+#define PLAY_CU8        (2)
+#define PLAY_CI8        (3)
+
+typedef int (*play_cb_fn)(const float *p, int n, void *ctx);
+
+typedef struct player_t {
+    const uint8_t   *map;
+    long long       map_bytes;
+    long long       pairs;      // in the file
+    int             frame;      // bytes per IQ pair in the file
+    int             dtype;      // PLAY_CF32 ...
+    double          rate;       // Hz, from the meta file or -Pr
+    double          freq;       // Hz, 0 if the file doesn't say
+    double          speed;      // pacing multiple, 1.0 real time
+    long long       pos;        // next pair, playback thread only
+    play_cb_fn      callback;
+    void            *ctx;
+    pthread_t       thread;
+    _Atomic int     streaming;
+    _Atomic long long loops;    // times through the whole file
+    _Atomic long long late;     // schedule restarts, couldn't keep up
+} player_t;
+
+int     player_open(player_t *pl, const char *path, double rate);
+int     player_start(player_t *pl, play_cb_fn callback, void *ctx);
+void    player_stop(player_t *pl);
+int     player_is_streaming(player_t *pl);
+void    player_close(player_t *pl);
+
+#endif  // HFP_PLAY_H
@@ -0,0 +1,464 @@
+//
+//  hfp_record.c
+//
+//  IQ recorder for hfp_tcp, see hfp_record.h
+//
+//   re-distribution under the BSD 3 clause license permitted
+//
+
+#ifdef __linux__
+#define _GNU_SOURCE             // O_DIRECT
+#else
+#define _POSIX_C_SOURCE 200112L
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "hfp_record.h"
+
+static double wall_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return(ts.tv_sec + 1e-9 * ts.tv_nsec);
+}
+
+//  ISO 8601, as SigMF wants it
+
+static void iso_time(double t, char *buf, int size)
+{
+    time_t    s = (time_t)t;
+    struct tm tm;
+    gmtime_r(&s, &tm);
+    int n = (int)strftime(buf, size, "%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf(buf + n, size - n, ".%06dZ", (int)((t - (double)s) * 1e6));
+}
+
+static void rec_new_file(recorder_t *rec)
+{
+    recFile *f = &rec->file;
+    double  t  = wall_time();
+    time_t  s  = (time_t)t;
+    struct tm tm;
+    char    stamp[32];
+    gmtime_r(&s, &tm);
+    strftime(stamp, sizeof(stamp), "%Y%m%dT%H%M%SZ", &tm);
+    f->seq       = rec->nfiles++;
+    snprintf(f->name, sizeof(f->name), "%s-%s-%03d", rec->prefix, stamp,
+             f->seq % 1000);
+    f->rate      = rec->rate;
+    f->bytes     = 0;
+    f->dropped   = 0;
+    f->ncaptures = 1;
+    f->captures[0].start = 0;
+    f->captures[0].freq  = rec->freq;
+    f->captures[0].time  = t;
+}
+
+static void rec_add_capture(recorder_t *rec, double t)
+{
+    recFile *f = &rec->file;
+    long long start = f->bytes / rec->frame;
+    if (f->captures[f->ncaptures - 1].start == start) {
+        f->ncaptures -= 1;              // nothing recorded under the old one
+    }
+    recCapture *c = &f->captures[f->ncaptures++];
+    c->start = start;
+    c->freq  = rec->freq;
+    c->time  = t;
+}
+
+static void rec_write_meta(recorder_t *rec, const recFile *f)
+{
+    char path[600], when[64];
+    snprintf(path, sizeof(path), "%s.sigmf-meta", f->name);
+    FILE *m = fopen(path, "w");
+    if (m == NULL) {
+        fprintf(stderr, "recorder: can't write %s\n", path);
+        return;
+    }
+    fprintf(m, "{\n  \"global\": {\n"
+            "    \"core:datatype\": \"%s\",\n"
+            "    \"core:sample_rate\": %.1f,\n"
+            "    \"core:version\": \"1.0.0\",\n"
+            "    \"core:hw\": \"Airspy HF+\",\n"
+            "    \"core:recorder\": \"hfp_tcp\",\n"
+            "    \"core:extensions\": [ { \"name\": \"hfp\", "
+            "\"version\": \"1.0.0\", \"optional\": true } ],\n"
+            "    \"hfp:file_index\": %d,\n"
+            "    \"hfp:dropped_samples\": %lld\n"
+            "  },\n  \"captures\": [",
+            rec->datatype, f->rate, f->seq, f->dropped);
+    for (int i=0; i<f->ncaptures; i++) {
+        const recCapture *c = &f->captures[i];
+        iso_time(c->time, when, sizeof(when));
+        fprintf(m, "%s\n    { \"core:sample_start\": %lld, "
+                "\"core:frequency\": %.1f, \"core:datetime\": \"%s\" }",
+                (i > 0) ? "," : "", c->start, c->freq, when);
+    }
+    fprintf(m, "\n  ],\n  \"annotations\": []\n}\n");
+    fclose(m);
+}
+
+//  Hand the filled buffer to the write thread, with the file as it
+//    stands, and wait for the other one to be free.  The ring takes
+//    up anything that arrives meanwhile.
+
+static void rec_submit(recorder_t *rec, int last)
+{
+    pthread_mutex_lock(&rec->lock);
+    recBuf *b = &rec->bufs[rec->cur];
+    b->file  = rec->file;
+    b->last  = last;
+    b->ready = 1;
+    pthread_cond_broadcast(&rec->cond);
+    rec->cur ^= 1;
+    while (rec->bufs[rec->cur].ready) {
+        pthread_cond_wait(&rec->cond, &rec->lock);
+    }
+    pthread_mutex_unlock(&rec->lock);
+}
+
+static void rec_end_file(recorder_t *rec)
+{
+    rec_submit(rec, 1);
+    rec_new_file(rec);
+}
+
+//  Retunes the reader has reached : a new capture segment for a new
+//    frequency, a new file for a new rate.  Returns the ring position
+//    of the next one still ahead, or -1.
+
+static long long rec_events(recorder_t *rec, long long r_pos)
+{
+    long long next = -1;
+    pthread_mutex_lock(&rec->lock);
+    while (rec->nevents > 0 && rec->events[0].pos <= r_pos) {
+        recEvent e = rec->events[0];
+        rec->nevents -= 1;
+        memmove(&rec->events[0], &rec->events[1],
+                rec->nevents * sizeof(recEvent));
+        pthread_mutex_unlock(&rec->lock);
+        rec->freq = e.freq;
+        if (e.rate != rec->rate) {
+            rec->rate = e.rate;
+            if (rec->file.bytes > 0) {
+                rec_end_file(rec);
+            } else {
+                rec->file.rate = e.rate;
+                rec->file.captures[0].freq = e.freq;
+            }
+        } else if (e.freq != rec->file.captures[rec->file.ncaptures-1].freq) {
+            if (rec->file.ncaptures == REC_MAX_CAPTURES) {
+                rec_end_file(rec);
+            } else {
+                rec_add_capture(rec, wall_time());
+            }
+        }
+        pthread_mutex_lock(&rec->lock);
+    }
+    if (rec->nevents > 0) { next = rec->events[0].pos; }
+    pthread_mutex_unlock(&rec->lock);
+    return(next);
+}
+
+//  bytes the current file can still take, a whole number of frames
+
+static long long rec_room(recorder_t *rec)
+{
+    long long room = 1LL << 62;
+    if (rec->max_bytes > 0) {
+        room = rec->max_bytes / rec->frame * rec->frame - rec->file.bytes;
+    }
+    if (rec->max_seconds > 0) {
+        long long n = (long long)(rec->max_seconds * rec->file.rate);
+        long long r = n * rec->frame - rec->file.bytes;
+        if (r < room) { room = r; }
+    }
+    return(room);
+}
+
+static void *rec_fill(void *param)
+{
+    recorder_t *rec = (recorder_t *)param;
+    long long  lapped = 0;
+    while (rec->stop == 0) {
+        long avail = ring_wait(&rec->rd, 1, 100, &rec->stop);
+        long long r_pos = atomic_load_explicit(&rec->rd.rd_pos,
+                                               memory_order_relaxed);
+        long long next  = rec_events(rec, r_pos);
+        if (avail <= 0 || rec->stop) { continue; }
+        long long room = rec_room(rec);
+        if (room <= 0) {
+            rec_end_file(rec);
+            continue;
+        }
+        recBuf *b    = &rec->bufs[rec->cur];
+        long   want  = REC_BUF_BYTES - b->len;
+        if (want > room) { want = (long)room; }
+        if (next > r_pos && next - r_pos < want) { want = (long)(next - r_pos); }
+        want -= want % rec->frame;          // gaps and files at whole pairs
+        uint8_t *ptr = NULL;
+        long n = ring_view(&rec->rd, &ptr, want);
+        if (rec->rd.lapped != lapped) {     // the disk fell behind
+            lapped = rec->rd.lapped;
+            long long lost = rec->rd.last_drop;
+            rec->file.dropped += lost;
+            atomic_fetch_add_explicit(&rec->dropped, lost,
+                                      memory_order_relaxed);
+            fprintf(stderr, "recorder overrun, dropped %lld samples\n", lost);
+            if (rec->file.ncaptures < REC_MAX_CAPTURES) {
+                rec_add_capture(rec, wall_time());  // marks the gap
+            }
+            continue;                       // events, at the new position
+        }
+        if (n <= 0) { continue; }
+        memcpy(b->data + b->len, ptr, n);
+        ring_consume(&rec->rd, n);
+        b->len          += n;
+        rec->file.bytes += n;
+        if (b->len == REC_BUF_BYTES) { rec_submit(rec, 0); }
+    }
+    rec_submit(rec, 1);
+    pthread_mutex_lock(&rec->lock);
+    rec->fill_done = 1;
+    pthread_cond_broadcast(&rec->cond);
+    pthread_mutex_unlock(&rec->lock);
+    return(NULL);
+}
+
+static int rec_open(const char *path)
+{
+    int fd = -1;
+#if defined(O_DIRECT)
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (fd >= 0) { return(fd); }
+    // tmpfs and some network filesystems refuse O_DIRECT
+#endif
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#if defined(__APPLE__)
+    if (fd >= 0) { fcntl(fd, F_NOCACHE, 1); }
+#endif
+    return(fd);
+}
+
+static int write_full(int fd, const uint8_t *p, long len)
+{
+    while (len > 0) {
+        ssize_t k = write(fd, p, len);
+        if (k < 0 && errno == EINTR) { continue; }
+        if (k <= 0) { return(-1); }
+        p   += k;
+        len -= k;
+    }
+    return(0);
+}
+
+//  Whole REC_ALIGN blocks go out direct; a file's last partial block
+//    is written through the page cache.
+
+static int rec_write(int fd, const uint8_t *p, long len)
+{
+    long aligned = len & ~(long)(REC_ALIGN - 1);
+    if (aligned > 0 && write_full(fd, p, aligned) < 0) { return(-1); }
+    if (len > aligned) {
+#if defined(O_DIRECT)
+        int fl = fcntl(fd, F_GETFL);
+        if (fl & O_DIRECT) { fcntl(fd, F_SETFL, fl & ~O_DIRECT); }
+#endif
+        if (write_full(fd, p + aligned, len - aligned) < 0) { return(-1); }
+    }
+    return(0);
+}
+
+static void *rec_writer(void *param)
+{
+    recorder_t *rec = (recorder_t *)param;
+    int fd  = -1;
+    int cur = 0;
+    while (1) {
+        recBuf *b = &rec->bufs[cur];
+        pthread_mutex_lock(&rec->lock);
+        while (!b->ready && !rec->fill_done) {
+            pthread_cond_wait(&rec->cond, &rec->lock);
+        }
+        int ready = b->ready;
+        pthread_mutex_unlock(&rec->lock);
+        if (!ready) { break; }
+
+        if (fd < 0 && b->len > 0) {
+            char path[600];
+            snprintf(path, sizeof(path), "%s.sigmf-data", b->file.name);
+            fd = rec_open(path);
+            if (fd < 0) {
+                fprintf(stderr, "recorder: can't create %s\n", path);
+            } else {
+                printf("recording to %s\n", path);
+                rec_write_meta(rec, &b->file);
+                atomic_fetch_add_explicit(&rec->files, 1, memory_order_relaxed);
+            }
+        }
+        if (fd >= 0 && b->len > 0) {
+            long long t0 = mono_ns();
+            if (rec_write(fd, b->data, b->len) < 0) {
+                fprintf(stderr, "recorder: write failed, %s\n",
+                        strerror(errno));
+            } else {
+                atomic_fetch_add_explicit(&rec->bytes_written, b->len,
+                                          memory_order_relaxed);
+            }
+            long long dt = mono_ns() - t0;
+            atomic_fetch_add_explicit(&rec->write_ns, dt, memory_order_relaxed);
+            if (dt > atomic_load_explicit(&rec->max_write_ns,
+                                          memory_order_relaxed)) {
+                atomic_store_explicit(&rec->max_write_ns, dt,
+                                      memory_order_relaxed);
+            }
+        }
+        if (b->last && fd >= 0) {
+            close(fd);
+            fd = -1;
+            rec_write_meta(rec, &b->file);
+        }
+        pthread_mutex_lock(&rec->lock);
+        b->len   = 0;
+        b->ready = 0;
+        pthread_cond_broadcast(&rec->cond);
+        pthread_mutex_unlock(&rec->lock);
+        cur ^= 1;
+    }
+    if (fd >= 0) { close(fd); }
+    return(NULL);
+}
+
+//  everything recorder_start() set up, after its threads have ended
+
+static void rec_free(recorder_t *rec)
+{
+    ring_reader_detach(&rec->rd);
+    for (int i=0; i<2; i++) {
+        free(rec->bufs[i].data);
+        rec->bufs[i].data = NULL;
+    }
+    if (rec->src == &rec->own) { ring_free(&rec->own); }
+    rec->src = NULL;
+    pthread_mutex_destroy(&rec->lock);
+    pthread_cond_destroy(&rec->cond);
+}
+
+//  src NULL records the raw float32 capture, fed with recorder_feed();
+//    otherwise src is a served stream's ring.  max_bytes and
+//    max_seconds rotate files, 0 for no limit.
+
+int recorder_start(recorder_t *rec, const char *prefix, ring_t *src,
+                   int frame, const char *datatype, double freq,
+                   double rate, long long max_bytes, int max_seconds)
+{
+    bzero((char *)rec, sizeof(recorder_t));
+    strncpy(rec->prefix, prefix, sizeof(rec->prefix) - 1);
+    rec->datatype    = datatype;
+    rec->frame       = frame;
+    rec->freq        = freq;
+    rec->rate        = rate;
+    rec->max_bytes   = max_bytes;
+    rec->max_seconds = max_seconds;
+    pthread_mutex_init(&rec->lock, NULL);
+    pthread_cond_init(&rec->cond, NULL);
+    if (src == NULL) {
+        if (ring_init(&rec->own, REC_RING_BYTES, frame) < 0) {
+            rec_free(rec);
+            return(-1);
+        }
+        src = &rec->own;
+    }
+    rec->src = src;
+    for (int i=0; i<2; i++) {
+        void *p = NULL;
+        if (posix_memalign(&p, REC_ALIGN, REC_BUF_BYTES) != 0) {
+            rec_free(rec);
+            return(-1);
+        }
+        rec->bufs[i].data = (uint8_t *)p;
+    }
+    rec->rd.passive = 1;
+    ring_reader_attach(&rec->rd, src);
+    rec_new_file(rec);
+    if (pthread_create(&rec->write_thread, NULL, rec_writer, rec) != 0) {
+        rec_free(rec);
+        return(-1);
+    }
+    if (pthread_create(&rec->fill_thread, NULL, rec_fill, rec) != 0) {
+        pthread_mutex_lock(&rec->lock);     // the writer has nothing coming
+        rec->fill_done = 1;
+        pthread_cond_broadcast(&rec->cond);
+        pthread_mutex_unlock(&rec->lock);
+        pthread_join(rec->write_thread, NULL);
+        rec_free(rec);
+        return(-1);
+    }
+    rec->on = 1;
+    return(0);
+}
+
+//  raw mode, from the dsp worker : never waits, a slow disk only
+//    laps the recorder's reader
+
+void recorder_feed(recorder_t *rec, const float *p, int n)
+{
+    atomic_fetch_add(&rec->busy, 1);    // before on, see recorder_stop()
+    if (rec->on && rec->src == &rec->own) {
+        ring_write(&rec->own, (const uint8_t *)p, 8L * n);
+    }
+    atomic_fetch_sub(&rec->busy, 1);
+}
+
+//  The device was retuned; it applies from the samples after
+//    those in the ring now.
+
+void recorder_tune(recorder_t *rec, double freq, double rate)
+{
+    atomic_fetch_add(&rec->busy, 1);
+    if (!rec->on) {
+        atomic_fetch_sub(&rec->busy, 1);
+        return;
+    }
+    pthread_mutex_lock(&rec->lock);
+    if (rec->nevents < REC_MAX_EVENTS) {
+        recEvent *e = &rec->events[rec->nevents++];
+        e->pos  = atomic_load_explicit(&rec->src->wr_pos, memory_order_acquire);
+        e->freq = freq;
+        e->rate = rate;
+    }
+    pthread_mutex_unlock(&rec->lock);
+    atomic_fetch_sub(&rec->busy, 1);
+}
+
+//  Flushes what's buffered, closes the file and writes its metadata,
+//    then frees the buffers, the raw mode ring and the lock.  Once on
+//    is clear no new feed or tune call gets past its check, and the
+//    ones already past it are waited out.  A signal handler that
+//    interrupted one of them on its own thread would wait forever, so
+//    the wait is bounded and then nothing is freed; it is exiting.
+
+void recorder_stop(recorder_t *rec)
+{
+    if (!atomic_exchange(&rec->on, 0)) { return; }
+    for (int i=0; i<REC_STOP_SPINS && atomic_load(&rec->busy) > 0; i++) {
+        sched_yield();
+    }
+    rec->stop = 1;
+    pthread_join(rec->fill_thread, NULL);
+    pthread_join(rec->write_thread, NULL);
+    if (atomic_load(&rec->busy) == 0) { rec_free(rec); }
+}
+
+// eof
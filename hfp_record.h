@@ -0,0 +1,100 @@
+//
+//  hfp_record.h
+//
+//  IQ recorder for hfp_tcp : tees samples to SigMF files on disk
+//    alongside live serving.  Either the raw float32 capture, fed by
+//    the dsp worker into the recorder's own ring, or the served
+//    stream, read from its ring as a passive reader.  Either way the
+//    recorder can be lapped but never holds up the sample pipeline.
+//
+//    A fill thread copies from the ring into one of two aligned
+//    buffers while a write thread writes the other with O_DIRECT
+//    (F_NOCACHE on macOS).  Files rotate by size and/or time,
+//    each pair named prefix-YYYYmmddTHHMMSSZ-nnn.sigmf-data/-meta.
+//    Retunes add capture segments; rate changes start a new file.
+//
+//   re-distribution under the BSD 3 clause license permitted
+//
+
+#ifndef HFP_RECORD_H
+#define HFP_RECORD_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "hfp_ring.h"
+
+#define REC_BUF_BYTES   (4L * 1024L * 1024L)    // per buffer, two of them
+#define REC_ALIGN       (4096)                  // O_DIRECT alignment
+#define REC_RING_BYTES  (32L * 1024L * 1024L)   // raw mode, ~5 s at 768k
+#define REC_MAX_CAPTURES (256)                  // per file, then rotate
+#define REC_MAX_EVENTS  (64)
+#define REC_STOP_SPINS  (100000)                // recorder_stop's wait, yields
+
+typedef struct recCapture {
+    long long       start;      // sample index in the file
+    double          freq;       // Hz
+    double          time;       // unix seconds of its first sample
+} recCapture;
+
+typedef struct recFile {        // what the meta file describes
+    int             seq;
+    char            name[512];  // without the .sigmf-data/-meta suffix
+    double          rate;
+    long long       bytes;
+    long long       dropped;    // samples lost while this file was open
+    int             ncaptures;
+    recCapture      captures[REC_MAX_CAPTURES];
+} recFile;
+
+typedef struct recBuf {
+    uint8_t         *data;      // REC_BUF_BYTES, REC_ALIGN aligned
+    long            len;
+    int             ready;      // filled, waiting for the write thread
+    int             last;       // closes the file
+    recFile         file;       // a snapshot, with last
+} recBuf;
+
+typedef struct recEvent {       // a retune, seen at a ring byte position
+    long long       pos;
+    double          freq;
+    double          rate;
+} recEvent;
+
+typedef struct recorder_t {
+    atomic_int      on;
+    atomic_int      busy;       // recorder_feed and _tune calls under way
+    char            prefix[400];
+    const char      *datatype;  // SigMF core:datatype
+    int             frame;      // bytes per IQ pair
+    long long       max_bytes;  // rotate after, 0 : never
+    int             max_seconds;
+    ring_t          own;        // raw mode
+    ring_t          *src;
+    ring_reader_t   rd;
+    double          freq, rate;
+    recEvent        events[REC_MAX_EVENTS];
+    int             nevents;
+    pthread_mutex_t lock;       // events, and the buffer handoff
+    pthread_cond_t  cond;
+    recBuf          bufs[2];
+    int             cur;        // the buffer being filled
+    recFile         file;       // the one being filled
+    int             nfiles;
+    volatile int    stop;
+    int             fill_done;  // the fill thread has handed off its last
+    pthread_t       fill_thread, write_thread;
+    _Atomic long long bytes_written;
+    _Atomic long long dropped;  // samples lost to a slow disk
+    _Atomic long long files;
+    _Atomic long long write_ns;
+    _Atomic long long max_write_ns;
+} recorder_t;
+
+int     recorder_start(recorder_t *rec, const char *prefix, ring_t *src,
+                       int frame, const char *datatype, double freq,
+                       double rate, long long max_bytes, int max_seconds);
+void    recorder_feed(recorder_t *rec, const float *p, int n);
+void    recorder_tune(recorder_t *rec, double freq, double rate);
+void    recorder_stop(recorder_t *rec);
+
+#endif  // HFP_RECORD_H
@@ -0,0 +1,271 @@
+//
+//  hfp_resamp.c
+//
+//  sample rate conversion for hfp_tcp, see hfp_resamp.h
+//
+//   re-distribution under the BSD 3 clause license permitted
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+
+#include "hfp_resamp.h"
+
+static const double pi = 3.14159265358979;
+
+static double bessel_i0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    for (int k=1; k<32; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum  += term;
+    }
+    return(sum);
+}
+
+static double kaiser(int n, int len, double beta)
+{
+    double r = (2.0 * n) / (len - 1) - 1.0;
+    return(bessel_i0(beta * sqrt(1.0 - r * r)) / bessel_i0(beta));
+}
+
+static double kaiser_beta(double atten)
+{
+    if (atten > 50.0) { return(0.1102 * (atten - 8.7)); }
+    return(0.5842 * pow(atten - 21.0, 0.4) + 0.07886 * (atten - 21.0));
+}
+
+static long gcd(long a, long b)
+{
+    while (b != 0) { long t = a % b; a = b; b = t; }
+    return(a);
+}
+
+//  Halfband : every other tap is zero and the rest are symmetric,
+//    so an output costs (RS_HB_TAPS + 1) / 4 multiplies per component
+//    plus the center tap.  The following stages need only the bottom
+//    quarter of the input band, which leaves a wide transition band.
+
+static float hbTaps[(RS_HB_TAPS + 1) / 4];     // odd taps 1, 3, 5 ...
+
+static void hb_design(void)
+{
+    int    half = (RS_HB_TAPS - 1) / 2;
+    double beta = kaiser_beta(80.0);
+    for (int j=0; j<(RS_HB_TAPS + 1) / 4; j++) {
+        int n = 2 * j + 1;                  // distance from the center
+        double h = sin(0.5 * pi * n) / (pi * n);
+        hbTaps[j] = h * kaiser(half + n, RS_HB_TAPS, beta);
+    }
+}
+
+static int hb_process(rsHalfband *h, const float *in, int n, float *out)
+{
+    int half = (RS_HB_TAPS - 1) / 2;
+    int m = 0;
+    memcpy(&h->buf[2 * h->nbuf], in, 8 * n);
+    h->nbuf += n;
+    while (h->pos + RS_HB_TAPS <= h->nbuf) {
+        const float *c = &h->buf[2 * (h->pos + half)];
+        float yi = 0.5f * c[0];
+        float yq = 0.5f * c[1];
+        for (int j=0; j<(RS_HB_TAPS + 1) / 4; j++) {
+            int d = 2 * (2 * j + 1);
+            yi += hbTaps[j] * (c[-d  ] + c[d  ]);
+            yq += hbTaps[j] * (c[-d+1] + c[d+1]);
+        }
+        out[2*m  ] = yi;
+        out[2*m+1] = yq;
+        m += 1;
+        h->pos += 2;
+    }
+    // keep the last RS_HB_TAPS - 1 pairs for the next call
+    int keep = RS_HB_TAPS - 1;
+    int drop = h->nbuf - keep;
+    if (drop > 0) {
+        memmove(&h->buf[0], &h->buf[2 * drop], 8 * keep);
+        h->nbuf -= drop;
+        h->pos  -= drop;
+    }
+    return(m);
+}
+
+//  Polyphase rational stage, out = in * L / M.
+//    Output n sits at input time n * M / L; its branch is the
+//    fractional part, phase = (n * M) mod L.  The taps of each branch
+//    are stored reversed and doubled for I and Q, so every output is
+//    a straight dot product over 2K contiguous floats.
+//  The halfbands leave the polyphase stage under 4x down, which
+//    RS_MAX_K covers; odd rates can stop them early, and then the
+//    branches are cut to RS_MAX_K and the stopband is shallower.
+
+static int poly_design(resamp_t *r, double rate)
+{
+    long a = (long)rate, b = (long)r->out_rate;
+    long g = gcd(a, b);
+    r->L = (int)(b / g);
+    r->M = (int)(a / g);
+    if (r->L > RS_MAX_L) { return(-1); }
+    double lo    = (r->out_rate < rate) ? r->out_rate : rate;
+    double fs    = rate * r->L;             // prototype filter's rate
+    double dw    = 2.0 * pi * (RS_STOP - RS_PASS) * lo / fs;
+    int    ntaps = (int)ceil((RS_ATTEN - 8.0) / (2.285 * dw)) + 1;
+    int    K     = (ntaps + r->L - 1) / r->L;
+    if (K > RS_MAX_K) {
+        static int warned = 0;
+        if (!warned) {
+            double atten = 2.285 * dw * (RS_MAX_K * r->L - 1) + 8.0;
+            printf("resampler : %.0f to %.0f needs %d taps per branch, "
+                   "using %d, stopband about %.0f dB\n",
+                   r->in_rate, r->out_rate, K, RS_MAX_K, atten);
+            warned = 1;
+        }
+        K = RS_MAX_K;
+    }
+    if (K < 2) { K = 2; }
+    ntaps = K * r->L;
+    r->K  = K;
+    r->taps = (float *)malloc(sizeof(float) * 2 * K * r->L);
+    r->buf  = (float *)malloc(sizeof(float) * 2 * (K - 1 + RS_BLOCK));
+    if (r->taps == NULL || r->buf == NULL) { return(-1); }
+
+    double fc   = 0.5 * (RS_PASS + RS_STOP) * lo / fs;  // cycles / sample
+    double beta = kaiser_beta(RS_ATTEN);
+    double mid  = 0.5 * (ntaps - 1);
+    for (int i=0; i<ntaps; i++) {
+        double t = i - mid;
+        double h = (t == 0.0) ? 2.0 * fc : sin(2.0 * pi * fc * t) / (pi * t);
+        h *= kaiser(i, ntaps, beta) * r->L;     // L : interpolation gain
+        int p = i % r->L;                       // branch
+        int k = i / r->L;                       // tap within the branch
+        float *br = &r->taps[2 * K * p];
+        br[2 * (K - 1 - k)    ] = h;
+        br[2 * (K - 1 - k) + 1] = h;
+    }
+    r->nbuf  = K - 1;                           // start on zeroed history
+    bzero((char *)r->buf, sizeof(float) * 2 * (K - 1));
+    r->pos   = 0;
+    r->phase = 0;
+    return(0);
+}
+
+static int poly_process(resamp_t *r, const float *in, int n, float *out)
+{
+    int K = r->K;
+    int m = 0;
+    memcpy(&r->buf[2 * r->nbuf], in, 8 * n);
+    r->nbuf += n;
+    while (r->pos + K <= r->nbuf) {
+        const float *x = &r->buf[2 * r->pos];
+        const float *h = &r->taps[2 * K * r->phase];
+        float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+        int j = 0;
+        for ( ; j + 4 <= 2 * K; j += 4) {       // 2 pairs per step
+            s0 += h[j  ] * x[j  ];
+            s1 += h[j+1] * x[j+1];
+            s2 += h[j+2] * x[j+2];
+            s3 += h[j+3] * x[j+3];
+        }
+        for ( ; j < 2 * K; j += 2) {
+            s0 += h[j  ] * x[j  ];
+            s1 += h[j+1] * x[j+1];
+        }
+        out[2*m  ] = s0 + s2;
+        out[2*m+1] = s1 + s3;
+        m += 1;
+        r->phase += r->M;
+        r->pos   += r->phase / r->L;
+        r->phase  = r->phase % r->L;
+    }
+    int keep = K - 1;
+    int drop = r->nbuf - keep;
+    if (drop > r->pos) { drop = r->pos; }
+    if (drop > 0) {
+        memmove(&r->buf[0], &r->buf[2 * drop], 8 * (r->nbuf - drop));
+        r->nbuf -= drop;
+        r->pos  -= drop;
+    }
+    return(m);
+}
+
+//  Plan the chain : halve the rate while the next stage would still
+//    run at 2x the output rate or more, then finish with L/M.
+//    Returns -1 if the ratio can't be done.
+
+int resamp_init(resamp_t *r, double in_rate, double out_rate)
+{
+    static int designed = 0;
+    if (!designed) { hb_design(); designed = 1; }
+
+    bzero((char *)r, sizeof(resamp_t));
+    r->in_rate  = in_rate;
+    r->out_rate = out_rate;
+    if (out_rate <= 0.0 || out_rate > RS_MAX_UP * in_rate) { return(-1); }
+    if (floor(in_rate) != in_rate || floor(out_rate) != out_rate) {
+        return(-1);
+    }
+    double rate = in_rate;
+    while (rate >= 4.0 * out_rate && r->nhb < RS_MAX_HB
+           && fmod(rate, 2.0) == 0.0) {
+        r->nhb += 1;
+        rate   *= 0.5;
+    }
+    for (int i=0; i<r->nhb; i++) { r->hb[i].nbuf = RS_HB_TAPS - 1; }
+    if (rate != out_rate) {
+        if (poly_design(r, rate) < 0) {
+            resamp_free(r);
+            return(-1);
+        }
+    }
+    r->work = (float *)malloc(sizeof(float) * 2 * RS_BLOCK);
+    if (r->work == NULL) { resamp_free(r); return(-1); }
+    return(0);
+}
+
+void resamp_free(resamp_t *r)
+{
+    free(r->taps);
+    free(r->buf);
+    free(r->work);
+    r->taps = NULL;
+    r->buf  = NULL;
+    r->work = NULL;
+    r->L    = 0;
+    r->nhb  = 0;
+}
+
+//  room needed in out[] for n input pairs
+
+int resamp_max_out(resamp_t *r, int n)
+{
+    return((int)ceil(n * r->out_rate / r->in_rate) + 2);
+}
+
+//  n IQ pairs in, returns the number of IQ pairs written to out
+
+int resamp_process(resamp_t *r, const float *in, int n, float *out)
+{
+    int total = 0;
+    for (int k=0; k<n; k+=RS_BLOCK) {
+        int t = n - k;
+        if (t > RS_BLOCK) { t = RS_BLOCK; }
+        const float *src = &in[2*k];
+        float *w = r->work;
+        for (int i=0; i<r->nhb; i++) {
+            t   = hb_process(&r->hb[i], src, t, w);
+            src = w;                // halfbands run in place after the first
+        }
+        if (r->L > 0) {
+            t = poly_process(r, src, t, &out[2*total]);
+        } else if (src != &out[2*total]) {
+            memmove(&out[2*total], src, 8 * t);
+        }
+        total += t;
+    }
+    return(total);
+}
+
+// eof
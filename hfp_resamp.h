@@ -0,0 +1,52 @@
+//
+//  hfp_resamp.h
+//
+//  sample rate conversion for hfp_tcp :
+//    any number of halfband decimate-by-2 stages, then one polyphase
+//    rational (L/M) stage that lands exactly on the requested rate.
+//    Only the output samples that are kept get computed.
+//
+//   re-distribution under the BSD 3 clause license permitted
+//
+
+#ifndef HFP_RESAMP_H
+#define HFP_RESAMP_H
+
+#define RS_MAX_HB       (8)     // halfband stages, 768k / 256 = 3k
+#define RS_HB_TAPS      (19)    // halfband length, 4*j - 1
+#define RS_MAX_L        (1024)  // largest interpolation factor
+#define RS_MAX_K        (176)   // largest taps per polyphase branch,
+                                // enough for anything under 4x down
+#define RS_BLOCK        (1024)  // IQ pairs per internal pass
+#define RS_MAX_UP       (2.0)   // largest out/in rate ratio
+#define RS_ATTEN        (70.0)  // dB stopband for the polyphase stage
+#define RS_PASS         (0.40)  // passband edge, fraction of the lower rate
+#define RS_STOP         (0.50)  // stopband edge, fraction of the lower rate
+
+typedef struct rsHalfband {
+    float       buf[2 * (RS_HB_TAPS - 1 + RS_BLOCK)];  // history + input
+    int         nbuf;           // IQ pairs in buf
+    int         pos;            // next output's first input pair
+} rsHalfband;
+
+typedef struct resamp_t {
+    double      in_rate;
+    double      out_rate;
+    int         nhb;            // halfband stages in use
+    rsHalfband  hb[RS_MAX_HB];
+    int         L, M;           // final stage, 0 if not needed
+    int         K;              // taps per polyphase branch
+    float       *taps;          // L branches of 2K floats, I/Q duplicated
+    float       *buf;           // 2 * (K - 1 + RS_BLOCK) floats
+    int         nbuf;
+    int         pos;            // input pair of the next output
+    int         phase;          // branch of the next output, 0 .. L-1
+    float       *work;          // between stages, 2 * RS_BLOCK floats
+} resamp_t;
+
+int     resamp_init(resamp_t *r, double in_rate, double out_rate);
+void    resamp_free(resamp_t *r);
+int     resamp_max_out(resamp_t *r, int n);
+int     resamp_process(resamp_t *r, const float *in, int n, float *out);
+
+#endif  // HFP_RESAMP_H
@@ -0,0 +1,537 @@
+//
+//  hfp_ring.c
+//
+//  lock-free sample ring for hfp_tcp, see hfp_ring.h
+//
+//   re-distribution under the BSD 3 clause license permitted
+//
+
+#ifdef __linux__
+#define _GNU_SOURCE             // memfd_create
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "hfp_ring.h"
+
+//  Map the same pages at buf and buf + size.
+//    Returns NULL if the platform won't cooperate.
+
+static uint8_t *ring_map_mirror(long size)
+{
+    int fd = -1;
+#ifdef __linux__
+    fd = memfd_create("hfp_ring", 0);
+#else
+    char name[64];
+    snprintf(name, sizeof(name), "/hfp_ring.%d.%ld", (int)getpid(), size);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0) { shm_unlink(name); }
+#endif
+    if (fd < 0) { return(NULL); }
+    if (ftruncate(fd, size) != 0) { close(fd); return(NULL); }
+
+    // reserve 2 * size of address space, then map the file into both halves
+    uint8_t *base = mmap(NULL, 2 * size, PROT_NONE,
+                         MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (base == MAP_FAILED) { close(fd); return(NULL); }
+    void *a = mmap(base,        size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_FIXED, fd, 0);
+    void *b = mmap(base + size, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_FIXED, fd, 0);
+    close(fd);
+    if (a != base || b != base + size) {
+        munmap(base, 2 * size);
+        return(NULL);
+    }
+    return(base);
+}
+
+int ring_init(ring_t *r, long size, int frame)
+{
+    long sz = sysconf(_SC_PAGESIZE);
+    while (sz < size) { sz *= 2; }      // power of two, whole pages
+    bzero((char *)r, sizeof(ring_t));
+    r->buf = ring_map_mirror(sz);
+    r->mirrored = (r->buf != NULL);
+    if (r->buf == NULL) {
+        fprintf(stderr, "ring: mirrored mapping failed, using split copies\n");
+        r->buf = (uint8_t *)malloc(sz);
+        if (r->buf == NULL) { return(-1); }
+    }
+    bzero(r->buf, sz);
+    r->size  = sz;
+    r->mask  = sz - 1;
+    r->frame = frame;
+    r->frame_pairs = 1;
+    atomic_init(&r->wr_pos, 0);
+    atomic_init(&r->wr_end, 0);
+    atomic_init(&r->waiters, 0);
+    r->policy = RING_DROP_OLDEST;
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
+    return(0);
+}
+
+//  Unmaps or frees the buffer, once no writer or reader is left on it
+
+void ring_free(ring_t *r)
+{
+    if (r->buf == NULL) { return; }
+    if (r->mirrored) {
+        munmap(r->buf, 2 * r->size);
+    } else {
+        free(r->buf);
+    }
+    r->buf = NULL;
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->cond);
+}
+
+//  Free space starts here; with the mirror, up to size bytes are
+//    contiguous, otherwise only up to the end of the buffer.
+
+uint8_t *ring_write_ptr(ring_t *r, long *contig)
+{
+    long long w_pos = atomic_load_explicit(&r->wr_pos, memory_order_relaxed);
+    long w_index = (long)(w_pos & r->mask);
+    if (contig != NULL) {
+        *contig = r->mirrored ? r->size : r->size - w_index;
+    }
+    return(&r->buf[w_index]);
+}
+
+//  Announce that the writer is about to fill amount bytes from
+//    ring_write_ptr(), ahead of their ring_commit(), for readers that
+//    check afterwards whether bytes they used were written over.
+
+void ring_reserve(ring_t *r, long amount)
+{
+    long long w_pos = atomic_load_explicit(&r->wr_pos, memory_order_relaxed);
+    atomic_store_explicit(&r->wr_end, w_pos + amount, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);  // before the bytes go in
+}
+
+//  Publish amount bytes written at ring_write_ptr() to the readers.
+
+void ring_commit(ring_t *r, long amount)
+{
+    if (amount <= 0) { return; }
+    long long w_pos = atomic_load_explicit(&r->wr_pos, memory_order_relaxed);
+    // the bytes are visible before the new position (release), and
+    //   the store is ordered before the waiters check (seq_cst)
+    atomic_store_explicit(&r->wr_pos, w_pos + amount, memory_order_seq_cst);
+    if (atomic_load_explicit(&r->waiters, memory_order_seq_cst) > 0) {
+        pthread_mutex_lock(&r->lock);
+        pthread_cond_broadcast(&r->cond);   // wake waiting readers
+        pthread_mutex_unlock(&r->lock);
+    }
+}
+
+int ring_write(ring_t *r, const uint8_t *from_ptr, long amount)
+{
+    long contig = 0;
+    uint8_t *p = ring_write_ptr(r, &contig);
+    if (amount > r->size) { return(-1); }
+    ring_reserve(r, amount);
+    if (amount <= contig) {
+        memcpy(p, from_ptr, amount);
+    } else {                            // unmirrored fallback
+        memcpy(p, from_ptr, contig);
+        memcpy(&r->buf[0], from_ptr + contig, amount - contig);
+    }
+    ring_commit(r, amount);
+    return(0);
+}
+
+//  Writer side overrun handling.  The writer finds the slowest
+//    registered reader; RING_DROP_NEWEST and RING_BLOCK keep every
+//    reader within size - RING_GUARD bytes so it is never lapped.
+//    Passive readers are left out, and can be lapped under any policy.
+//    Held bytes are never overwritten, whatever the policy, even
+//    once their reader has been lapped past them.
+
+long ring_space(ring_t *r)
+{
+    long long w_pos = atomic_load_explicit(&r->wr_pos, memory_order_relaxed);
+    long space = r->size;
+    for (int i=0; i<RING_MAX_READERS; i++) {
+        ring_reader_t *rd = atomic_load_explicit(&r->readers[i],
+                                                 memory_order_acquire);
+        if (rd == NULL) { continue; }
+        long long hold = atomic_load_explicit(&rd->hold, memory_order_acquire);
+        if (hold >= 0 && (long)(r->size - (w_pos - hold)) < space) {
+            space = (long)(r->size - (w_pos - hold));
+        }
+        if (rd->passive || r->policy == RING_DROP_OLDEST) { continue; }
+        long long lag = w_pos - atomic_load_explicit(&rd->rd_pos,
+                                                     memory_order_acquire);
+        long room = (long)(r->size - RING_GUARD - lag);
+        if (room < space) { space = room; }
+    }
+    return((space > 0) ? space : 0);
+}
+
+//  RING_BLOCK : wait for room, woken by ring_consume().
+//    Returns the space available, which may be short on timeout.
+
+long ring_wait_space(ring_t *r, long need, int timeout_ms,
+                     volatile int *stop)
+{
+    long space = ring_space(r);
+    if (space >= need) { return(space); }
+    struct timespec t0, ts;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec  += timeout_ms / 1000;
+    ts.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec  += 1;
+        ts.tv_nsec -= 1000000000L;
+    }
+    pthread_mutex_lock(&r->lock);
+    atomic_store_explicit(&r->writer_waiting, 1, memory_order_seq_cst);
+    while (((space = ring_space(r)) < need) && (*stop == 0)) {
+        if (pthread_cond_timedwait(&r->cond, &r->lock, &ts) == ETIMEDOUT) {
+            space = ring_space(r);
+            break;
+        }
+    }
+    atomic_store_explicit(&r->writer_waiting, 0, memory_order_seq_cst);
+    pthread_mutex_unlock(&r->lock);
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    atomic_fetch_add_explicit(&r->blocked, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&r->blocked_ns,
+                              1000000000LL * (t1.tv_sec - t0.tv_sec)
+                              + (t1.tv_nsec - t0.tv_nsec),
+                              memory_order_relaxed);
+    return(space);
+}
+
+//  RING_DROP_NEWEST : the writer throws away amount bytes of output
+//    instead of committing them.  amount is whole frames.
+
+void ring_drop(ring_t *r, long amount)
+{
+    atomic_fetch_add_explicit(&r->dropped,
+                              amount / r->frame * r->frame_pairs,
+                              memory_order_relaxed);
+}
+
+//  sample number of the next sample the writer produces,
+//    counting the ones it dropped
+
+long long ring_sample_seq(ring_t *r)
+{
+    return(atomic_load_explicit(&r->wr_pos, memory_order_relaxed) / r->frame
+           * r->frame_pairs
+           + atomic_load_explicit(&r->dropped, memory_order_relaxed));
+}
+
+void ring_reader_attach(ring_reader_t *rd, ring_t *r)
+{
+    if (rd->ring != NULL) { ring_reader_detach(rd); }
+    long long w_pos = atomic_load_explicit(&r->wr_pos, memory_order_acquire);
+    rd->ring   = r;
+    rd->lapped = 0;
+    rd->high   = 0;
+    rd->dropped   = 0;
+    rd->last_drop = 0;
+    rd->drop_seq  = 0;
+    atomic_store_explicit(&rd->hold, -1, memory_order_release);
+    atomic_store_explicit(&rd->rd_pos, w_pos - (w_pos % r->frame),
+                          memory_order_release);
+    for (int i=0; i<RING_MAX_READERS; i++) {
+        ring_reader_t *expect = NULL;
+        if (atomic_compare_exchange_strong(&r->readers[i], &expect, rd)) {
+            return;
+        }
+    }
+    fprintf(stderr, "ring: too many readers, this one can be lapped\n");
+}
+
+void ring_reader_detach(ring_reader_t *rd)
+{
+    ring_t *r = rd->ring;
+    if (r == NULL) { return; }
+    for (int i=0; i<RING_MAX_READERS; i++) {
+        ring_reader_t *expect = rd;
+        atomic_compare_exchange_strong(&r->readers[i], &expect, NULL);
+    }
+    rd->ring = NULL;
+    pthread_mutex_lock(&r->lock);
+    pthread_cond_broadcast(&r->cond);       // a blocked writer may go on
+    pthread_mutex_unlock(&r->lock);
+}
+
+long ring_available(ring_reader_t *rd)
+{
+    long long w_pos = atomic_load_explicit(&rd->ring->wr_pos,
+                                           memory_order_acquire);
+    long long n = w_pos - atomic_load_explicit(&rd->rd_pos,
+                                               memory_order_relaxed);
+    if (n < 0) { n = 0; }	                // error condition ?
+    return((long)n);
+}
+
+//  Block until at least 'need' bytes are readable, the timeout
+//    expires, or *stop is set.  Returns bytes available.
+
+long ring_wait(ring_reader_t *rd, long need, int timeout_ms,
+               volatile int *stop)
+{
+    ring_t *r = rd->ring;
+    long avail = ring_available(rd);
+    if (avail >= need) { return(avail); }
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec  += timeout_ms / 1000;
+    ts.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec  += 1;
+        ts.tv_nsec -= 1000000000L;
+    }
+    pthread_mutex_lock(&r->lock);
+    atomic_fetch_add_explicit(&r->waiters, 1, memory_order_seq_cst);
+    while (((avail = ring_available(rd)) < need) && (*stop == 0)) {
+        if (pthread_cond_timedwait(&r->cond, &r->lock, &ts) == ETIMEDOUT) {
+            avail = ring_available(rd);
+            break;
+        }
+    }
+    atomic_fetch_sub_explicit(&r->waiters, 1, memory_order_seq_cst);
+    pthread_mutex_unlock(&r->lock);
+    return(avail);
+}
+
+//  Point *ptr at up to 'amount' readable bytes, in place in the ring.
+//    Returns the byte count; ring_consume() releases them.
+
+long ring_view(ring_reader_t *rd, uint8_t **ptr, long amount)
+{
+    return(ring_view_at(rd, 0, ptr, amount));
+}
+
+//  Same, starting 'skip' bytes past the reader's cursor, for a reader
+//    that has bytes out but not yet released.  If the writer laps the
+//    reader those bytes are gone, and the view restarts at the cursor.
+
+long ring_view_at(ring_reader_t *rd, long skip, uint8_t **ptr, long amount)
+{
+    ring_t *r = rd->ring;
+    long long r_pos = atomic_load_explicit(&rd->rd_pos, memory_order_relaxed);
+    long long w_pos = atomic_load_explicit(&r->wr_pos, memory_order_acquire);
+    if (w_pos - r_pos > atomic_load_explicit(&rd->high, memory_order_relaxed)) {
+        atomic_store_explicit(&rd->high, w_pos - r_pos, memory_order_relaxed);
+    }
+    if (w_pos - r_pos > r->size - RING_GUARD) {
+        // lapped by the writer: skip ahead to recent data,
+        //   keeping IQ frame alignment
+        long long skip_to = w_pos - (r->size / 2);
+        skip_to -= (skip_to - r_pos) % r->frame;
+        long long lost = (skip_to - r_pos) / r->frame * r->frame_pairs;
+        rd->drop_seq  = r_pos / r->frame * r->frame_pairs
+                        + atomic_load_explicit(&r->dropped, memory_order_relaxed);
+        rd->last_drop = lost;
+        rd->dropped  += lost;
+        r_pos = skip_to;
+        atomic_store_explicit(&rd->rd_pos, r_pos, memory_order_release);
+        rd->lapped += 1;
+        skip = 0;
+    }
+    r_pos += skip;
+    long long available = w_pos - r_pos;
+    if (available <= 0) { return(0); }
+    long n = amount;
+    if (n > available) { n = (long)available; }	// min(n, available)
+    long r_index = (long)(r_pos & r->mask);
+    if (!r->mirrored && r_index + n > r->size) {
+        n = r->size - r_index;              // up to the end, rest next time
+    }
+    *ptr = &r->buf[r_index];
+    return(n);
+}
+
+void ring_consume(ring_reader_t *rd, long amount)
+{
+    atomic_fetch_add_explicit(&rd->rd_pos, amount, memory_order_seq_cst);
+    ring_t *r = rd->ring;
+    if (atomic_load_explicit(&r->writer_waiting, memory_order_seq_cst)) {
+        pthread_mutex_lock(&r->lock);
+        pthread_cond_broadcast(&r->cond);
+        pthread_mutex_unlock(&r->lock);
+    }
+}
+
+//  ring_consume() for bytes used in place, by something that can
+//    block (a send), so the writer may have come round onto them in
+//    the meantime under RING_DROP_OLDEST.  If it did, what was used
+//    was partly newer samples, and the batch counts as a lap and a
+//    drop.  Returns 1 then, otherwise 0.  Bytes written but not yet
+//    committed count too, through wr_end (ring_reserve).
+
+int ring_release(ring_reader_t *rd, long amount)
+{
+    ring_t *r = rd->ring;
+    atomic_thread_fence(memory_order_acquire);  // after the bytes were used
+    long long r_pos = atomic_load_explicit(&rd->rd_pos, memory_order_relaxed);
+    long long w_pos = atomic_load_explicit(&r->wr_pos, memory_order_acquire);
+    long long w_end = atomic_load_explicit(&r->wr_end, memory_order_relaxed);
+    if (w_end > w_pos) { w_pos = w_end; }
+    int overwritten = (w_pos - r_pos > r->size);
+    if (overwritten) {
+        long long lost = (amount + r_pos % r->frame) / r->frame
+                         * r->frame_pairs;
+        rd->drop_seq  = r_pos / r->frame * r->frame_pairs
+                        + atomic_load_explicit(&r->dropped, memory_order_relaxed);
+        rd->last_drop = lost;
+        rd->dropped  += lost;
+        rd->lapped   += 1;
+    }
+    ring_consume(rd, amount);
+    return(overwritten);
+}
+
+//  Moves the reader's cursor forward to pos, for a reader discarding
+//    stale samples on purpose rather than being lapped.  The caller
+//    keeps the skip whole frames and not past the writer.  Returns
+//    the samples skipped; they aren't counted as dropped.
+
+long long ring_skip_to(ring_reader_t *rd, long long pos)
+{
+    long long r_pos = atomic_load_explicit(&rd->rd_pos, memory_order_relaxed);
+    if (pos <= r_pos) { return(0); }
+    ring_consume(rd, (long)(pos - r_pos));
+    return((pos - r_pos) / rd->ring->frame * rd->ring->frame_pairs);
+}
+
+//  Keeps the writer off everything from pos on, for a reader that
+//    has lent ring pages out past its own cursor; pos is at or before
+//    the oldest byte still lent, and -1 lets go.  Set it before lending.
+
+void ring_hold(ring_reader_t *rd, long long pos)
+{
+    atomic_store_explicit(&rd->hold, pos, memory_order_seq_cst);
+}
+
+//  Block pool, see hfp_ring.h
+
+int pool_init(pool_t *p, int blocks, int pairs)
+{
+    bzero((char *)p, sizeof(pool_t));
+    if ((blocks & (blocks - 1)) != 0) {
+        printf("block pool size %d is not a power of two\n", blocks);
+        return(-1);
+    }
+    p->mem   = (float *)malloc(sizeof(float) * 2 * pairs * blocks);
+    p->count = (int *)malloc(sizeof(int) * blocks);
+    if (p->mem == NULL || p->count == NULL) {
+        printf("block pool allocation failed\n");
+        return(-1);
+    }
+    bzero((char *)p->mem, sizeof(float) * 2 * pairs * blocks); // fault in now
+    p->blocks = blocks;
+    p->pairs  = pairs;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond, NULL);
+    return(0);
+}
+
+//  producer : the next free block, or NULL (and one more drop) if full
+
+float *pool_put_ptr(pool_t *p)
+{
+    long long h = atomic_load_explicit(&p->head, memory_order_relaxed);
+    long long t = atomic_load_explicit(&p->tail, memory_order_acquire);
+    if (h - t >= p->blocks) {
+        atomic_fetch_add_explicit(&p->dropped, 1, memory_order_relaxed);
+        return(NULL);
+    }
+    return(&p->mem[2L * p->pairs * (h & (p->blocks - 1))]);
+}
+
+void pool_put(pool_t *p, int n)
+{
+    long long h = atomic_load_explicit(&p->head, memory_order_relaxed);
+    p->count[h & (p->blocks - 1)] = n;
+    atomic_store_explicit(&p->head, h + 1, memory_order_seq_cst);
+    int used = (int)(h + 1 - atomic_load_explicit(&p->tail,
+                                                  memory_order_relaxed));
+    if (used > atomic_load_explicit(&p->high, memory_order_relaxed)) {
+        atomic_store_explicit(&p->high, used, memory_order_relaxed);
+    }
+    if (atomic_load_explicit(&p->waiters, memory_order_seq_cst) > 0) {
+        pthread_mutex_lock(&p->lock);
+        pthread_cond_signal(&p->cond);
+        pthread_mutex_unlock(&p->lock);
+    }
+}
+
+//  consumer : the oldest queued block, NULL on timeout or stop.
+//    The block stays owned by the consumer until pool_release().
+
+float *pool_get(pool_t *p, int *n, int timeout_ms, volatile int *stop)
+{
+    long long t = atomic_load_explicit(&p->tail, memory_order_relaxed);
+    if (atomic_load_explicit(&p->head, memory_order_acquire) == t) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec  += timeout_ms / 1000;
+        ts.tv_nsec += (timeout_ms % 1000) * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec  += 1;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_mutex_lock(&p->lock);
+        atomic_fetch_add_explicit(&p->waiters, 1, memory_order_seq_cst);
+        while ((atomic_load_explicit(&p->head, memory_order_seq_cst) == t)
+               && (*stop == 0)) {
+            if (pthread_cond_timedwait(&p->cond, &p->lock, &ts) == ETIMEDOUT) {
+                break;
+            }
+        }
+        atomic_fetch_sub_explicit(&p->waiters, 1, memory_order_seq_cst);
+        pthread_mutex_unlock(&p->lock);
+        if (atomic_load_explicit(&p->head, memory_order_acquire) == t) {
+            return(NULL);
+        }
+    }
+    *n = p->count[t & (p->blocks - 1)];
+    return(&p->mem[2L * p->pairs * (t & (p->blocks - 1))]);
+}
+
+void pool_release(pool_t *p)
+{
+    atomic_fetch_add_explicit(&p->tail, 1, memory_order_release);
+}
+
+int pool_used(pool_t *p)
+{
+    return((int)(atomic_load_explicit(&p->head, memory_order_relaxed)
+                 - atomic_load_explicit(&p->tail, memory_order_relaxed)));
+}
+
+long long mono_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(1000000000LL * ts.tv_sec + ts.tv_nsec);
+}
+
+void put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >>  8);
+    p[3] = (uint8_t)(v      );
+}
+
+// eof
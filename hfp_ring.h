@@ -0,0 +1,133 @@
+//
+//  hfp_ring.h
+//
+//  lock-free sample ring for hfp_tcp :
+//    one writer, any number of independent readers.
+//
+//    The buffer is mapped twice, back to back, so any span of up to
+//    size bytes starting anywhere in the ring is contiguous in memory.
+//    Positions are running byte counts; the buffer index is pos & mask.
+//    What happens when a reader falls behind by size - RING_GUARD
+//    bytes is the ring's overrun policy :
+//      RING_DROP_OLDEST  the reader is moved forward past old data
+//      RING_DROP_NEWEST  the writer discards what it was about to add
+//      RING_BLOCK        the writer waits for the reader, and counts it
+//    Either way whole IQ frames are discarded, and the discarded
+//    samples are counted against the stream's sample numbers.
+//    A reader can also hold bytes it has handed to someone else (the
+//    kernel, for zero-copy sends); the writer stays off those under
+//    every policy, and discards newest instead, until they're let go.
+//
+//   re-distribution under the BSD 3 clause license permitted
+//
+
+#ifndef HFP_RING_H
+#define HFP_RING_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define RING_GUARD      (1024L * 1024L) // keep readers this far from the writer
+#define RING_MAX_READERS (16)
+
+#define RING_DROP_OLDEST    (0)
+#define RING_DROP_NEWEST    (1)
+#define RING_BLOCK          (2)
+
+struct ring_reader_t;
+
+typedef struct ring_t {
+    uint8_t             *buf;       // size bytes, mirrored at buf + size
+    long                size;       // power of two
+    long                mask;
+    int                 mirrored;   // 0 if the double mapping failed
+    int                 frame;      // bytes per IQ sample pair, or block
+    int                 frame_pairs;    // IQ pairs per frame, 1 but for blocks
+    _Atomic long long   wr_pos;     // running count of bytes written
+    _Atomic long long   wr_end;     // may be writing up to here, uncommitted
+    atomic_int          waiters;    // readers blocked in ring_wait
+    int                 policy;     // RING_DROP_OLDEST ...
+    struct ring_reader_t * _Atomic readers[RING_MAX_READERS];
+    atomic_int          writer_waiting;
+    _Atomic long long   dropped;    // samples the writer discarded
+    _Atomic long long   blocked;    // times the writer waited
+    _Atomic long long   blocked_ns;
+    pthread_mutex_t     lock;       // only for waiting on cond
+    pthread_cond_t      cond;
+} ring_t;
+
+typedef struct ring_reader_t {
+    ring_t              *ring;
+    _Atomic long long   rd_pos;     // this reader's cursor
+    _Atomic long long   lapped;     // times the writer overran this reader
+    _Atomic long long   dropped;    // samples skipped over, in total
+    _Atomic long long   last_drop;  // samples skipped the last time
+    _Atomic long long   drop_seq;   // sample number where that gap began
+    _Atomic long long   high;       // most bytes ever waiting for it
+    _Atomic long long   hold;       // writer keeps off bytes from here,
+                                    //   -1 if none, see ring_hold()
+    int                 passive;    // never holds back the writer, set
+                                    //   before attaching (the recorder)
+} ring_reader_t;
+
+int     ring_init(ring_t *r, long size, int frame);
+void    ring_free(ring_t *r);
+
+//  writer side
+uint8_t *ring_write_ptr(ring_t *r, long *contig);
+void    ring_reserve(ring_t *r, long amount);
+void    ring_commit(ring_t *r, long amount);
+int     ring_write(ring_t *r, const uint8_t *from_ptr, long amount);
+long    ring_space(ring_t *r);
+long    ring_wait_space(ring_t *r, long need, int timeout_ms,
+                        volatile int *stop);
+void    ring_drop(ring_t *r, long amount);
+long long ring_sample_seq(ring_t *r);
+
+//  reader side
+void    ring_reader_attach(ring_reader_t *rd, ring_t *r);
+void    ring_reader_detach(ring_reader_t *rd);
+long    ring_available(ring_reader_t *rd);
+long    ring_wait(ring_reader_t *rd, long need, int timeout_ms,
+                  volatile int *stop);
+long    ring_view(ring_reader_t *rd, uint8_t **ptr, long amount);
+long    ring_view_at(ring_reader_t *rd, long skip, uint8_t **ptr, long amount);
+void    ring_consume(ring_reader_t *rd, long amount);
+int     ring_release(ring_reader_t *rd, long amount);
+long long ring_skip_to(ring_reader_t *rd, long long pos);
+void    ring_hold(ring_reader_t *rd, long long pos);
+
+//  Block pool : a fixed set of preallocated float blocks handed from
+//    one producer (the usb callback) to one consumer (the dsp worker).
+//    The producer never waits or allocates; when every block is
+//    queued it drops the incoming one and counts it.
+
+typedef struct pool_t {
+    float               *mem;       // blocks * 2 * pairs floats
+    int                 *count;     // IQ pairs in each queued block
+    int                 blocks;     // power of two
+    int                 pairs;      // capacity of a block
+    _Atomic long long   head;       // blocks put
+    _Atomic long long   tail;       // blocks released
+    _Atomic long long   dropped;    // blocks that found the pool full
+    atomic_int          high;       // most blocks queued at once
+    atomic_int          waiters;
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+} pool_t;
+
+int     pool_init(pool_t *p, int blocks, int pairs);
+float   *pool_put_ptr(pool_t *p);
+void    pool_put(pool_t *p, int n);
+float   *pool_get(pool_t *p, int *n, int timeout_ms, volatile int *stop);
+void    pool_release(pool_t *p);
+int     pool_used(pool_t *p);
+
+//  CLOCK_MONOTONIC in nanoseconds, for timing sends and kernels;
+//    a big endian u32, for the spectrum and UDP headers
+
+long long mono_ns(void);
+void    put_u32(uint8_t *p, uint32_t v);
+
+#endif  // HFP_RING_H
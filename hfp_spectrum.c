@@ -0,0 +1,267 @@
+//
+//  hfp_spectrum.c
+//
+//  Spectrum stream for hfp_tcp, see hfp_spectrum.h
+//
+//   re-distribution under the BSD 3 clause license permitted
+//
+
+#define _POSIX_C_SOURCE 200112L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "hfp_spectrum.h"
+
+#ifdef __APPLE__
+#define MSG_NOSIGNAL    0       // SIGPIPE is ignored by the server
+#endif
+
+//  The averaged power, fft shifted, as bytes of half dB
+
+static int spec_make_frame(spectrum_t *s, int nffts)
+{
+    uint8_t *f = s->frame;
+    int     n  = s->size;
+    memcpy(f, "HFPS", 4);
+    put_u32(f +  4, (uint32_t)n);
+    put_u32(f +  8, (uint32_t)s->freq);
+    put_u32(f + 12, (uint32_t)s->rate);
+    put_u32(f + 16, s->seq++);
+    for (int k=0; k<n; k++) {
+        double p  = s->power[(k + n/2) & (n - 1)] / nffts;
+        double db = 10.0 * log10(p + 1e-30);
+        double b  = floor(2.0 * (db + 127.5) + 0.5);
+        f[SPEC_HEADER_BYTES + k] = (uint8_t)((b < 0.0) ? 0.0
+                                             : ((b > 255.0) ? 255.0 : b));
+    }
+    return(SPEC_HEADER_BYTES + n);
+}
+
+//  Non-blocking sends : a viewer whose socket can't take the whole
+//    frame right away is dropped, so one slow viewer never stalls the rest.
+
+static void spec_send_frame(spectrum_t *s, int len)
+{
+    int fds[SPEC_MAX_VIEWERS], nv = 0;
+    pthread_mutex_lock(&s->lock);
+    nv = atomic_load(&s->nviewers);
+    memcpy(fds, s->viewers, nv * sizeof(int));
+    pthread_mutex_unlock(&s->lock);
+
+    for (int i=0; i<nv; i++) {          // never waits on a slow viewer
+        if (send(fds[i], s->frame, len, MSG_NOSIGNAL | MSG_DONTWAIT) == len) {
+            continue;
+        }
+        pthread_mutex_lock(&s->lock);
+        int m = atomic_load(&s->nviewers);
+        for (int j=0; j<m; j++) {
+            if (s->viewers[j] == fds[i]) {
+                s->viewers[j] = s->viewers[m - 1];
+                atomic_store(&s->nviewers, m - 1);
+                break;
+            }
+        }
+        m = atomic_load(&s->nviewers);
+        pthread_mutex_unlock(&s->lock);
+        close(fds[i]);
+        atomic_fetch_add_explicit(&s->dropped_viewers, 1,
+                                  memory_order_relaxed);
+        printf("spectrum viewer disconnected\n");
+        if (s->watch != NULL) { s->watch(s->ctx, m); }
+    }
+    atomic_fetch_add_explicit(&s->frames, 1, memory_order_relaxed);
+}
+
+//  One FFT of size pairs per pass, back to back over everything the
+//    dsp worker feeds in; a frame averages those since the last one.
+//    If the FFT is longer than a frame period, a frame per FFT.
+
+static void *spec_run(void *param)
+{
+    spectrum_t *s     = (spectrum_t *)param;
+    long       need   = 8L * s->size;
+    int        nffts  = 0;
+    long long  pairs  = 0;          // since the last frame
+    while (s->stop == 0) {
+        pthread_mutex_lock(&s->lock);
+        if (s->reset) {
+            ring_skip_to(&s->rd, s->reset_pos);
+            s->reset = 0;
+            nffts    = 0;
+            pairs    = 0;
+        }
+        pthread_mutex_unlock(&s->lock);
+        if (atomic_load(&s->nviewers) == 0) {
+            // nothing is fed; whatever is left is stale by now
+            ring_skip_to(&s->rd, atomic_load(&s->ring.wr_pos));
+            nffts = 0;
+            pairs = 0;
+            struct timespec idle = { 0, 20 * 1000000L };
+            nanosleep(&idle, NULL);
+            continue;
+        }
+        long avail = ring_wait(&s->rd, need, 100, &s->stop);
+        if (avail < need || s->stop) { continue; }
+        uint8_t *ptr = NULL;
+        if (ring_view(&s->rd, &ptr, need) < need) { continue; }
+
+        long long  t0 = mono_ns();
+        const float *x = (const float *)ptr;
+        for (int i=0; i<s->size; i++) {
+            s->work[2*i  ] = s->window[i] * x[2*i  ];
+            s->work[2*i+1] = s->window[i] * x[2*i+1];
+        }
+        ring_consume(&s->rd, need);
+        s->plan.exec(&s->plan, s->work);
+        if (nffts == 0) { bzero((char *)s->power, sizeof(double) * s->size); }
+        for (int i=0; i<s->size; i++) {
+            float re = s->work[2*i], im = s->work[2*i+1];
+            s->power[i] += (double)(re * re + im * im);
+        }
+        nffts += 1;
+        pairs += s->size;
+        atomic_fetch_add_explicit(&s->fft_ns, mono_ns() - t0,
+                                  memory_order_relaxed);
+        atomic_fetch_add_explicit(&s->ffts, 1, memory_order_relaxed);
+
+        if (pairs * s->fps >= (long long)s->rate) {
+            pthread_mutex_lock(&s->lock);
+            int stale = s->reset;       // retuned meanwhile, don't mix
+            int len   = stale ? 0 : spec_make_frame(s, nffts);
+            pthread_mutex_unlock(&s->lock);
+            if (len > 0) { spec_send_frame(s, len); }
+            nffts = 0;
+            pairs = 0;
+        }
+    }
+    return(NULL);
+}
+
+static void *spec_accept(void *param)
+{
+    spectrum_t *s = (spectrum_t *)param;
+    while (s->stop == 0) {
+        struct sockaddr_in6 addr;
+        socklen_t len = sizeof(addr);
+        int fd = accept(s->listen_fd, (struct sockaddr *)&addr, &len);
+        if (fd < 0) { break; }
+        char name[100];
+        inet_ntop(AF_INET6, &addr.sin6_addr, name, sizeof(name));
+        int sndbuf = SPEC_SNDBUF_FRAMES * (SPEC_HEADER_BYTES + s->size);
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+        shutdown(fd, SHUT_RD);          // viewers have nothing to say
+        pthread_mutex_lock(&s->lock);
+        int m = atomic_load(&s->nviewers);
+        if (m < SPEC_MAX_VIEWERS) {
+            s->viewers[m++] = fd;
+            atomic_store(&s->nviewers, m);
+            fd = -1;
+        }
+        pthread_mutex_unlock(&s->lock);
+        if (fd >= 0) {
+            printf("spectrum viewer from %s refused, %d already\n",
+                   name, SPEC_MAX_VIEWERS);
+            close(fd);
+        } else {
+            printf("spectrum viewer from %s\n", name);
+            if (s->watch != NULL) { s->watch(s->ctx, m); }
+        }
+    }
+    return(NULL);
+}
+
+//  size FFT points, a power of two; fps frames per second.
+//    freq and rate describe the capture spectrum_feed will be given.
+//    watch, if not NULL, hears of every viewer arriving or leaving.
+
+int spectrum_start(spectrum_t *s, int port, int size, int fps,
+                   double freq, double rate, spec_watch_fn watch, void *ctx)
+{
+    struct sockaddr_in6 addr;
+    int rr = 1;
+    bzero((char *)s, sizeof(spectrum_t));
+    s->size = size;
+    s->fps  = fps;
+    s->freq = freq;
+    s->rate = rate;
+    s->watch = watch;
+    s->ctx   = ctx;
+    if (fft_plan_init(&s->plan, size) < 0) { return(-1); }
+    s->window = (float *)malloc(sizeof(float) * size);
+    s->work   = (float *)malloc(sizeof(float) * 2 * size);
+    s->power  = (double *)malloc(sizeof(double) * size);
+    s->frame  = (uint8_t *)malloc(SPEC_HEADER_BYTES + size);
+    if (s->window == NULL || s->work == NULL || s->power == NULL
+        || s->frame == NULL) {
+        return(-1);
+    }
+    fft_window(s->window, size);
+    if (ring_init(&s->ring, SPEC_RING_BYTES, 8) < 0) { return(-1); }
+    pthread_mutex_init(&s->lock, NULL);
+    s->rd.passive = 1;                  // a slow FFT never holds up the dsp
+    ring_reader_attach(&s->rd, &s->ring);
+
+    s->listen_fd = socket(AF_INET6, SOCK_STREAM, 0);
+    if (s->listen_fd < 0) {
+        printf("ERROR opening spectrum socket\n");
+        return(-1);
+    }
+    setsockopt(s->listen_fd, SOL_SOCKET, SO_REUSEADDR,
+               (char *)&rr, sizeof(int));
+    bzero((char *)&addr, sizeof(addr));
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr   = in6addr_any;
+    addr.sin6_port   = htons(port);
+    if (bind(s->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        printf("ERROR on bind to spectrum port %d\n", port);
+        close(s->listen_fd);
+        return(-1);
+    }
+    listen(s->listen_fd, 4);
+    if (pthread_create(&s->fft_thread, NULL, spec_run, s) != 0
+        || pthread_create(&s->accept_thread, NULL, spec_accept, s) != 0) {
+        printf("could not create spectrum threads\n");
+        return(-1);
+    }
+    pthread_detach(s->accept_thread);
+    s->on = 1;
+    printf("spectrum on port %d, %d bins at %d frames/s (%s FFT)\n",
+           port, size, fps,
+           (s->plan.exec == fft_forward_scalar) ? "scalar" : "simd");
+    return(0);
+}
+
+//  from the dsp worker, the raw capture : never waits, and costs
+//    nothing with no viewers
+
+void spectrum_feed(spectrum_t *s, const float *p, int n)
+{
+    if (s->on && atomic_load_explicit(&s->nviewers, memory_order_relaxed) > 0) {
+        ring_write(&s->ring, (const uint8_t *)p, 8L * n);
+    }
+}
+
+//  The device was retuned; spectra start over from the samples after
+//    those in the ring now.
+
+void spectrum_tune(spectrum_t *s, double freq, double rate)
+{
+    if (!s->on) { return; }
+    pthread_mutex_lock(&s->lock);
+    s->freq      = freq;
+    s->rate      = rate;
+    s->reset     = 1;
+    s->reset_pos = atomic_load_explicit(&s->ring.wr_pos, memory_order_acquire);
+    pthread_mutex_unlock(&s->lock);
+}
+
+// eof
@@ -0,0 +1,74 @@
+//
+//  hfp_spectrum.h
+//
+//  Spectrum stream for hfp_tcp : averaged power spectra of the whole
+//    capture, for waterfall displays that can't take the IQ stream.
+//    The dsp worker feeds the raw float32 capture into the spectrum's
+//    own ring, only while someone is watching; a thread windows it,
+//    runs the FFT and averages the power of every FFT since the last
+//    frame, and sends each frame to all viewers on the spectrum port.
+//    One FFT pass serves every viewer.
+//
+//    A frame is a 20 byte header, all big endian :
+//      "HFPS", u32 bins, u32 center Hz, u32 sample rate, u32 frame seq
+//    then one byte per bin, lowest frequency first (DC in the middle),
+//    byte = 2 * (dBFS + 127.5) : 0 is -127.5 dBFS, 255 is 0 dBFS.
+//    Sends never wait : a viewer whose socket can't take a whole frame,
+//    SPEC_SNDBUF_FRAMES behind, is disconnected.
+//    The server is told as viewers come and go, so that it can keep
+//    the device streaming for them with no IQ clients.
+//
+//   re-distribution under the BSD 3 clause license permitted
+//
+
+#ifndef HFP_SPECTRUM_H
+#define HFP_SPECTRUM_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "hfp_ring.h"
+#include "hfp_fft.h"
+
+#define SPEC_RING_BYTES     (8L * 1024L * 1024L)    // ~1.3 s at 768k
+#define SPEC_MAX_VIEWERS    (16)
+#define SPEC_HEADER_BYTES   (20)
+#define SPEC_SNDBUF_FRAMES  (8)     // a viewer's queue, then it's dropped
+
+typedef void (*spec_watch_fn)(void *ctx, int viewers);
+
+typedef struct spectrum_t {
+    int             on;
+    int             size;       // FFT points, also bins per frame
+    int             fps;        // frames per second
+    fft_plan_t      plan;
+    float           *window;
+    float           *work;      // 2 * size, the FFT in place
+    double          *power;     // size, summed since the last frame
+    uint8_t         *frame;     // header and bins
+    ring_t          ring;
+    ring_reader_t   rd;
+    pthread_mutex_t lock;       // freq, rate, reset and the viewer list
+    double          freq, rate;
+    int             reset;      // retuned : skip to reset_pos, start over
+    long long       reset_pos;
+    int             listen_fd;
+    int             viewers[SPEC_MAX_VIEWERS];
+    atomic_int      nviewers;
+    spec_watch_fn   watch;      // called with the new count, no locks held
+    void            *ctx;       // passed to watch
+    volatile int    stop;
+    pthread_t       fft_thread, accept_thread;
+    uint32_t        seq;
+    _Atomic long long frames;   // sent, once per frame however many viewers
+    _Atomic long long ffts;
+    _Atomic long long fft_ns;
+    _Atomic long long dropped_viewers;
+} spectrum_t;
+
+int     spectrum_start(spectrum_t *s, int port, int size, int fps,
+                       double freq, double rate,
+                       spec_watch_fn watch, void *ctx);
+void    spectrum_feed(spectrum_t *s, const float *p, int n);
+void    spectrum_tune(spectrum_t *s, double freq, double rate);
+
+#endif  // HFP_SPECTRUM_H
@@ -2,8 +2,8 @@
 //  hfp_tcp_server.c
 //
 //  Serves IQ data using the rtl_tcp protocol
-//    from an Airspy HF+
-//    on iPv6 port 1234
+//    from each attached Airspy HF+
+//    on iPv6 port 1234, and up for further devices
 //
 #define VERSION "v.1.2.120" // 2020-12-06 rhn
 //   v.1.2.117 2020-09-02  rhn 
@@ -14,10 +14,10 @@
 //   re-distribution under the BSD 3 clause license permitted
 //
 //   pi :    
-//   	cc -std=c99 -lm -lairspyhf -lpthread -Os -o hfp_tcp hfp_tcp_server.c
+//   	cc -std=c11 -lm -lairspyhf -lpthread -Os -o hfp_tcp hfp_tcp_server.c hfp_dsp.c hfp_ring.c hfp_resamp.c hfp_metrics.c hfp_codec.c hfp_record.c hfp_play.c hfp_fft.c hfp_spectrum.c hfp_udp.c hfp_cpu.c
 //
 //   macOS : 
-//	clang -lm -llibairspyhf -lpthread -Os -o hfp_tcp hfp_tcp_server.c 
+//	clang -lm -llibairspyhf -lpthread -Os -o hfp_tcp hfp_tcp_server.c hfp_dsp.c hfp_ring.c hfp_resamp.c hfp_metrics.c hfp_codec.c hfp_record.c hfp_play.c hfp_fft.c hfp_spectrum.c hfp_udp.c hfp_cpu.c
 //   					// libairspyhf.1.6.8.dylib
 //
 //   requires these 2 files to compile
@@ -29,10 +29,27 @@
 #define SOCKET_READ_TIMEOUT_SEC ( 60.0 * 60.0 )
 #define SAMPLE_BITS     ( 8)    // default to match rtl_tcp
 // #define SAMPLE_BITS  (16)    // default to match rsp_tcp
+// #define SAMPLE_BITS  (12)    // packed, 3 bytes per IQ pair
 // #define SAMPLE_BITS  (32)    // HF+ capable of float32 IQ data
+#define BFP_BITS        (18)    // -b bfp, header byte 7 is 'B'
 #define GAIN8           (64.0)  // default gain
 #define PORT            (1234)  // default port
 #define RING_BUFFER_ALLOCATION  (2L * 8L * 1024L * 1024L)  // 16MB
+#define MAX_CLIENTS     (8)     // simultaneous rtl_tcp connections, per HF+
+#define MAX_DEVICES     (8)     // HF+ receivers served by one process
+#define CHANNEL_RING_ALLOCATION (4L * 1024L * 1024L)      // 4MB per channel
+#define CHANNEL_FILTER_ORDER    (12)
+#define CHANNEL_USABLE  (0.90)  // usable fraction of the captured span
+#define TILE_PAIRS      (512)   // IQ pairs per processing pass, 4 KB of floats
+#define TILE_OUT        (2 * TILE_PAIRS + 4)   // after resampling, RS_MAX_UP
+#define SEND_BATCH_MIN  (8192)  // bytes, default for -B
+#define SEND_BATCH_MAX  (256L * 1024L)  // largest single send
+#define SEND_LATENCY_MS (20)    // default for -L
+#define POOL_BLOCKS     (128)   // usb blocks queued for the dsp worker
+#define POOL_BLOCK_PAIRS (2048) // IQ pairs per block, libairspyhf sends 1024
+#define ZC_MAX_PENDING  (64)    // zero-copy sends awaiting completion
+#define ZC_MAX_INFLIGHT (RING_GUARD / 2)    // bytes, well inside the guard
+#define CMD_COMPRESS    (0x60)  // hfp_tcp extension : data 1 = HFPZ frames
 
 #define _POSIX_C_SOURCE 200112L
 #include <stdio.h>
@@ -53,6 +70,19 @@
 
 #include <pthread.h>
 #include <sys/time.h>
+#include <time.h>
+#include <poll.h>
+
+#ifdef __linux__
+#include <asm/socket.h>         // SO_ZEROCOPY, hidden by _POSIX_C_SOURCE
+#include <linux/errqueue.h>
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY    0x4000000
+#endif
+#ifdef SO_ZEROCOPY
+#define HFP_ZEROCOPY
+#endif
+#endif
 
 #ifndef _UNISTD_H_
 int usleep(unsigned long int usec);
@@ -60,49 +90,243 @@ int usleep(unsigned long int usec);
 
 #include <sys/time.h>
 
+#ifdef HFP_SIM
+#include "airspyhf_sim.h"       // make sim : no hardware needed
+#else
 #include "airspyhf.h"
+#endif
+#include "hfp_dsp.h"
+#include "hfp_ring.h"
+#include "hfp_resamp.h"
+#include "hfp_metrics.h"
+#include "hfp_codec.h"
+#include "hfp_record.h"
+#include "hfp_play.h"
+#include "hfp_spectrum.h"
+#include "hfp_udp.h"
+#include "hfp_cpu.h"
+
+typedef struct channel_t {      // a processed stream and its ring
+    int             in_use;
+    pthread_mutex_t lock;       // held by the callback while processing
+    long            offset;     // Hz from the hardware center frequency
+    long            rate;       // output sample rate
+    int             resamp;     // rs in use
+    resamp_t        rs;
+    int             decim;      // -F iir only, sampRate / rate
+    int             decimCntr;
+    float           gain;
+    int             dropping;   // RING_DROP_NEWEST, in a drop episode
+    dither_t        dither;
+    nco_t           nco;
+    iirCascade      iir;
+    float           bfp[2 * BFP_PAIRS];     // -b bfp, pairs short of a block
+    int             bfp_n;
+    uint8_t         bfp_seq;    // block counter
+    long long       retune_pos; // ring position of the last retune
+    const char      *name;      // "stream" or "channel", for logs
+    ring_t          ring;
+} channel_t;
+
+typedef struct zcSend {        // a send whose pages the kernel may still hold
+    uint32_t        id;         // MSG_ZEROCOPY counter
+    int             done;
+    long long       start;      // ring position of its first byte
+    long long       end;        // ring position just past its bytes
+} zcSend;
+
+typedef struct cmdBurst {      // commands that arrived together, coalesced
+    int             n;          // commands decoded
+    int             superseded; // retunes a later one in the burst replaced
+    int             has_freq, has_rate, has_gain;
+    long            freq;
+    long            rate;
+    int             gain;       // 10ths of dB
+    int             compress;   // CMD_COMPRESS, data 1
+    int             other;      // ignored commands, the last one below
+    int             other_msg;
+    uint32_t        other_data;
+} cmdBurst;
+
+typedef struct receiver_t receiver_t;
+
+typedef struct client_t {     // one per connected rtl_tcp client
+    int             in_use;
+    int             id;
+    receiver_t      *rx;            // the HF+ it is served from
+    int             sockfd;
+    int             sendErrorFlag;
+    int             stop_send_thread;
+    ring_reader_t   rd;             // cursor on chan0's ring or its own
+    channel_t       *chan;          // NULL unless in channel mode
+    atomic_llong    bytes_sent;
+    atomic_llong    sends;          // send syscalls
+    atomic_llong    stalls;         // sends that blocked past -L
+    int             zerocopy;       // -Z, sending straight from ring pages
+    long long       zc_pos;         // ring position sent up to
+    uint32_t        zc_next;        // id of the next zero-copy send
+    int             zc_head;        // oldest pending send
+    int             zc_count;
+    zcSend          zc[ZC_MAX_PENDING];
+    long long       zc_copied;      // completions the kernel copied anyway
+    volatile int    compress;       // CMD_COMPRESS asked for HFPZ frames
+    codec_t         *codec;         // encoder scratch, send thread only
+    uint8_t         *zbuf;          // one encoded frame
+    atomic_llong    z_frames;
+    atomic_llong    z_raw;          // bytes before compression
+    atomic_llong    z_bytes;        // and after, headers included
+    atomic_llong    z_ns;           // time spent encoding
+    atomic_llong    z_max_ns;       // slowest frame
+    long            batch_min;      // sendBatchMin, or less with -T
+    int             wait_ms;        // sendLatencyMs, or less with -T
+    long            sndbuf;         // -T, the SO_SNDBUF set for it
+    atomic_llong    flush_pos;      // -T : skip to here, set on retunes
+    atomic_llong    trimmed;        // samples skipped to stay under -T
+    atomic_llong    flushed;        // stale samples skipped after retunes
+    uint8_t         cmd[5];         // a command split across recvs
+    int             cmd_len;
+    pthread_t       cmd_thread;
+    pthread_t       send_thread;
+    char            addr[100];
+} client_t;
+
+struct receiver_t {             // one HF+, and everything serving it
+    int             id;             // 0.. in serial number order
+    uint64_t        serialnum;
+    airspyhf_device_t *device;
+    int             port;           // -p plus id
+    int             listen_sockfd;
+    pthread_t       accept_thread;
+    int             usb_cpu;        // -A, -1 for unpinned
+    int             dsp_cpu;
+    int             usb_pinned;     // the transfer thread, since its start
+    int             numSampleRates;
+    uint32_t        sampleRates[100];   // the hardware's
+    long            sampRate;
+    long            previousSRate;
+    float           gain0;
+    long            chanCenter;     // hardware stays parked here
+    long            tunedFreq;      // hardware center frequency
+    channel_t       chan0;          // full capture, shared by clients
+    channel_t       channels[MAX_CLIENTS];  // a client's slice of the capture
+    client_t        clients[MAX_CLIENTS];
+    int             numClients;     // connections being served
+    pthread_mutex_t clients_lock;
+    pthread_mutex_t device_lock;
+    pool_t          blockPool;      // usb callback -> dsp worker
+    pthread_t       dsp_thread;
+    recorder_t      recorder;
+    spectrum_t      spectrum;       // -S : FFT frames for viewers
+    udp_t           udpOut;         // -U : datagrams to the LAN
+    char            label[32];      // metrics : {device="1"}, "" for one HF+
+    char            label_in[32];   // the same inside braces, device="1",
+    atomic_llong    totalSamples;   // IQ pairs, dsp worker only
+    _Atomic float   sMax;           // peaks of the last usb block
+    _Atomic float   sMin;
+    atomic_llong    freqRetunes;
+    atomic_llong    rateRetunes;
+    atomic_llong    cmdCoalesced;   // retunes never applied, superseded
+    atomic_llong    ncoRetunes;     // -N, the hardware stayed put
+    atomic_llong    cbCalls;        // usb callback timing, in ns
+    atomic_llong    cbNanos;
+    atomic_llong    cbMaxNanos;
+    int             sendblockcount;
+};
 
-void *connection_handler(void);
+void *accept_loop(void *param);
+void *connection_handler(void *param);
+void cmd_decode(client_t *c, const uint8_t *p, int n, cmdBurst *b);
+void cmd_apply(client_t *c, cmdBurst *b);
+void client_flush(receiver_t *rx, client_t *c);
+void nco_tune(client_t *c, long freq);
 void *tcp_send_handler(void *param);
+void *dsp_worker(void *param);
 int usb_rcv_callback(airspyhf_transfer_t *context);
+int play_rcv_callback(const float *p, int n, void *ctx);
 static void sighandler(int signum);
 
-uint64_t            serialnum   =  0;
-airspyhf_device_t   *device     =  NULL;
-airspyhf_transfer_t context;
+receiver_t      receivers[MAX_DEVICES];
+int             numReceivers    =  0;
+int             maxDevices      =  MAX_DEVICES;     // -D
 
-int             sendErrorFlag   =  0;
 int             sampleBits      =  SAMPLE_BITS;
-int         numSampleRates      =  1;
-static long int totalSamples    =  0;
-long        sampRate            =  768000;
-long        previousSRate       = -1;
-float       gain0               =  GAIN8;
-int        gClientSocketID      = -1;
-
-uint8_t	   *ring_buffer_ptr     =  NULL;
-int		decimateFlag	=  1;
-int		decimateCntr	=  0;
-int		filterFlag	=  0;
-void 	iir_fbc(float *s, int n, int order);
-void 	init_iir();
-
-static int    listen_sockfd;
+int         iirFilter           =  0;   // -F iir
+int         zeroCopy            =  0;   // -Z 1
+int         ringPolicy          =  RING_DROP_OLDEST;    // -O
+long        sendBatchMin        =  SEND_BATCH_MIN;
+int         sendLatencyMs       =  SEND_LATENCY_MS;
+int         latencyTargetMs     =  0;   // -T, 0 for no bound
+int         ncoTune             =  0;   // -N 1 : retune in software
+int         pinMode             =  0;   // -A : 0 with several HF+, 1, -1 off
+int         pinFirst            =  0;   // -A, the first core used
+
+int             channelMode     =  0;   // -c : per-client DDC channels
+long            parkFreq        =  0;   // -c, where each HF+ stays
+char            *recPrefix      =  NULL;    // -R
+int             recStream       =  0;       // -Rk stream
+long            recMaxMB        =  0;       // -Rs
+int             recMaxSec       =  0;       // -Rt
+player_t        player;                 // -P : a file instead of the HF+
+char            *playPath       =  NULL;    // -P
+double          playSpeed       =  1.0;     // -Ps
+double          playRate        =  768000;  // -Pr, raw files
+int             specPort        =  0;       // -S, 0 for none
+int             specFps         =  10;      // -Sf
+int             specSize        =  2048;    // -Sn
+char            *udpDest        =  NULL;    // -U host:port
+int             udpPayload      =  UDP_PAYLOAD; // -Ud
+int             udpTtl          =  1;       // -Ut, multicast hops
+int             udpGso          =  0;       // -Ug 1
+
 struct sigaction    sigact, sigign;
 static volatile int     do_exit =  0;
-float        acc_r              =  0.0;    // accumulated rounding
-float        sMax               =  0.0;    // for debug
-float        sMin               =  0.0;
-int		sendblockcount  =  0;
+int           metricsPort       =  0;      // -M, 0 for none
 int 		threads_running =  0;
 
+void receiver_init(receiver_t *rx, int id, int port);
+void receiver_start(receiver_t *rx);
+void devices_open(int portno);
+void device_open(receiver_t *rx);
+void playback_open(receiver_t *rx);
+void threads_place(void);
+int  device_start(receiver_t *rx);
+void device_stop(receiver_t *rx);
+int  device_streaming(receiver_t *rx);
+void spectrum_watch(void *ctx, int viewers);
+int  device_idle(receiver_t *rx);
+
+int  ring_frame_bytes(void);
+int  ring_frame_pairs(void);
+void pipeline_stats(receiver_t *rx);
+long metrics_format_server(char *buf, long size);
+long hardware_rate(receiver_t *rx, long r);
+int  channel_set_rate(channel_t *ch, long in_rate, long out_rate);
+int  channel_open(client_t *c);
+void channel_close(client_t *c);
+int  channel_fits(receiver_t *rx, long offset, long rate);
+void channel_command(client_t *c, int msg, int data);
+
 char UsageString[]
-    = "Usage:    [-p listen port (default: 1234)]\n          [-b 16]";
+    = "Usage:    [-p listen port (default: 1234, then 1235.. per HF+)]"
+      "\n          [-D max HF+ devices] [-A first cpu/off (thread pinning)]"
+      "\n          [-b 8/12/16/32/bfp]"
+      "\n          [-c center frequency (per-client channels)]"
+      "\n          [-B min send batch bytes] [-L max send latency ms]"
+      "\n          [-T latency target ms (bounded queue, flush on retune)]"
+      "\n          [-N 1 (retune inside the passband by NCO)]"
+      "\n          [-F iir (IIR filter for integer decimation)]"
+      "\n          [-Z 1 (zero-copy sends, Linux)]"
+      "\n          [-M metrics port (Prometheus, localhost only)]"
+      "\n          [-R record file prefix] [-Rk raw/stream]"
+      "\n          [-Rs rotate MB] [-Rt rotate seconds]"
+      "\n          [-P playback file] [-Ps speed] [-Pr raw file rate]"
+      "\n          [-S spectrum port] [-Sf frames/s] [-Sn FFT size]"
+      "\n          [-U udp host:port or group:port] [-Ud payload bytes]"
+      "\n          [-Ut multicast ttl] [-Ug 1 (UDP GSO, Linux)]"
+      "\n          [-O oldest/newest/block (overrun policy)]";
 
 int main(int argc, char *argv[]) {
 
-    struct sockaddr_in6 serv_addr ;
-    char client_addr_ipv6[100];
     int portno     =  PORT;     //
     char *ipaddr =  NULL;       // "127.0.0.1"
     int n;
@@ -119,15 +343,159 @@ int main(int argc, char *argv[]) {
                     printf("invalid port number entry %s\n", argv[arg-1]);
                     exit(0);
                 }
+            } else if (strcmp(argv[arg-2], "-D")==0) {
+                maxDevices = atoi(argv[arg-1]);
+                if (maxDevices <= 0 || maxDevices > MAX_DEVICES) {
+                    printf("invalid device count %s (1 to %d)\n",
+                           argv[arg-1], MAX_DEVICES);
+                    exit(0);
+                }
+            } else if (strcmp(argv[arg-2], "-A")==0) {
+                if (strcmp(argv[arg-1],"off")==0) {
+                    pinMode  = -1;
+                } else {
+                    pinMode  = 1;
+                    pinFirst = atoi(argv[arg-1]);
+                    if (pinFirst < 0 || pinFirst >= cpu_count()) {
+                        printf("invalid cpu %s\n", argv[arg-1]);
+                        exit(0);
+                    }
+                }
             } else if (strcmp(argv[arg-2], "-b")==0) {
                 if (strcmp(argv[arg-1],"16")==0) {
                     sampleBits = 16;
                 } else if (strcmp(argv[arg-1],"8")==0) {
                     sampleBits =  8;
+                } else if (strcmp(argv[arg-1],"12")==0) {
+                    sampleBits = 12;    // packed, see quantize_12
+                } else if (strcmp(argv[arg-1],"32")==0) {
+                    sampleBits = 32;    // float32, gain not applied
+                } else if (strcmp(argv[arg-1],"bfp")==0) {
+                    sampleBits = BFP_BITS;  // see quantize_bfp
+                } else {
+                    printf("%s\n", UsageString);
+                    exit(0);
+                }
+            } else if (strcmp(argv[arg-2], "-c")==0) {
+                parkFreq = atol(argv[arg-1]);
+                if (parkFreq <= 0) {
+                    printf("invalid center frequency %s\n", argv[arg-1]);
+                    exit(0);
+                }
+                channelMode = 1;
+            } else if (strcmp(argv[arg-2], "-B")==0) {
+                sendBatchMin = atol(argv[arg-1]);
+                if (sendBatchMin <= 0 || sendBatchMin > SEND_BATCH_MAX) {
+                    printf("invalid send batch size %s\n", argv[arg-1]);
+                    exit(0);
+                }
+            } else if (strcmp(argv[arg-2], "-L")==0) {
+                sendLatencyMs = atoi(argv[arg-1]);
+                if (sendLatencyMs <= 0) {
+                    printf("invalid send latency %s\n", argv[arg-1]);
+                    exit(0);
+                }
+            } else if (strcmp(argv[arg-2], "-T")==0) {
+                latencyTargetMs = atoi(argv[arg-1]);
+                if (latencyTargetMs <= 0) {
+                    printf("invalid latency target %s\n", argv[arg-1]);
+                    exit(0);
+                }
+            } else if (strcmp(argv[arg-2], "-N")==0) {
+                ncoTune = (atoi(argv[arg-1]) != 0);
+            } else if (strcmp(argv[arg-2], "-F")==0) {
+                if (strcmp(argv[arg-1],"iir")==0) {
+                    iirFilter = 1;
+                } else if (strcmp(argv[arg-1],"fir")==0) {
+                    iirFilter = 0;
+                } else {
+                    printf("%s\n", UsageString);
+                    exit(0);
+                }
+            } else if (strcmp(argv[arg-2], "-Z")==0) {
+                zeroCopy = (atoi(argv[arg-1]) != 0);
+#ifndef HFP_ZEROCOPY
+                if (zeroCopy) {
+                    printf("zero-copy sends need Linux, copying instead\n");
+                    zeroCopy = 0;
+                }
+#endif
+            } else if (strcmp(argv[arg-2], "-M")==0) {
+                metricsPort = atoi(argv[arg-1]);
+                if (metricsPort <= 0) {
+                    printf("invalid metrics port %s\n", argv[arg-1]);
+                    exit(0);
+                }
+            } else if (strcmp(argv[arg-2], "-O")==0) {
+                if (strcmp(argv[arg-1],"oldest")==0) {
+                    ringPolicy = RING_DROP_OLDEST;
+                } else if (strcmp(argv[arg-1],"newest")==0) {
+                    ringPolicy = RING_DROP_NEWEST;
+                } else if (strcmp(argv[arg-1],"block")==0) {
+                    ringPolicy = RING_BLOCK;
+                } else {
+                    printf("%s\n", UsageString);
+                    exit(0);
+                }
+            } else if (strcmp(argv[arg-2], "-R")==0) {
+                recPrefix = argv[arg-1];
+            } else if (strcmp(argv[arg-2], "-Rk")==0) {
+                if (strcmp(argv[arg-1],"raw")==0) {
+                    recStream = 0;
+                } else if (strcmp(argv[arg-1],"stream")==0) {
+                    recStream = 1;
                 } else {
                     printf("%s\n", UsageString);
                     exit(0);
                 }
+            } else if (strcmp(argv[arg-2], "-Rs")==0) {
+                recMaxMB = atol(argv[arg-1]);
+            } else if (strcmp(argv[arg-2], "-Rt")==0) {
+                recMaxSec = atoi(argv[arg-1]);
+            } else if (strcmp(argv[arg-2], "-P")==0) {
+                playPath = argv[arg-1];
+            } else if (strcmp(argv[arg-2], "-Ps")==0) {
+                playSpeed = atof(argv[arg-1]);
+                if (playSpeed <= 0.0) {
+                    printf("invalid playback speed %s\n", argv[arg-1]);
+                    exit(0);
+                }
+            } else if (strcmp(argv[arg-2], "-Pr")==0) {
+                playRate = atof(argv[arg-1]);
+                if (playRate <= 0.0) {
+                    printf("invalid playback rate %s\n", argv[arg-1]);
+                    exit(0);
+                }
+            } else if (strcmp(argv[arg-2], "-S")==0) {
+                specPort = atoi(argv[arg-1]);
+                if (specPort <= 0) {
+                    printf("invalid spectrum port %s\n", argv[arg-1]);
+                    exit(0);
+                }
+            } else if (strcmp(argv[arg-2], "-Sf")==0) {
+                specFps = atoi(argv[arg-1]);
+                if (specFps <= 0 || specFps > 100) {
+                    printf("invalid spectrum frame rate %s\n", argv[arg-1]);
+                    exit(0);
+                }
+            } else if (strcmp(argv[arg-2], "-Sn")==0) {
+                specSize = atoi(argv[arg-1]);   // checked by fft_plan_init
+            } else if (strcmp(argv[arg-2], "-U")==0) {
+                udpDest = argv[arg-1];
+            } else if (strcmp(argv[arg-2], "-Ud")==0) {
+                udpPayload = atoi(argv[arg-1]);
+                if (udpPayload <= 0 || udpPayload > UDP_MAX_PAYLOAD) {
+                    printf("invalid udp payload %s\n", argv[arg-1]);
+                    exit(0);
+                }
+            } else if (strcmp(argv[arg-2], "-Ut")==0) {
+                udpTtl = atoi(argv[arg-1]);
+                if (udpTtl <= 0 || udpTtl > 255) {
+                    printf("invalid multicast ttl %s\n", argv[arg-1]);
+                    exit(0);
+                }
+            } else if (strcmp(argv[arg-2], "-Ug")==0) {
+                udpGso = (atoi(argv[arg-1]) != 0);
             } else if (strcmp(argv[arg-2], "-a")==0) {
         ipaddr = argv[arg-1];        // unused
             } else {
@@ -138,23 +506,7 @@ int main(int argc, char *argv[]) {
     }
 
     printf("\nhfp_tcp Version %s\n\n", VERSION);
-
-    ring_buffer_ptr = (uint8_t *)malloc(RING_BUFFER_ALLOCATION + 4);
-    if (ring_buffer_ptr == NULL) { exit(-1); }
-    bzero(ring_buffer_ptr, RING_BUFFER_ALLOCATION + 2);
-
-    printf("Serving %d-bit samples on port %d\n", sampleBits, portno);
-
-    uint64_t serials[4] = { 0L,0L,0L,0L };
-    int count = 2;
-    n = airspyhf_list_devices(&serials[0], count);
-    printf("hf+ devices = %d\n", n);
-    if (n == 0L) { exit(-1); }
-    printf("hf+ serial# = ");
-    uint64_t t = serials[0];
-    printf("%" PRIu64 "\n", t);
-    serialnum = t;
-    if (serialnum == 0L) { exit(-1); }
+    printf("dsp kernels: %s\n", dsp_init());
 
     sigact.sa_handler = sighandler;
     sigemptyset(&sigact.sa_mask);
@@ -169,338 +521,1189 @@ int main(int argc, char *argv[]) {
     sigaction(SIGPIPE, &sigign, NULL);
 #endif
 
-    n = airspyhf_open_sn(&device, serialnum);
-    printf("hf+ open status = %d\n", n);
-    if ((n < 0) || (device == NULL)) { exit(-1); }
+    if (playPath != NULL) {
+        receiver_init(&receivers[0], 0, portno);
+        numReceivers = 1;
+        playback_open(&receivers[0]);
+    } else {
+        devices_open(portno);
+    }
+    threads_place();
+    for (int k=0; k<numReceivers; k++) {
+        receiver_start(&receivers[k]);
+    }
 
-    airspyhf_lib_version_t version;
-    airspyhf_lib_version(&version);
-    printf("\nlibairspyhf   %" PRIu32 ".%" PRIu32 ".%" PRIu32 "\n",
-           version.major_version, version.minor_version, version.revision);
+    if (metricsPort > 0) {
+        metrics_start(metricsPort, metrics_format_server);
+    }
 
-    char versionString[64];
-    uint8_t versionLength = 64;
+    for (int k=0; k<numReceivers; k++) {    // until the listeners fail
+        pthread_join(receivers[k].accept_thread, NULL);
+    }
+    for (int k=0; k<numReceivers; k++) {
+        if (receivers[k].device != NULL) {
+            n = airspyhf_close(receivers[k].device);
+            printf("hf+ close status = %d\n", n);
+        }
+    }
 
-    bzero((char *)&versionString[0], 64);
+    fflush(stdout);
+    return 0;
+}  //  main
 
-    n = airspyhf_version_string_read(device, &versionString[0], versionLength);
-    if (n == AIRSPYHF_ERROR) {
-    printf("Error reading version string");
-    exit(-1);
+//  A receiver's defaults, before its HF+ (or -P file) is opened
+
+void receiver_init(receiver_t *rx, int id, int port)
+{
+    bzero((char *)rx, sizeof(receiver_t));
+    rx->id             =  id;
+    rx->port           =  port;
+    rx->listen_sockfd  = -1;
+    rx->usb_cpu        = -1;
+    rx->dsp_cpu        = -1;
+    rx->numSampleRates =  1;
+    rx->sampleRates[0] =  768000;
+    rx->sampRate       =  768000;
+    rx->previousSRate  = -1;
+    rx->gain0          =  GAIN8;
+    rx->chanCenter     =  parkFreq;
+    pthread_mutex_init(&rx->clients_lock, NULL);
+    pthread_mutex_init(&rx->device_lock, NULL);
+}
+
+//  -U host:port : the first HF+ sends to port, the next to port + 1..
+
+const char *udp_dest(receiver_t *rx, char *buf, int size)
+{
+    const char *colon = strrchr(udpDest, ':');
+    if (rx->id == 0 || colon == NULL) { return(udpDest); }
+    snprintf(buf, size, "%.*s:%d", (int)(colon - udpDest), udpDest,
+             atoi(colon + 1) + rx->id);
+    return(buf);
+}
+
+//  Everything that serves an opened receiver : its ring, dsp worker,
+//    recorder, spectrum and udp outputs, then its listener.
+
+void receiver_start(receiver_t *rx)
+{
+    struct sockaddr_in6 serv_addr;
+    channel_t *chan0 = &rx->chan0;
+
+    if (numReceivers > 1) {         // metrics labels
+        snprintf(rx->label, sizeof(rx->label), "{device=\"%d\"}", rx->id);
+        snprintf(rx->label_in, sizeof(rx->label_in), "device=\"%d\",",
+                 rx->id);
+    }
+    dither_init(&chan0->dither, (uint32_t)time(NULL) + rx->id);
+    if (ring_init(&chan0->ring, RING_BUFFER_ALLOCATION,
+                  ring_frame_bytes()) < 0) {
+        exit(-1);
+    }
+    chan0->ring.policy = ringPolicy;
+    chan0->ring.frame_pairs = ring_frame_pairs();
+    pthread_mutex_init(&chan0->lock, NULL);
+    chan0->name  = "stream";
+    chan0->decim = 1;
+    chan0->rate  = rx->sampRate;
+    chan0->gain  = rx->gain0;
+    for (int i=0; i<MAX_CLIENTS; i++) {
+        pthread_mutex_init(&rx->channels[i].lock, NULL);
+        rx->channels[i].name = "channel";
+    }
+    if (pool_init(&rx->blockPool, POOL_BLOCKS, POOL_BLOCK_PAIRS) < 0) {
+        exit(-1);
+    }
+    if (pthread_create(&rx->dsp_thread, NULL, dsp_worker, rx) != 0) {
+        printf("could not create dsp thread\n");
+        exit(-1);
     }
-    printf("hf+ firmware %s\n\n", versionString);
 
-    uint32_t sr_buffer[100];
-    airspyhf_get_samplerates(device, sr_buffer, 0);
-    uint32_t sr_len = sr_buffer[0];
-    printf("number of supported sample rates: %d \n", sr_len);
-    if (sr_len > 0 && sr_len < 100) {
-      numSampleRates     =  sr_len;
-      airspyhf_get_samplerates(device, sr_buffer, sr_len);
-      printf("supported sample rates: ");
-        for (int i=0; i<sr_len; i++) {
-          printf("%d ", sr_buffer[i]);
+    printf("Serving %d-bit samples on port %d\n", sampleBits, rx->port);
+
+    if (recPrefix != NULL) {
+        ring_t     *src   =  NULL;          // raw float32 at the hw rate
+        int        frame  =  8;
+        const char *dtype = "cf32_le";
+        double     rate   =  rx->sampRate;
+        char       prefix[400];
+        if (recStream) {
+            if (channelMode || sampleBits == 12 || sampleBits == BFP_BITS) {
+                printf("-Rk stream needs -b 8, 16 or 32, and no -c or -P\n");
+                exit(0);
+            }
+            src   = &chan0->ring;
+            frame = ring_frame_bytes();
+            dtype = (sampleBits == 8) ? "cu8"
+                  : ((sampleBits == 16) ? "ci16_le" : "cf32_le");
+            rate  = chan0->rate;
+        }
+        if (numReceivers > 1) {     // files of their own, by serial
+            snprintf(prefix, sizeof(prefix), "%s-%016" PRIx64,
+                     recPrefix, rx->serialnum);
+        } else {
+            snprintf(prefix, sizeof(prefix), "%s", recPrefix);
+        }
+        if (recorder_start(&rx->recorder, prefix, src, frame, dtype,
+                           (double)rx->tunedFreq, rate,
+                           recMaxMB * 1024L * 1024L, recMaxSec) < 0) {
+            printf("could not start the recorder\n");
+            exit(-1);
         }
-        printf(" \n\n");
     }
 
-    int sampRate = 768000;
-    n = airspyhf_set_samplerate(device, sampRate);
-    printf("set rate status = %d %d\n", sampRate, n);
-    previousSRate = sampRate;
-    long int f0 = 162450000;
-    n = airspyhf_set_freq(device, f0);
-    printf("set f0 status = %ld %d\n", f0, n);
+    if (specPort > 0) {
+        if (spectrum_start(&rx->spectrum, specPort + rx->id, specSize,
+                           specFps, (double)rx->tunedFreq,
+                           (double)rx->sampRate, spectrum_watch, rx) < 0) {
+            printf("could not start the spectrum stream\n");
+            exit(-1);
+        }
+    }
+
+    if (udpDest != NULL) {
+        char dest[200];
+        if (channelMode) {          // -P runs in channel mode too
+            printf("-U sends the full stream, not with -c or -P\n");
+            exit(0);
+        }
+        if (udp_start(&rx->udpOut, udp_dest(rx, dest, sizeof(dest)),
+                      &chan0->ring, udpPayload, sampleBits, udpTtl, udpGso,
+                      sendLatencyMs) < 0) {
+            printf("could not start udp output\n");
+            exit(-1);
+        }
+        udp_tune(&rx->udpOut, (double)rx->tunedFreq, (double)chan0->rate);
+        pthread_mutex_lock(&rx->device_lock);
+        if (device_start(rx) < 0) { exit(-1); } // streams with no clients
+        pthread_mutex_unlock(&rx->device_lock);
+    }
 
-    printf("\nhfp_tcp IPv6 server started on port %d\n", portno);
+    printf("\nhfp_tcp IPv6 server started on port %d\n", rx->port);
 
-    listen_sockfd = socket(AF_INET6, SOCK_STREAM, 0);
-    if (listen_sockfd < 0) {
+    rx->listen_sockfd = socket(AF_INET6, SOCK_STREAM, 0);
+    if (rx->listen_sockfd < 0) {
         printf("ERROR opening socket");
-        return(-1);
+        exit(-1);
     }
 
     struct linger ling = {1,0};
     int rr = 1;
-    setsockopt(listen_sockfd, SOL_SOCKET, SO_REUSEADDR,
+    setsockopt(rx->listen_sockfd, SOL_SOCKET, SO_REUSEADDR,
             (char *)&rr, sizeof(int));
-    setsockopt(listen_sockfd, SOL_SOCKET, SO_LINGER,
+    setsockopt(rx->listen_sockfd, SOL_SOCKET, SO_LINGER,
             (char *)&ling, sizeof(ling));
 
     bzero((char *) &serv_addr, sizeof(serv_addr));
     serv_addr.sin6_flowinfo = 0;
     serv_addr.sin6_family = AF_INET6;
     serv_addr.sin6_addr = in6addr_any;
-    serv_addr.sin6_port = htons(portno);
+    serv_addr.sin6_port = htons(rx->port);
 
     // Sockets Layer Call: bind()
-    if (bind( listen_sockfd, (struct sockaddr *)&serv_addr,
+    if (bind( rx->listen_sockfd, (struct sockaddr *)&serv_addr,
              sizeof(serv_addr) ) < 0) {
-        printf("ERROR on bind to listen\n");
-        return(-1);
+        printf("ERROR on bind to listen port %d\n", rx->port);
+        exit(-1);
     }
 
-    listen(listen_sockfd, 5);
+    listen(rx->listen_sockfd, 5);
+    if (pthread_create(&rx->accept_thread, NULL, accept_loop, rx) != 0) {
+        printf("could not create accept thread\n");
+        exit(-1);
+    }
     fprintf(stdout, "listening for socket connection \n");
+}
 
-    while (1) {
+//  Accepts rx's connections, then hands each to its own thread
 
-        // accept a connection
+void *accept_loop(void *param)
+{
+    receiver_t *rx = (receiver_t *)param;
+    char client_addr_ipv6[100];
 
+    while (1) {
         struct sockaddr_in6 cli_addr;
         socklen_t claddrlen = sizeof(cli_addr);
-        gClientSocketID = accept( listen_sockfd,
-                                 (struct sockaddr *) &cli_addr,
-                                 &claddrlen );
-        if (gClientSocketID < 0) {
+        int sockfd = accept( rx->listen_sockfd,
+                             (struct sockaddr *) &cli_addr,
+                             &claddrlen );
+        if (sockfd < 0) {
             printf("ERROR on accept\n");
             break;
         }
 
         inet_ntop(AF_INET6, &(cli_addr.sin6_addr), client_addr_ipv6, 100);
-        printf("\nConnected to client with IP address: %s\n",
-               client_addr_ipv6);
+        printf("\nConnected to client with IP address: %s, port %d\n",
+               client_addr_ipv6, rx->port);
+
+        client_t *c = NULL;
+        pthread_mutex_lock(&rx->clients_lock);
+        for (int i=0; i<MAX_CLIENTS; i++) {
+            if (rx->clients[i].in_use == 0) {
+                c = &rx->clients[i];
+                bzero((char *)c, sizeof(client_t));
+                c->in_use = 1;
+                c->id     = i;
+                c->rx     = rx;
+                c->sockfd = sockfd;
+                strncpy(c->addr, client_addr_ipv6, sizeof(c->addr) - 1);
+                rx->numClients += 1;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&rx->clients_lock);
+        if (c == NULL) {
+            printf("too many clients (max %d), closing connection\n",
+                   MAX_CLIENTS);
+            close(sockfd);
+            continue;
+        }
+
+        if (pthread_create(&c->cmd_thread, NULL,
+                           connection_handler, (void *)c) != 0) {
+            printf("could not create client thread\n");
+            close(sockfd);
+            pthread_mutex_lock(&rx->clients_lock);
+            c->in_use   = 0;
+            rx->numClients -= 1;
+            pthread_mutex_unlock(&rx->clients_lock);
+            continue;
+        }
+        pthread_detach(c->cmd_thread);
+    }
+    return(NULL);
+}
+
+//  Lists the attached HF+s and opens up to -D of them, in serial
+//    number order, so each keeps its port from one run to the next.
+
+void devices_open(int portno)
+{
+    uint64_t serials[MAX_DEVICES];
+    int n;
+
+    bzero((char *)serials, sizeof(serials));
+    n = airspyhf_list_devices(&serials[0], MAX_DEVICES);
+    printf("hf+ devices = %d\n", n);
+    if (n <= 0) { exit(-1); }
+    if (n > MAX_DEVICES) { n = MAX_DEVICES; }
+    for (int i=1; i<n; i++) {
+        uint64_t t = serials[i];
+        int      j = i;
+        for ( ; j > 0 && serials[j-1] > t; j--) { serials[j] = serials[j-1]; }
+        serials[j] = t;
+    }
+    if (n > maxDevices) { n = maxDevices; }
 
-        connection_handler();
+    airspyhf_lib_version_t version;
+    airspyhf_lib_version(&version);
+    printf("\nlibairspyhf   %" PRIu32 ".%" PRIu32 ".%" PRIu32 "\n",
+           version.major_version, version.minor_version, version.revision);
 
+    for (int k=0; k<n; k++) {
+        receiver_init(&receivers[k], k, portno + k);
+        receivers[k].serialnum = serials[k];
+        device_open(&receivers[k]);
     }
+    numReceivers = n;
+}
 
-    n = airspyhf_close(device);
-    printf("hf+ close status = %d\n", n);
+//  Opens rx's HF+, parks it at 768k and either
+//    the default frequency or the -c center.
 
-    fflush(stdout);
-    return 0;
-}  //  main
+void device_open(receiver_t *rx)
+{
+    int n;
+
+    printf("\nhf+ %d serial# = ", rx->id);
+    printf("%" PRIu64 "\n", rx->serialnum);
+    if (rx->serialnum == 0L) { exit(-1); }
+
+    n = airspyhf_open_sn(&rx->device, rx->serialnum);
+    printf("hf+ open status = %d\n", n);
+    if ((n < 0) || (rx->device == NULL)) { exit(-1); }
+
+    char versionString[64];
+    uint8_t versionLength = 64;
+
+    bzero((char *)&versionString[0], 64);
+
+    n = airspyhf_version_string_read(rx->device, &versionString[0],
+                                     versionLength);
+    if (n == AIRSPYHF_ERROR) {
+    printf("Error reading version string");
+    exit(-1);
+    }
+    printf("hf+ firmware %s\n\n", versionString);
+
+    uint32_t sr_buffer[100];
+    airspyhf_get_samplerates(rx->device, sr_buffer, 0);
+    uint32_t sr_len = sr_buffer[0];
+    printf("number of supported sample rates: %d \n", sr_len);
+    if (sr_len > 0 && sr_len < 100) {
+      rx->numSampleRates = sr_len;
+      airspyhf_get_samplerates(rx->device, sr_buffer, sr_len);
+      printf("supported sample rates: ");
+        for (int i=0; i<sr_len; i++) {
+          printf("%d ", sr_buffer[i]);
+          rx->sampleRates[i] = sr_buffer[i];
+        }
+        printf(" \n\n");
+    }
+
+    rx->sampRate = 768000;
+    n = airspyhf_set_samplerate(rx->device, rx->sampRate);
+    printf("set rate status = %ld %d\n", rx->sampRate, n);
+    rx->previousSRate = rx->sampRate;
+    long int f0 = 162450000;
+    if (channelMode) {
+        f0 = rx->chanCenter;
+        printf("channel mode: hardware parked at %ld Hz\n", f0);
+    }
+    n = airspyhf_set_freq(rx->device, f0);
+    printf("set f0 status = %ld %d\n", f0, n);
+    rx->tunedFreq = f0;
+}
+
+//  -P : the file stands in for the HF+.  Its rate is the capture rate
+//    and its frequency the center, in channel mode, so frequency and
+//    rate commands select and resample a slice of the recording.
+
+void playback_open(receiver_t *rx)
+{
+    if (player_open(&player, playPath, playRate) < 0) { exit(-1); }
+    player.speed = playSpeed;
+    rx->sampRate = (long)player.rate;
+    rx->numSampleRates = 1;
+    rx->sampleRates[0] = (uint32_t)rx->sampRate;
+    rx->previousSRate  = rx->sampRate;
+    if (player.freq > 0.0) {
+        rx->chanCenter = (long)player.freq;
+    } else if (!channelMode) {
+        rx->chanCenter = 162450000;
+    }
+    channelMode   = 1;
+    rx->tunedFreq = rx->chanCenter;
+    printf("playback: %s, %lld samples at %ld, centered at %ld Hz, "
+           "speed %.2f\n", playPath, player.pairs, rx->sampRate,
+           rx->chanCenter, player.speed);
+}
+
+//  -A : each receiver's usb thread and dsp worker get a core apiece,
+//    pairs of cores from pinFirst up, shared round when there are too
+//    few.  By default only with several HF+, whose threads would
+//    otherwise wander onto each other's cores.
+
+void threads_place()
+{
+    int ncpu = cpu_count();
+    if (pinMode < 0 || (pinMode == 0 && numReceivers < 2)) { return; }
+    for (int k=0; k<numReceivers; k++) {
+        receiver_t *rx = &receivers[k];
+        rx->usb_cpu = (pinFirst + 2 * k) % ncpu;
+        rx->dsp_cpu = (pinFirst + 2 * k + 1) % ncpu;
+        printf("hf+ %d: usb thread on cpu %d, dsp worker on cpu %d\n",
+               k, rx->usb_cpu, rx->dsp_cpu);
+    }
+    if (pinFirst + 2 * numReceivers > ncpu) {
+        printf("%d cpus from %d for %d hf+, some threads share\n",
+               ncpu - pinFirst, pinFirst, numReceivers);
+    }
+}
 
 static void sighandler(int signum)
 {
         fprintf(stderr, "Signal caught, exiting!\n");
         fflush(stderr);
-        close(listen_sockfd);
-        if (gClientSocketID != 0) {
-            close(gClientSocketID);
-            gClientSocketID = -1;
-        }
-        if (device != NULL) {
-            airspyhf_close(device);
-            device = NULL;
+        for (int k=0; k<numReceivers; k++) {
+            receiver_t *rx = &receivers[k];
+            recorder_stop(&rx->recorder);   // flush and close the file
+            close(rx->listen_sockfd);
+            for (int i=0; i<MAX_CLIENTS; i++) {
+                if (rx->clients[i].in_use && rx->clients[i].sockfd >= 0) {
+                    close(rx->clients[i].sockfd);
+                    rx->clients[i].sockfd = -1;
+                }
+            }
+            if (rx->device != NULL) {
+                airspyhf_close(rx->device);
+                rx->device = NULL;
+            }
         }
+        player_close(&player);
     exit(-1);
         do_exit = 1;
 }
 
-int stop_send_thread = 0;
 int thread_counter = 0;
-int thread_running = 0;
-
-int  ring_buffer_size   =  RING_BUFFER_ALLOCATION;
-volatile long int ring_wr_index  =  0;
-volatile long int ring_rd_index  =  0;
-
-int ring_data_available() 
-{
-    long int n = 0;
-    int w_index = ring_wr_index;  // 
-    int r_index = ring_rd_index;  //
-    n = w_index - r_index;
-    if (n < 0) { n += ring_buffer_size; }
-    if (n < 0) { n = 0; }	                // error condition ?
-    if (n >= ring_buffer_size) { n = 0; }       // error condition
-    return(n);
-}
-
-int ring_write(uint8_t *from_ptr, int amount)
-{
-    int wrap = 0;
-    int w_index = ring_wr_index;  // my index
-    int r_index = ring_rd_index;  // other threads index
-    if (   (w_index < 0) 
-        || (w_index >= ring_buffer_size) ) { return(-1); }  // error !
-    if (decimateFlag > 1) {
-        int i;
-        if (sampleBits == 16) { 
-          for (i = 0; i < amount; i += 4) {
-            if (decimateCntr == 0) {
-	      ring_buffer_ptr[w_index  ] = from_ptr[i  ];
-	      ring_buffer_ptr[w_index+1] = from_ptr[i+1];
-	      ring_buffer_ptr[w_index+2] = from_ptr[i+2];
-	      ring_buffer_ptr[w_index+3] = from_ptr[i+3];
-              w_index += 4;
-              if (w_index >= ring_buffer_size) { w_index = 0; }
-	    }
-	    decimateCntr += 1;
-	    if (decimateCntr >= decimateFlag) { decimateCntr = 0; }
-	  }
-	} else {	// assume samplebits == 8
-          for (i = 0; i < amount; i += 2) {
-            if (decimateCntr == 0) {
-	      ring_buffer_ptr[w_index  ] = from_ptr[i  ];
-	      ring_buffer_ptr[w_index+1] = from_ptr[i+1];
-              w_index += 2;
-              if (w_index >= ring_buffer_size) { w_index = 0; }
-	    }
-	    decimateCntr += 1;
-	    if (decimateCntr >= decimateFlag) { decimateCntr = 0; }
-	  }
-	}
-    } else if (w_index + amount < ring_buffer_size) {
-        memcpy(&ring_buffer_ptr[w_index], from_ptr, amount);
-        w_index += amount;
-    } else {
-        int i;
-        for (i = 0; i < amount; i += 1) {
-            ring_buffer_ptr[w_index] = from_ptr[i];
-            w_index += 1;
-            if (w_index >= ring_buffer_size) { w_index = 0; }
-        }
-    }
-    // 
-    // insert memory barrier here
-    //
-    ring_wr_index = w_index;	 // update lock free input info
-// fprintf(stdout, "into ring %d\n", amount); // yyy yyy
-// fflush(stdout);
-    int m = ring_data_available();
-    if (m > ring_buffer_size/2) { wrap = 1; }
-    return(wrap);
-}
-        
-int ring_read(uint8_t *to_ptr, int amount, int always)
-{
-    int bytes_read = 0;
-    int r_index = ring_rd_index;  // my index
-    int w_index = ring_wr_index;  // other threads index
-    int available = w_index - r_index;
-    if (available < 0) { available += ring_buffer_size; }
-    if (always != 0) {
-        bzero(to_ptr, amount);
-    }
-    if (available <= 0) { return(bytes_read); }
-    int n = amount;
-    if (n > available) { n = available; }	// min(n, available)
-    if (r_index + n < ring_buffer_size) {
-        memcpy(to_ptr, &ring_buffer_ptr[r_index], n);
-        r_index += n;
-    } else {
-      int i;
-      for (i = 0; i < n; i += 1) {
-          to_ptr[i] = ring_buffer_ptr[r_index];
-          r_index += 1;
-          if (r_index >= ring_buffer_size) { r_index = 0; }
-      }
+
+int ring_frame_bytes()                  // bytes per IQ sample pair
+{
+    if (sampleBits == 16) { return(4); }
+    if (sampleBits == 12) { return(3); }
+    if (sampleBits == 32) { return(8); }
+    if (sampleBits == BFP_BITS) { return(BFP_FRAME); }
+    return(2);
+}
+
+int ring_frame_pairs()
+{
+    return((sampleBits == BFP_BITS) ? BFP_PAIRS : 1);
+}
+
+//  Each send thread sleeps until its ring holds sendBatchMin bytes,
+//    or sendLatencyMs has passed with something to send,
+//    then sends everything available (up to SEND_BATCH_MAX) in one call,
+//    straight from the ring.  A send that blocks until the writer has
+//    come round onto its bytes is caught after it returns, and counts
+//    as an overrun like any other lap.
+
+//  Zero-copy sends (Linux MSG_ZEROCOPY) : the kernel transmits from the
+//    ring pages themselves, so the reader's cursor stays behind every
+//    send until the error queue reports it complete.  Completions
+//    can arrive out of order; the cursor moves over the done prefix.
+//    In-flight bytes are capped well inside RING_GUARD, and the ring
+//    is held at the oldest send still out (ring_hold), so the writer
+//    never writes over pages the kernel hasn't sent.  The hold must
+//    not stop the writer for everyone else, so the sends don't block,
+//    a client more than half a ring behind has its sends copied, and
+//    one whose pages are still held when it would be lapped is reset,
+//    which purges its send queue.
+
+void client_overrun(client_t *c)
+{
+    fprintf(stderr, "client %d overrun, dropped %lld samples at sample %lld\n",
+            c->id, (long long)c->rd.last_drop, (long long)c->rd.drop_seq);
+}
+
+#ifdef HFP_ZEROCOPY
+void zc_reap(client_t *c)
+{
+    char            control[128];
+    struct msghdr   msg;
+    for (;;) {
+        bzero((char *)&msg, sizeof(msg));
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(c->sockfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            break;
+        }
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != NULL;
+             cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!(   (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+                  || (   cm->cmsg_level == SOL_IPV6
+                      && cm->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            struct sock_extended_err *e
+                = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (e->ee_origin != SO_EE_ORIGIN_ZEROCOPY || e->ee_errno != 0) {
+                continue;
+            }
+            uint32_t lo = e->ee_info, hi = e->ee_data;
+            if (e->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                c->zc_copied += (uint32_t)(hi - lo) + 1;
+            }
+            for (int i=0; i<c->zc_count; i++) {
+                zcSend *z = &c->zc[(c->zc_head + i) % ZC_MAX_PENDING];
+                if ((uint32_t)(z->id - lo) <= (uint32_t)(hi - lo)) {
+                    z->done = 1;
+                }
+            }
+        }
+    }
+    long long r_pos = atomic_load_explicit(&c->rd.rd_pos, memory_order_relaxed);
+    while (c->zc_count > 0 && c->zc[c->zc_head].done) {
+        zcSend *z = &c->zc[c->zc_head];
+        if (z->end > r_pos) {
+            ring_consume(&c->rd, (long)(z->end - r_pos));
+            r_pos = z->end;
+        }
+        c->zc_head   = (c->zc_head + 1) % ZC_MAX_PENDING;
+        c->zc_count -= 1;
+    }
+    ring_hold(&c->rd, (c->zc_count > 0) ? c->zc[c->zc_head].start : -1);
+}
+
+//  one batch, returns bytes sent, 0 if nothing was sent, or -1
+
+long zc_send_batch(client_t *c, long *pad)
+{
+    zc_reap(c);
+    ring_t    *r     = c->rd.ring;
+    long long w_pos  = atomic_load_explicit(&r->wr_pos, memory_order_acquire);
+    long long r_pos  = atomic_load_explicit(&c->rd.rd_pos,
+                                            memory_order_relaxed);
+    if (c->zc_count > 0
+        && w_pos - c->zc[c->zc_head].start > r->size - RING_GUARD) {
+        struct linger lg = { 1, 0 };    // close() resets, dropping the queue
+        setsockopt(c->sockfd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+        fprintf(stderr, "client %d stopped taking data with zero-copy "
+                "sends out, resetting it\n", c->id);
+        return(-1);
+    }
+    int  copy     = (w_pos - r_pos > r->size / 2);
+    long inflight = (long)(c->zc_pos - r_pos);
+    if (c->zc_count == ZC_MAX_PENDING || inflight >= ZC_MAX_INFLIGHT) {
+        struct pollfd pfd = { c->sockfd, 0, 0 };    // POLLERR : completions
+        poll(&pfd, 1, c->wait_ms);
+        return(0);
+    }
+    long avail = ring_wait(&c->rd, inflight + c->batch_min + *pad,
+                           c->wait_ms, &c->stop_send_thread) - inflight;
+    if (avail <= *pad) { return(0); }
+    if (*pad > 0 && avail < c->batch_min + *pad) { return(0); }
+    *pad = 0;
+    uint8_t *ptr = NULL;
+    long long lapped = c->rd.lapped;
+    long sz = ring_view_at(&c->rd, inflight, &ptr, SEND_BATCH_MAX);
+    if (c->rd.lapped != lapped) {       // in flight still, but skipped
+        c->zc_pos   = atomic_load_explicit(&c->rd.rd_pos,
+                                           memory_order_relaxed);
+    }
+    if (sz <= 0) { return(0); }
+    if (c->zc_count == 0 && !copy) { ring_hold(&c->rd, c->zc_pos); }
+    uint32_t id     = 0;
+    int      copied = copy;
+    long long t0    = mono_ns();
+    long k = send(c->sockfd, ptr, sz,
+                  MSG_NOSIGNAL | MSG_DONTWAIT | (copy ? 0 : MSG_ZEROCOPY));
+    if (k >= 0) {
+        if (!copy) { id = c->zc_next++; }   // counted even for partial sends
+    } else if (errno == ENOBUFS) {      // out of optmem, copy this one
+        k = send(c->sockfd, ptr, sz, MSG_NOSIGNAL | MSG_DONTWAIT);
+        copied = 1;
+    }
+    if (mono_ns() - t0 > 1000000LL * sendLatencyMs) {
+        atomic_fetch_add_explicit(&c->stalls, 1, memory_order_relaxed);
+    }
+    if (k < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        struct pollfd pfd = { c->sockfd, POLLOUT, 0 };
+        poll(&pfd, 1, c->wait_ms);      // room, or a completion (POLLERR)
+        return(0);
+    }
+    if (k <= 0) { return(-1); }
+    zcSend *z = &c->zc[(c->zc_head + c->zc_count) % ZC_MAX_PENDING];
+    z->id     = id;
+    z->done   = copied;
+    z->start  = c->zc_pos;
+    z->end    = c->zc_pos + k;
+    c->zc_pos = z->end;
+    c->zc_count += 1;
+    return(k);
+}
+#endif
+
+//  -T : a client's queue is kept under latencyTargetMs of samples, at
+//    its own rate and format.  Batches shrink to a quarter of that, and
+//    when more is waiting the reader skips ahead, leaving half.  After
+//    a retune it skips whatever was queued before it (flush_pos).
+//    Skips start and end on frame boundaries, so happen only while
+//    the cursor is on one, and never over zero-copy bytes in flight.
+
+void client_bound_latency(client_t *c)
+{
+    ring_reader_t *rd = &c->rd;
+    ring_t        *r  = rd->ring;
+    long  rate  = (c->chan != NULL) ? c->chan->rate : c->rx->chan0.rate;
+    long  bytes = (long)(1e-3 * latencyTargetMs * rate / r->frame_pairs)
+                  * r->frame;
+    if (bytes < 4 * r->frame) { bytes = 4 * r->frame; }
+    c->batch_min = (bytes / 4 < sendBatchMin) ? bytes / 4 : sendBatchMin;
+    c->wait_ms   = (latencyTargetMs / 4 < sendLatencyMs)
+                   ? latencyTargetMs / 4 : sendLatencyMs;
+    if (c->wait_ms < 1) { c->wait_ms = 1; }
+    if (bytes != c->sndbuf) {           // and the kernel's queue with it
+        int sb = (bytes < 16384) ? 16384 : (int)bytes;
+        setsockopt(c->sockfd, SOL_SOCKET, SO_SNDBUF, &sb, sizeof(sb));
+        c->sndbuf = bytes;
+    }
+
+#ifdef HFP_ZEROCOPY
+    if (c->zerocopy) {
+        zc_reap(c);
+        if (c->zc_count > 0) { return; }
+    }
+#endif
+    long long r_pos = atomic_load_explicit(&rd->rd_pos, memory_order_relaxed);
+    long long w_pos = atomic_load_explicit(&r->wr_pos, memory_order_acquire);
+    if ((r_pos % r->frame) != 0) { return; }
+    long long f = atomic_exchange(&c->flush_pos, 0);
+    if (f > r_pos) {
+        if (f > w_pos) { f = w_pos; }
+        f -= (f - r_pos) % r->frame;
+        atomic_fetch_add_explicit(&c->flushed, ring_skip_to(rd, f),
+                                  memory_order_relaxed);
+        r_pos = f;
+    }
+    if (w_pos - r_pos > bytes) {
+        long long to = w_pos - bytes / 2;
+        to -= (to - r_pos) % r->frame;
+        atomic_fetch_add_explicit(&c->trimmed, ring_skip_to(rd, to),
+                                  memory_order_relaxed);
+    }
+#ifdef HFP_ZEROCOPY
+    if (c->zerocopy) {
+        c->zc_pos = atomic_load_explicit(&rd->rd_pos, memory_order_relaxed);
     }
-    bytes_read = n;
-// fprintf(stderr, "out of ring %d\n", n); // yyy yyy
-// fflush(stderr);
-    ring_rd_index = r_index;  	 // update lock free extract info
-    return(bytes_read);
+#endif
+}
+
+//  after a retune, -T clients skip what the old settings produced
+
+void client_flush(receiver_t *rx, client_t *c)
+{
+    if (latencyTargetMs <= 0) { return; }
+    if (c != NULL) {
+        atomic_store(&c->flush_pos, c->chan->retune_pos);
+        return;
+    }
+    for (int i=0; i<MAX_CLIENTS; i++) {     // everyone on the hardware
+        client_t *o = &rx->clients[i];
+        if (o->in_use && o->chan == NULL) {
+            atomic_store(&o->flush_pos, rx->chan0.retune_pos);
+        }
+    }
+}
+
+//  Compressed sends (CMD_COMPRESS) : each batch becomes one HFPZ frame
+//    (see hfp_codec.h), encoded here on the client's send thread,
+//    and is sent whole.  Returns bytes sent, 0 or -1.
+
+long codec_send_batch(client_t *c, long *pad)
+{
+    int  frame = c->rd.ring->frame;
+    long avail = ring_wait(&c->rd, c->batch_min + *pad, c->wait_ms,
+                           &c->stop_send_thread);
+    if (avail <= *pad) { return(0); }
+    if (*pad > 0 && avail < c->batch_min + *pad) { return(0); }
+    *pad = 0;
+    uint8_t *ptr = NULL;
+    uint8_t split[8];
+    long sz = ring_view(&c->rd, &ptr, (long)CODEC_MAX_PAIRS * frame);
+    int  pairs = (int)(sz / frame);
+    if (sz > 0 && pairs == 0) {     // a pair cut by the wrap, unmirrored ring
+        memcpy(split, ptr, sz);
+        ring_consume(&c->rd, sz);
+        if (ring_view(&c->rd, &ptr, frame - sz) < frame - sz) { return(0); }
+        memcpy(split + sz, ptr, frame - sz);
+        ring_consume(&c->rd, frame - sz);
+        ptr   = split;
+        sz    = 0;
+        pairs = 1;
+    }
+    if (pairs == 0) { return(0); }
+    long long t0 = mono_ns();
+    long zsz = codec_encode(c->codec, ptr, pairs, sampleBits, c->zbuf);
+    long long dt = mono_ns() - t0;
+    if (sz > 0) { ring_consume(&c->rd, (long)pairs * frame); }
+    atomic_fetch_add_explicit(&c->z_frames, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&c->z_raw, (long long)pairs * frame,
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&c->z_bytes, zsz, memory_order_relaxed);
+    atomic_fetch_add_explicit(&c->z_ns, dt, memory_order_relaxed);
+    if (dt > atomic_load_explicit(&c->z_max_ns, memory_order_relaxed)) {
+        atomic_store_explicit(&c->z_max_ns, dt, memory_order_relaxed);
+    }
+    long done = 0;
+    t0 = mono_ns();
+    while (done < zsz) {            // frames can't be cut short
+#ifdef __APPLE__
+        long k = send(c->sockfd, c->zbuf + done, zsz - done, 0);
+#else
+        long k = send(c->sockfd, c->zbuf + done, zsz - done, MSG_NOSIGNAL);
+#endif
+        if (k <= 0) { return(-1); }
+        done += k;
+    }
+    if (mono_ns() - t0 > 1000000LL * sendLatencyMs) {
+        atomic_fetch_add_explicit(&c->stalls, 1, memory_order_relaxed);
+    }
+    return(done);
 }
 
-float tmpFPBuf[4*32768];
-uint8_t tmpBuf[4*32768];
+//  switches a client to HFPZ frames at the next batch, once any
+//    zero-copy sends still in flight have completed
 
-void send_delay(int n, int rate)
+int codec_switch(client_t *c)
 {
-    int n1 = n;					// n in bytes
-    if (sampleBits == 16) { n1 = n / 2; }	// convert to samples
-    if (sampleBits == 32) { n1 = n / 4; }	// convert to samples
-    double dt = 0.10 * (double)n1 / rate; // fraction of a second
-    unsigned int dt_uS = floor(1.0e6 * dt);	// 10X too fast
-    usleep(dt_uS);
+#ifdef HFP_ZEROCOPY
+    if (c->zerocopy) {
+        zc_reap(c);
+        if (c->zc_count > 0) {
+            struct pollfd pfd = { c->sockfd, 0, 0 };
+            poll(&pfd, 1, sendLatencyMs);
+            return(0);
+        }
+        c->zerocopy = 0;
+    }
+#endif
+    c->codec = (codec_t *)malloc(sizeof(codec_t));
+    c->zbuf  = (uint8_t *)malloc(codec_max_bytes(CODEC_MAX_PAIRS));
+    if (c->codec == NULL || c->zbuf == NULL) {
+        printf("client %d: no memory for compression\n", c->id);
+        c->compress = 0;
+        return(-1);
+    }
+    printf("client %d: sending compressed frames\n", c->id);
+    return(1);
 }
 
 void *tcp_send_handler(void *param)
 {
-    int sz0   =     1408;                      // MTU size ? 
-    int pad   =    32768 * 2;
-    printf("send thread %d running 2 \n", thread_counter);
-    while (stop_send_thread == 0) {
-	if (gClientSocketID  <  0) { break; }
-        if (ring_data_available() >= (sz0 + pad)) {
-            int sz = ring_read(tmpBuf, sz0, 0);
-	    if (sz > 0) {
-                int k = 0;
-		int send_sockfd = gClientSocketID ;
+    client_t *c = (client_t *)param;
+    long  pad   =    32768 * 2;                 // initial pre-buffer
+    long long lapped = 0;
+    printf("send thread %d running 2 \n", c->id);
+    c->batch_min = sendBatchMin;
+    c->wait_ms   = sendLatencyMs;
+    if (latencyTargetMs > 0) { pad = 0; }
+#ifdef HFP_ZEROCOPY
+    if (zeroCopy) {
+        int one = 1;
+        if (setsockopt(c->sockfd, SOL_SOCKET, SO_ZEROCOPY,
+                       &one, sizeof(one)) == 0) {
+            c->zerocopy = 1;
+            c->zc_pos   = atomic_load(&c->rd.rd_pos);
+        } else {
+            printf("client %d: zero-copy unavailable, copying\n", c->id);
+        }
+    }
+#endif
+    while (c->stop_send_thread == 0) {
+	if (c->sockfd  <  0) { break; }
+        if (c->compress && c->zbuf == NULL && codec_switch(c) <= 0) {
+            continue;
+        }
+        if (latencyTargetMs > 0) {
+            client_bound_latency(c);
+        }
+        if (c->zbuf != NULL) {
+            long k = codec_send_batch(c, &pad);
+            if (c->rd.lapped != lapped) {
+                lapped = c->rd.lapped;
+                client_overrun(c);
+            }
+            if (k < 0) {
+                c->sendErrorFlag = -1;
+                shutdown(c->sockfd, SHUT_RD);   // wake the recv loop
+                break;
+            }
+            if (k > 0) {
+                atomic_fetch_add_explicit(&c->bytes_sent, k,
+                                          memory_order_relaxed);
+                atomic_fetch_add_explicit(&c->sends, 1, memory_order_relaxed);
+            }
+            continue;
+        }
+#ifdef HFP_ZEROCOPY
+        if (c->zerocopy) {
+            long k = zc_send_batch(c, &pad);
+            if (c->rd.lapped != lapped) {
+                lapped = c->rd.lapped;
+                client_overrun(c);
+            }
+            if (k < 0) {
+                c->sendErrorFlag = -1;
+                shutdown(c->sockfd, SHUT_RD);   // wake the recv loop
+                break;
+            }
+            if (k > 0) {
+                atomic_fetch_add_explicit(&c->bytes_sent, k,
+                                          memory_order_relaxed);
+                atomic_fetch_add_explicit(&c->sends, 1, memory_order_relaxed);
+            }
+            continue;
+        }
+#endif
+        long avail = ring_wait(&c->rd, c->batch_min + pad, c->wait_ms,
+                               &c->stop_send_thread);
+        if (avail <= pad) { continue; }
+        if (pad > 0 && avail < c->batch_min + pad) { continue; }
+        uint8_t *ptr = NULL;
+        long sz = ring_view(&c->rd, &ptr, SEND_BATCH_MAX);
+        if (c->rd.lapped != lapped) {
+            lapped = c->rd.lapped;
+            client_overrun(c);
+        }
+	if (sz > 0) {
+            long k = 0;
+	    int send_sockfd = c->sockfd ;
+            long long t0 = mono_ns();
 #ifdef __APPLE__
-                k = send(send_sockfd, tmpBuf, sz, 0);
+            k = send(send_sockfd, ptr, sz, 0);
 #else
-                k = send(send_sockfd, tmpBuf, sz, MSG_NOSIGNAL);
+            k = send(send_sockfd, ptr, sz, MSG_NOSIGNAL);
 #endif
-                if (k <= 0) { sendErrorFlag = -1; }
-// fprintf(stderr, "sent %d\n", k); // yyy yyy
-// fflush(stderr);
-                totalSamples   +=  sz;
-                sendblockcount +=  1;
-	    }
-	    pad = 0;
-	} else {
-// fprintf(stdout, "send blocked \n" ); // yyy yyy
-// fflush(stdout);
-	        // send_delay(sz0, sampRate);
-		usleep(1);
+            if (mono_ns() - t0 > 1000000LL * sendLatencyMs) {
+                atomic_fetch_add_explicit(&c->stalls, 1, memory_order_relaxed);
+            }
+            if (k <= 0) {
+                c->sendErrorFlag = -1;
+                shutdown(send_sockfd, SHUT_RD);  // wake the recv loop
+                break;
+            }
+            if (ring_release(&c->rd, k)) {  // lapped during the send
+                lapped = c->rd.lapped;
+                client_overrun(c);
+            }
+            atomic_fetch_add_explicit(&c->bytes_sent, k, memory_order_relaxed);
+            atomic_fetch_add_explicit(&c->sends, 1, memory_order_relaxed);
 	}
+	pad = 0;
     }
-    pthread_exit(NULL);
-    fprintf(stderr, "tcp send thread %d stopped\n", thread_counter);
+    free(c->codec);
+    free(c->zbuf);
+    c->codec = NULL;
+    c->zbuf  = NULL;
+    fprintf(stderr, "tcp send thread %d stopped\n", c->id);
     fflush(stderr);
-    threads_running -= 1;
-    stop_send_thread = 0;
     return(NULL);
 }
 
-void *connection_handler()
+//  The device streams while at least one client is connected.
+//  Called with rx's device_lock held.
+
+int device_start(receiver_t *rx)
+{
+    int m = device_streaming(rx);
+    if (m > 0) { return(0); }
+    if (playPath != NULL) {
+        m = player_start(&player, &play_rcv_callback, rx);
+        printf("playback start status = %d\n", m);
+        return(m);
+    }
+    rx->usb_pinned = 0;                 // a new transfer thread
+    m = airspyhf_start(rx->device, &usb_rcv_callback, rx);
+    printf("hf+ start status = %d\n", m);
+    return(m);
+}
+
+void device_stop(receiver_t *rx)
 {
-    char buffer[256];
+    int m = device_streaming(rx);
+    printf("hf+ is running = %d\n", m);
+    if (m) {
+	fprintf(stdout,"stopping now 00 \n");
+        if (playPath != NULL) {
+            player_stop(&player);
+        } else {
+            m = airspyhf_stop(rx->device);
+            printf("hf+ stop status = %d\n", m);
+        }
+    }
+    pipeline_stats(rx);
+}
+
+//  Nobody left to stream for : no clients, spectrum viewers or -U.
+//  Called with rx's device_lock and clients_lock held.
+
+int device_idle(receiver_t *rx)
+{
+    return(rx->numClients == 0 && atomic_load(&rx->spectrum.nviewers) == 0
+           && !rx->udpOut.on);
+}
+
+//  Spectrum viewers keep the device streaming too
+
+void spectrum_watch(void *ctx, int viewers)
+{
+    receiver_t *rx = (receiver_t *)ctx;
+    pthread_mutex_lock(&rx->device_lock);
+    pthread_mutex_lock(&rx->clients_lock);
+    if (viewers > 0) {
+        if (device_start(rx) < 0) { exit(-1); }
+    } else if (device_idle(rx)) {
+        device_stop(rx);
+    }
+    pthread_mutex_unlock(&rx->clients_lock);
+    pthread_mutex_unlock(&rx->device_lock);
+}
+
+int device_streaming(receiver_t *rx)
+{
+    if (playPath != NULL) { return(player_is_streaming(&player)); }
+    return(airspyhf_is_streaming(rx->device));
+}
+
+void pipeline_stats(receiver_t *rx)
+{
+    long long calls = atomic_load(&rx->cbCalls);
+    if (calls == 0) { return; }
+    printf("hf+ %d: usb callbacks %lld, mean %.1f us, max %.1f us\n",
+           rx->id, calls,
+           1e-3 * (double)atomic_load(&rx->cbNanos) / (double)calls,
+           1e-3 * (double)atomic_load(&rx->cbMaxNanos));
+    printf("hf+ %d: block pool high water %d of %d, %lld blocks dropped\n",
+           rx->id, atomic_load(&rx->blockPool.high), rx->blockPool.blocks,
+           (long long)atomic_load(&rx->blockPool.dropped));
+}
+
+//  Prometheus text snapshot, for the -M endpoint.  Every counter has a
+//    single writing thread, so this only does relaxed atomic loads.
+//    With several HF+ each series is labelled with its device number.
+
+#define METRIC(name, type, help)                                        \
+    len = metrics_printf(buf, size, len,                                \
+                         "# HELP " name " " help "\n# TYPE " name " " type "\n")
+
+#define SERIES(...)                                                     \
+    for (int d=0; d<numReceivers; d++) {                                \
+        receiver_t *rx = &receivers[d];                                 \
+        len = metrics_printf(buf, size, len, __VA_ARGS__);              \
+    }
+
+long metrics_format_server(char *buf, long size)
+{
+    long len = 0;
+    METRIC("hfp_usb_blocks_total", "counter", "usb transfers received");
+    SERIES("hfp_usb_blocks_total%s %lld\n", rx->label,
+           (long long)atomic_load(&rx->cbCalls));
+    METRIC("hfp_usb_callback_seconds_total", "counter",
+           "time spent in the usb callback");
+    SERIES("hfp_usb_callback_seconds_total%s %.6f\n", rx->label,
+           1e-9 * (double)atomic_load(&rx->cbNanos));
+    METRIC("hfp_usb_callback_max_seconds", "gauge",
+           "longest usb callback");
+    SERIES("hfp_usb_callback_max_seconds%s %.6f\n", rx->label,
+           1e-9 * (double)atomic_load(&rx->cbMaxNanos));
+    METRIC("hfp_pool_dropped_blocks_total", "counter",
+           "usb blocks dropped with the dsp pool full");
+    SERIES("hfp_pool_dropped_blocks_total%s %lld\n", rx->label,
+           (long long)atomic_load(&rx->blockPool.dropped));
+    METRIC("hfp_pool_high_water_blocks", "gauge", "most usb blocks queued");
+    SERIES("hfp_pool_high_water_blocks%s %d\n", rx->label,
+           atomic_load(&rx->blockPool.high));
+    METRIC("hfp_samples_total", "counter", "IQ samples processed");
+    SERIES("hfp_samples_total%s %lld\n", rx->label,
+           (long long)atomic_load(&rx->totalSamples));
+    METRIC("hfp_sample_peak", "gauge", "largest and smallest IQ value "
+           "in the last usb block, full scale 1.0");
+    SERIES("hfp_sample_peak{%sedge=\"max\"} %.6f\n"
+           "hfp_sample_peak{%sedge=\"min\"} %.6f\n",
+           rx->label_in, (double)atomic_load(&rx->sMax),
+           rx->label_in, (double)atomic_load(&rx->sMin));
+    METRIC("hfp_retunes_total", "counter", "client retune commands");
+    SERIES("hfp_retunes_total{%skind=\"frequency\"} %lld\n"
+           "hfp_retunes_total{%skind=\"rate\"} %lld\n",
+           rx->label_in, (long long)atomic_load(&rx->freqRetunes),
+           rx->label_in, (long long)atomic_load(&rx->rateRetunes));
+    METRIC("hfp_retunes_nco_total", "counter",
+           "frequency changes the NCO made with the hardware parked (-N)");
+    SERIES("hfp_retunes_nco_total%s %lld\n", rx->label,
+           (long long)atomic_load(&rx->ncoRetunes));
+    METRIC("hfp_retunes_coalesced_total", "counter",
+           "retune commands superseded by a later one in the same burst");
+    SERIES("hfp_retunes_coalesced_total%s %lld\n", rx->label,
+           (long long)atomic_load(&rx->cmdCoalesced));
+    long long rdrop[MAX_DEVICES], rblock[MAX_DEVICES], rblock_ns[MAX_DEVICES];
+    for (int d=0; d<numReceivers; d++) {
+        receiver_t *rx = &receivers[d];
+        rdrop[d] = rblock[d] = rblock_ns[d] = 0;
+        for (int i=-1; i<MAX_CLIENTS; i++) {
+            ring_t *r = (i < 0) ? &rx->chan0.ring : &rx->channels[i].ring;
+            if (r->buf == NULL) { continue; }
+            rdrop[d]     += atomic_load(&r->dropped);
+            rblock[d]    += atomic_load(&r->blocked);
+            rblock_ns[d] += atomic_load(&r->blocked_ns);
+        }
+    }
+    METRIC("hfp_ring_dropped_samples_total", "counter",
+           "newest samples discarded by the writer, -O newest");
+    SERIES("hfp_ring_dropped_samples_total%s %lld\n", rx->label, rdrop[d]);
+    METRIC("hfp_ring_writer_blocked_total", "counter",
+           "times the writer waited for a reader, -O block");
+    SERIES("hfp_ring_writer_blocked_total%s %lld\n", rx->label, rblock[d]);
+    METRIC("hfp_ring_writer_blocked_seconds_total", "counter",
+           "time the writer waited for readers");
+    SERIES("hfp_ring_writer_blocked_seconds_total%s %.6f\n", rx->label,
+           1e-9 * (double)rblock_ns[d]);
+    METRIC("hfp_playback_loops_total", "counter",
+           "times through the -P file");
+    len = metrics_printf(buf, size, len, "hfp_playback_loops_total %lld\n",
+                         (long long)atomic_load(&player.loops));
+    METRIC("hfp_playback_late_total", "counter",
+           "playback blocks that fell behind the -Ps pace");
+    len = metrics_printf(buf, size, len, "hfp_playback_late_total %lld\n",
+                         (long long)atomic_load(&player.late));
+    METRIC("hfp_recorder_bytes_total", "counter", "bytes recorded to disk");
+    SERIES("hfp_recorder_bytes_total%s %lld\n", rx->label,
+           (long long)atomic_load(&rx->recorder.bytes_written));
+    METRIC("hfp_recorder_files_total", "counter", "recording files started");
+    SERIES("hfp_recorder_files_total%s %lld\n", rx->label,
+           (long long)atomic_load(&rx->recorder.files));
+    METRIC("hfp_recorder_dropped_samples_total", "counter",
+           "samples the recorder lost behind a slow disk");
+    SERIES("hfp_recorder_dropped_samples_total%s %lld\n", rx->label,
+           (long long)atomic_load(&rx->recorder.dropped));
+    METRIC("hfp_recorder_write_seconds_total", "counter",
+           "time spent in recorder writes");
+    SERIES("hfp_recorder_write_seconds_total%s %.6f\n", rx->label,
+           1e-9 * (double)atomic_load(&rx->recorder.write_ns));
+    METRIC("hfp_recorder_write_max_seconds", "gauge",
+           "slowest recorder write, one buffer");
+    SERIES("hfp_recorder_write_max_seconds%s %.6f\n", rx->label,
+           1e-9 * (double)atomic_load(&rx->recorder.max_write_ns));
+    METRIC("hfp_spectrum_viewers", "gauge", "spectrum stream viewers");
+    SERIES("hfp_spectrum_viewers%s %d\n", rx->label,
+           atomic_load(&rx->spectrum.nviewers));
+    METRIC("hfp_spectrum_frames_total", "counter",
+           "spectrum frames sent, once for all viewers");
+    SERIES("hfp_spectrum_frames_total%s %lld\n", rx->label,
+           (long long)atomic_load(&rx->spectrum.frames));
+    METRIC("hfp_spectrum_ffts_total", "counter", "spectrum FFTs computed");
+    SERIES("hfp_spectrum_ffts_total%s %lld\n", rx->label,
+           (long long)atomic_load(&rx->spectrum.ffts));
+    METRIC("hfp_spectrum_fft_seconds_total", "counter",
+           "time spent windowing, in FFTs and summing power");
+    SERIES("hfp_spectrum_fft_seconds_total%s %.6f\n", rx->label,
+           1e-9 * (double)atomic_load(&rx->spectrum.fft_ns));
+    METRIC("hfp_spectrum_viewers_dropped_total", "counter",
+           "spectrum viewers gone, or a second behind");
+    SERIES("hfp_spectrum_viewers_dropped_total%s %lld\n", rx->label,
+           (long long)atomic_load(&rx->spectrum.dropped_viewers));
+    METRIC("hfp_udp_datagrams_total", "counter", "-U datagrams sent");
+    SERIES("hfp_udp_datagrams_total%s %lld\n", rx->label,
+           (long long)atomic_load(&rx->udpOut.datagrams));
+    METRIC("hfp_udp_bytes_total", "counter", "-U bytes sent, headers included");
+    SERIES("hfp_udp_bytes_total%s %lld\n", rx->label,
+           (long long)atomic_load(&rx->udpOut.bytes));
+    METRIC("hfp_udp_send_calls_total", "counter",
+           "-U sendmmsg or sendmsg calls");
+    SERIES("hfp_udp_send_calls_total%s %lld\n", rx->label,
+           (long long)atomic_load(&rx->udpOut.calls));
+    METRIC("hfp_udp_send_errors_total", "counter",
+           "-U batches the network refused, not retried");
+    SERIES("hfp_udp_send_errors_total%s %lld\n", rx->label,
+           (long long)atomic_load(&rx->udpOut.errors));
+    METRIC("hfp_udp_dropped_samples_total", "counter",
+           "samples skipped when the -U sender fell behind");
+    SERIES("hfp_udp_dropped_samples_total%s %lld\n", rx->label,
+           (long long)atomic_load(&rx->udpOut.dropped));
+    METRIC("hfp_clients", "gauge", "connected clients");
+    SERIES("hfp_clients%s %d\n", rx->label, rx->numClients);
+    METRIC("hfp_ring_size_bytes", "gauge", "sample ring size");
+    SERIES("hfp_ring_size_bytes%s %ld\n", rx->label,
+           channelMode ? CHANNEL_RING_ALLOCATION : rx->chan0.ring.size);
+
+    static const char *per_client[][3] = {
+        { "hfp_client_bytes_sent_total",   "counter", "bytes sent"         },
+        { "hfp_client_sends_total",        "counter", "send calls"         },
+        { "hfp_client_send_stalls_total",  "counter",
+                                    "sends that blocked longer than -L"    },
+        { "hfp_client_overruns_total",     "counter",
+                                    "times the ring writer lapped the client" },
+        { "hfp_client_dropped_samples_total", "counter",
+                                    "samples skipped past when lapped"     },
+        { "hfp_client_ring_high_water_bytes", "gauge",
+                                    "most bytes waiting for the client"    },
+        { "hfp_client_compressed_frames_total", "counter",
+                                    "HFPZ frames sent"                     },
+        { "hfp_client_compress_in_bytes_total", "counter",
+                                    "sample bytes compressed"              },
+        { "hfp_client_compress_out_bytes_total", "counter",
+                                    "HFPZ bytes they became"               },
+        { "hfp_client_trimmed_samples_total", "counter",
+                                    "samples skipped to stay under -T"     },
+        { "hfp_client_flushed_samples_total", "counter",
+                                    "stale samples skipped after retunes"  },
+    };
+    for (int k=0; k<11; k++) {
+        len = metrics_printf(buf, size, len, "# HELP %s %s\n# TYPE %s %s\n",
+                             per_client[k][0], per_client[k][2],
+                             per_client[k][0], per_client[k][1]);
+        for (int d=0; d<numReceivers; d++) {
+            receiver_t *rx = &receivers[d];
+            for (int i=0; i<MAX_CLIENTS; i++) {
+                client_t *c = &rx->clients[i];
+                if (!c->in_use) { continue; }
+                long long v = 0;
+                switch (k) {
+                    case 0: v = atomic_load(&c->bytes_sent);    break;
+                    case 1: v = atomic_load(&c->sends);         break;
+                    case 2: v = atomic_load(&c->stalls);        break;
+                    case 3: v = atomic_load(&c->rd.lapped);     break;
+                    case 4: v = atomic_load(&c->rd.dropped);    break;
+                    case 5: v = atomic_load(&c->rd.high);       break;
+                    case 6: v = atomic_load(&c->z_frames);      break;
+                    case 7: v = atomic_load(&c->z_raw);         break;
+                    case 8: v = atomic_load(&c->z_bytes);       break;
+                    case 9: v = atomic_load(&c->trimmed);       break;
+                    case 10: v = atomic_load(&c->flushed);      break;
+                }
+                len = metrics_printf(buf, size, len,
+                                     "%s{%sclient=\"%d\"} %lld\n",
+                                     per_client[k][0], rx->label_in, i, v);
+            }
+        }
+    }
+    METRIC("hfp_client_encode_seconds_total", "counter",
+           "time spent compressing");
+    for (int d=0; d<numReceivers; d++) {
+        receiver_t *rx = &receivers[d];
+        for (int i=0; i<MAX_CLIENTS; i++) {
+            client_t *c = &rx->clients[i];
+            if (!c->in_use) { continue; }
+            len = metrics_printf(buf, size, len,
+                                 "hfp_client_encode_seconds_total"
+                                 "{%sclient=\"%d\"} %.6f\n", rx->label_in, i,
+                                 1e-9 * (double)atomic_load(&c->z_ns));
+        }
+    }
+    return(len);
+}
+
+void *connection_handler(void *param)
+{
+    client_t   *c  = (client_t *)param;
+    receiver_t *rx = c->rx;
+    uint8_t buffer[1024];
     int n = 0;
     int m = 0;
 
     if (do_exit != 0) { return(NULL); }
 
-    m = airspyhf_is_streaming(device);
-    if (m > 0) {    // stop before restarting
-        printf("hf+ already running = %d\n", m);
-        fprintf(stdout,"stopping now 00 \n");
-        m = airspyhf_stop(device);
-        printf("hf+ stop status = %d\n", m);
-        usleep(250L * 1000L);
-    }
-
     if (1) {        // 16 or 12-byte rtl_tcp header
         int sz = 16;
         if (sampleBits == 8) { sz = 12; }
         // HFP0 16
         char header[16] = { 0x48,0x46,0x50,0x30, 
-	    0x30,0x30,0x30+numSampleRates,0x30+sampleBits,
+	    0x30,0x30,0x30+rx->numSampleRates,0x30+sampleBits,
             0,0,0,1, 0,0,0,2 };
 #ifdef __APPLE__
-        n = send(gClientSocketID, header, sz, 0);
+        n = send(c->sockfd, header, sz, 0);
 #else
-        n = send(gClientSocketID, header, sz, MSG_NOSIGNAL);
+        n = send(c->sockfd, header, sz, MSG_NOSIGNAL);
 #endif
         fprintf(stdout, "header sent %d\n", n); // yyy yyy
         fflush(stdout);
     }
 
-    sendErrorFlag       =  0;
-    stop_send_thread    =  0;
-    ring_wr_index       =  0;
-    ring_rd_index       =  0;
-    pthread_t tcp_send_thread;
-    long int *param = (long int *)malloc(4 * sizeof(long int));
-    param[0]            =  0;
-    if ( pthread_create( &tcp_send_thread, NULL ,
+    c->sendErrorFlag    =  0;
+    c->stop_send_thread =  0;
+    c->chan             =  NULL;
+    ring_reader_attach(&c->rd, &rx->chan0.ring);
+    if (channelMode) {
+        if (channel_open(c) < 0) {
+            printf("could not allocate channel for client %d\n", c->id);
+            n = 0;
+        }
+    }
+    thread_counter     +=  1;
+    if ( pthread_create( &c->send_thread, NULL ,
                              tcp_send_handler,
-                             (void *)param) < 0) {
+                             (void *)c) != 0) {
             printf("could not create tcp send thread");
-            return(NULL);
+            c->send_thread = 0;
+            n = 0;
     } else {
             printf("send thread started 1 \n");
     }
 
-    acc_r         =  0.0;
-    totalSamples  =  0;
-    m = airspyhf_start(device, &usb_rcv_callback, &context);
-    printf("hf+ start status = %d\n", m);
+    pthread_mutex_lock(&rx->device_lock);
+    m = device_start(rx);
+    pthread_mutex_unlock(&rx->device_lock);
     if (m < 0) { exit(-1); }
     usleep(250L * 1000L);
 
@@ -508,446 +1711,649 @@ void *connection_handler()
     struct timeval timeout;
     timeout.tv_sec = SOCKET_READ_TIMEOUT_SEC;
     timeout.tv_usec = 0;
-    setsockopt( gClientSocketID, SOL_SOCKET, SO_RCVTIMEO,
+    setsockopt( c->sockfd, SOL_SOCKET, SO_RCVTIMEO,
                &timeout, sizeof(timeout) );
 
-    n = 1;
-    while ((n > 0) && (sendErrorFlag == 0)) {
-        int i, j, m;
-        // receive 5 byte commands (or a multiple thereof)
-        memset(buffer,0, 256);
-        n = recv(gClientSocketID, buffer, 255, 0);
-        if ((n <= 0) || (sendErrorFlag != 0)) {
-            if (airspyhf_is_streaming(device)) {
-                fprintf(stdout,"stopping now 00 \n");
-                m = airspyhf_stop(device);
-            }
-            close(gClientSocketID);
-            gClientSocketID = -1;
-            fprintf(stdout, "hf+ stop status = %d\n", m);
-            fflush(stdout);
+    if (c->send_thread != 0 && n > 0) { n = 1; }
+    while ((n > 0) && (c->sendErrorFlag == 0)) {
+        cmdBurst burst;
+        int      k;
+        n = recv(c->sockfd, buffer, sizeof(buffer), 0);
+        if ((n <= 0) || (c->sendErrorFlag != 0)) {
             break;
         }
-        if (n > 0) {
-            int msg1 = buffer[0];
-            if (msg1 != 4) {
-                for (i=0; i < n; i++) {
-                    fprintf(stdout, "%02x ", (0x00ff & buffer[i]));
-                }
-                if (n > 0) { fprintf(stdout, "\n"); }
-            }
-            for (i=0; i < n; i+=5) {
-                // decode 5 byte rtl_tcp command messages
-                int msg  = buffer[i];
-                int data = 0;
-                for (j=1;j<5;j++) {
-                    data = 256 * data + (0x00ff & buffer[i+j]);
-                }
-
-                if (msg == 1) {    // set frequency
-                    int f0 = data;
-                    fprintf(stdout, "setting frequency to: %d\n", f0);
-                    m = airspyhf_set_freq(device, f0);
-                    printf("set frequency status = %d\n", m);
-                }
-                if (msg == 2) {    // set sample rate
-                    int r = data;
-		    if (numSampleRates == 1 && r != 768000) {
-                        printf("error: unsupported sample rate command\n");
-		    }
-                    if ((r != previousSRate) || (decimateFlag > 1)) {
-		        int restartflag = 0;
-			if ((r == 48000) && (numSampleRates >= 4)) {
-                          fprintf(stdout, 
-			    "decimating 192k sample rate to 48k\n");
-			  decimateFlag = 4;
-			  init_iir();
-			  filterFlag   = 1;
-			  r = 4 * 48000; 	// 192000
-			} else {
-			  decimateFlag = 1;
-			  filterFlag   = 0;
-                          fprintf(stdout, "setting samplerate to: %d\n", r);
-			}
-                        sampRate = r;
-    			m = airspyhf_is_streaming(device);
-    			if (m > 0) {    // stop before restarting
-                            fprintf(stdout,"stopping now 00 \n");
-        		    m = airspyhf_stop(device);
-		            restartflag = 1;
-			    usleep(50L * 1000L);
-			}
-                        m = airspyhf_set_samplerate(device, sampRate);
-                        printf("set samplerate status = %d\n", m);
-                        previousSRate = r;
-		        if (restartflag == 1) {
-			    usleep(50L * 1000L);
-                            m = airspyhf_start(device, 
-			    		&usb_rcv_callback, &context);
-                            fprintf(stdout, "hf+ start status = %d\n", m);
-                            m = airspyhf_is_streaming(device);
-                            fprintf(stdout, "hf+ is running = %d\n", m);
-                            fflush(stdout);
-			}
-                    }
-                }
-                if (msg == 3) {            // other
-                    fprintf(stdout, "message = %d, data = %d\n", msg, data);
-                }
-                if (msg == 4) {            // gain
-                    if (   (sampleBits ==  8)
-                        || (sampleBits == 16) ) {
-                        // set gain ?
-                        float g1 = data; // data : in 10th dB's
-                        float g2 = 0.1 * (float)(data); // undo 10ths
-                        fprintf(stdout, "setting gain to: %f dB\n", g2);
-                        float g4 = g2 - 12.0; // ad hoc offset
-                        float g5 = pow(10.0, 0.1 * g4); // convert from dB
-                        gain0 = GAIN8 * g5;        // 64.0 = nominal
-                        msg1 = msg;
-                        float  g8  =  gain0; // GAIN8;
-                        fprintf(stdout, "8b  gain multiplier = %f\n", g8);
-                        float  g16 =   64.0 * gain0; // GAIN16;
-                        fprintf(stdout, "16b gain multiplier = %f\n", g16);
-                    }
-                }
-                if (msg > 4) {            // other
-                    fprintf(stdout, "message = %d, data = %d\n", msg, data);
-                }
-            }
-            if (msg1 != 4) {
-                m = airspyhf_is_streaming(device);
-                printf("hf+ is running = %d\n", m);
-                if (m == 0) {    // restart if command stops things
-                    sendErrorFlag =  0;
-                    m = airspyhf_start(device, &usb_rcv_callback, &context);
-                    fprintf(stdout, "hf+ start status = %d\n", m);
-                    m = airspyhf_is_streaming(device);
-                    fprintf(stdout, "hf+ is running = %d\n", m);
-                    fflush(stdout);
-                }
-            }
+        // whatever else has already arrived joins this burst
+        bzero((char *)&burst, sizeof(burst));
+        cmd_decode(c, buffer, n, &burst);
+        while ((k = recv(c->sockfd, buffer, sizeof(buffer),
+                         MSG_DONTWAIT)) > 0) {
+            cmd_decode(c, buffer, k, &burst);
         }
-        if (n < 0) {
-            fprintf(stdout, "read socket timeout %d \n", n);
-            fflush(stdout);
+        if (k == 0) { n = 0; }          // closed, after this burst
+        if (burst.n > 0) {
+            // commands from any of its clients apply to the device,
+            //   except in channel mode, where they retune its channel
+            pthread_mutex_lock(&rx->device_lock);
+            cmd_apply(c, &burst);
+            pthread_mutex_unlock(&rx->device_lock);
         }
         // loop until error (socket close) or timeout
     } ;
 
-    m = airspyhf_is_streaming(device);
-    printf("hf+ is running = %d\n", m);
-    if (m) {
-	fprintf(stdout,"stopping now 00 \n");
-        m = airspyhf_stop(device);
-        printf("hf+ stop status = %d\n", m);
+    c->stop_send_thread = 1;
+    pthread_mutex_lock(&c->rd.ring->lock);
+    pthread_cond_broadcast(&c->rd.ring->cond);
+    pthread_mutex_unlock(&c->rd.ring->lock);
+    if (c->send_thread != 0) {
+        pthread_join(c->send_thread, NULL);
+    }
+    ring_reader_detach(&c->rd);         // before a blocked writer holds us up
+    close(c->sockfd);
+    c->sockfd = -1;
+    channel_close(c);
+    printf("client %d disconnected, %lld bytes sent in %lld sends, "
+           "%lld overruns, %lld samples dropped\n", c->id,
+           (long long)c->bytes_sent, (long long)c->sends,
+           (long long)c->rd.lapped, (long long)c->rd.dropped);
+    if (c->zerocopy) {
+        printf("client %d: zero-copy sends %u, %lld copied by the kernel\n",
+               c->id, c->zc_next, c->zc_copied);
+    }
+    long long zf = atomic_load(&c->z_frames);
+    if (zf > 0) {
+        long long raw = atomic_load(&c->z_raw);
+        printf("client %d: %lld compressed frames, ratio %.2f, "
+               "encode %.1f ns per sample, slowest frame %.1f us\n",
+               c->id, zf, (double)raw / (double)atomic_load(&c->z_bytes),
+               (double)atomic_load(&c->z_ns)
+                   / ((double)raw / ring_frame_bytes()),
+               1e-3 * (double)atomic_load(&c->z_max_ns));
     }
 
-    close(gClientSocketID);
-    gClientSocketID = -1;
-    return(param);
+    pthread_mutex_lock(&rx->device_lock);
+    pthread_mutex_lock(&rx->clients_lock);
+    rx->numClients -= 1;
+    c->in_use       = 0;
+    if (device_idle(rx)) { device_stop(rx); }   // last one out
+    pthread_mutex_unlock(&rx->clients_lock);
+    pthread_mutex_unlock(&rx->device_lock);
+    fflush(stdout);
+    return(NULL);
 } // connection_handler()
 
-// uint8_t tmpBuf[4*32768];
+//  Runs received bytes through c's 5 byte command decoder.  Commands
+//    may be split across recvs; the partial one waits in c->cmd.
+//    Within a burst only the last frequency, rate and gain count,
+//    so a scanning client's queued retunes cost one hardware call.
+
+void cmd_decode(client_t *c, const uint8_t *p, int n, cmdBurst *b)
+{
+    for (int i=0; i<n; i++) {
+        c->cmd[c->cmd_len++] = p[i];
+        if (c->cmd_len < 5) { continue; }
+        c->cmd_len = 0;
+
+        int      msg  = c->cmd[0];
+        uint32_t data = ((uint32_t)c->cmd[1] << 24) | (c->cmd[2] << 16)
+                        | (c->cmd[3] << 8) | c->cmd[4];
+        b->n += 1;
+        if (msg == 1) {                 // set frequency
+            atomic_fetch_add_explicit(&c->rx->freqRetunes, 1,
+                                      memory_order_relaxed);
+            b->superseded += b->has_freq;
+            b->has_freq = 1;
+            b->freq     = (long)data;
+        } else if (msg == 2) {          // set sample rate
+            atomic_fetch_add_explicit(&c->rx->rateRetunes, 1,
+                                      memory_order_relaxed);
+            b->superseded += b->has_rate;
+            b->has_rate = 1;
+            b->rate     = (long)data;
+        } else if (msg == 4) {          // gain
+            b->has_gain = 1;
+            b->gain     = (int)data;
+        } else if (msg == CMD_COMPRESS) {
+            b->compress |= (data != 0);
+        } else {
+            b->other     += 1;
+            b->other_msg  = msg;
+            b->other_data = data;
+        }
+    }
+}
+
+//  Applies a burst, with rx's device_lock held : compression, then
+//    frequency, rate and gain, one status line for the lot.
+
+void cmd_apply(client_t *c, cmdBurst *b)
+{
+    receiver_t *rx    = c->rx;
+    channel_t  *chan0 = &rx->chan0;
+    int m;
+
+    if (b->superseded > 0) {
+        atomic_fetch_add_explicit(&rx->cmdCoalesced, b->superseded,
+                                  memory_order_relaxed);
+    }
+    if (b->compress && !c->compress) {
+        // frames can't be switched back off mid-stream
+        if (sampleBits == 32 || sampleBits == BFP_BITS) {
+            printf("client %d: floats are sent uncompressed\n", c->id);
+        } else {
+            c->compress = 1;
+        }
+    }
+    if (b->other > 0) {
+        printf("client %d: %d commands ignored, last message = %d, "
+               "data = %u\n", c->id, b->other, b->other_msg, b->other_data);
+    }
+    if (!b->has_freq && !b->has_rate && !b->has_gain) { return; }
+    if (b->superseded > 0) {
+        printf("client %d: %d commands, %d retunes coalesced\n",
+               c->id, b->n, b->superseded);
+    }
+
+    if (c->chan != NULL) {
+        long offset = c->chan->offset;
+        if (b->has_freq) { channel_command(c, 1, (uint32_t)b->freq); }
+        if (b->has_rate) { channel_command(c, 2, (uint32_t)b->rate); }
+        if (b->has_freq && b->has_rate && c->chan->offset == offset
+            && b->freq - rx->chanCenter != offset) {
+            // it only fits at the new, narrower rate
+            channel_command(c, 1, (uint32_t)b->freq);
+        }
+        if (b->has_gain) { channel_command(c, 4, b->gain); }
+        if (b->has_freq || b->has_rate) { client_flush(rx, c); }
+        return;
+    }
+
+    int restarted = 0;
+    if (b->has_freq && b->freq != rx->tunedFreq && !ncoTune) {
+        m = airspyhf_set_freq(rx->device, (uint32_t)b->freq);
+        fprintf(stdout, "client %d: frequency %ld, status %d\n",
+                c->id, b->freq, m);
+        rx->tunedFreq = b->freq;
+        chan0->retune_pos = atomic_load(&chan0->ring.wr_pos);
+    }
+    if (b->has_rate) {
+        long r  = b->rate;
+        long hw = hardware_rate(rx, r);
+        if (r == rx->previousSRate) {
+            // nothing to do
+        } else if (channel_set_rate(chan0, hw, r) < 0) {
+            printf("error: unsupported sample rate %ld\n", r);
+        } else {
+            if (hw != r) {
+                fprintf(stdout, "resampling %ld to %ld\n", hw, r);
+            } else {
+                fprintf(stdout, "setting samplerate to: %ld\n", r);
+            }
+            rx->previousSRate = r;
+        }
+        if ((r == rx->previousSRate) && (hw != rx->sampRate)) {
+            int restartflag = 0;
+            rx->sampRate = hw;
+            m = airspyhf_is_streaming(rx->device);
+            if (m > 0) {    // stop before restarting
+                fprintf(stdout,"stopping now 00 \n");
+                m = airspyhf_stop(rx->device);
+                restartflag = 1;
+                usleep(50L * 1000L);
+            }
+            m = airspyhf_set_samplerate(rx->device, rx->sampRate);
+            printf("set samplerate status = %d\n", m);
+            if (restartflag == 1) {
+                usleep(50L * 1000L);
+                rx->usb_pinned = 0;
+                m = airspyhf_start(rx->device, &usb_rcv_callback, rx);
+                fprintf(stdout, "hf+ start status = %d\n", m);
+            }
+            restarted = 1;
+        }
+    }
+    if (ncoTune && (b->has_freq || b->has_rate)) {
+        // after the rate, which decides what fits
+        nco_tune(c, b->has_freq ? b->freq : rx->tunedFreq + chan0->offset);
+    }
+    if (b->has_freq || b->has_rate) {
+        client_flush(rx, NULL);
+        recorder_tune(&rx->recorder,
+                      (double)(rx->tunedFreq
+                               + (recStream ? chan0->offset : 0)),
+                      recStream ? (double)chan0->rate : (double)rx->sampRate);
+        spectrum_tune(&rx->spectrum, (double)rx->tunedFreq,
+                      (double)rx->sampRate);
+        udp_tune(&rx->udpOut, (double)(rx->tunedFreq + chan0->offset),
+                 (double)chan0->rate);
+    }
+    if (b->has_gain && sampleBits != 32 && sampleBits != BFP_BITS) {
+        float g4 = 0.1 * (float)(b->gain) - 12.0; // 10ths of dB, ad hoc offset
+        rx->gain0 = GAIN8 * pow(10.0, 0.1 * g4);  // 64.0 = nominal
+        chan0->gain = rx->gain0;
+        fprintf(stdout, "client %d: gain %.1f dB, 8b multiplier %f\n",
+                c->id, 0.1 * (float)(b->gain), rx->gain0);
+    }
+    if (restarted) {
+        m = device_streaming(rx);
+        if (m == 0) {    // restart if the rate change stopped things
+            device_start(rx);
+        }
+        fprintf(stdout, "hf+ is running = %d\n", device_streaming(rx));
+    }
+    fflush(stdout);
+}
+
+//  -N : while freq keeps the stream's passband inside the usable span,
+//    the hardware stays parked and chan0's NCO shifts the stream there,
+//    phase continuous, with no usb round trip or settling transient.
+//    Otherwise (or at the full hardware rate) the hardware moves to freq.
+//    Called with rx's device_lock held.
 
-typedef union
+void nco_tune(client_t *c, long freq)
 {
-    uint32_t i;
-    float    f;
-} Float32_t;
+    receiver_t *rx    = c->rx;
+    channel_t  *chan0 = &rx->chan0;
+    long      offset = freq - rx->tunedFreq;
+    long long t0     = mono_ns();
+    int       fits   = (chan0->rate < rx->sampRate)
+                       && channel_fits(rx, offset, chan0->rate);
+    if (!fits) {
+        offset = 0;
+        if (freq != rx->tunedFreq) {
+            int m = airspyhf_set_freq(rx->device, (uint32_t)freq);
+            fprintf(stdout, "client %d: frequency %ld, status %d\n",
+                    c->id, freq, m);
+            rx->tunedFreq = freq;
+        }
+    }
+    pthread_mutex_lock(&chan0->lock);
+    chan0->offset = offset;
+    nco_set(&chan0->nco, (double)offset, rx->sampRate); // may be new
+    chan0->retune_pos = atomic_load(&chan0->ring.wr_pos);
+    pthread_mutex_unlock(&chan0->lock);
+    if (fits) {
+        atomic_fetch_add_explicit(&rx->ncoRetunes, 1, memory_order_relaxed);
+        fprintf(stdout, "client %d: frequency %ld, nco offset %ld Hz, "
+                "%.1f us\n", c->id, freq, offset, 1e-3 * (mono_ns() - t0));
+    }
+}
+
+//  Converts n processed IQ pairs to the wire format in out[],
+//    returns the number of bytes.  Block floating point holds back
+//    the pairs that don't fill a block until the next call.
+
+int quantize_samples(channel_t *ch, const float *p, int n, uint8_t *out)
+{
+    if (sampleBits ==  8) {
+        return(quantize_8(p, n, ch->gain, out, &ch->dither));
+    } else if (sampleBits == 16) {
+        return(quantize_16(p, n, ch->gain, out));
+    } else if (sampleBits == 12) {
+        return(quantize_12(p, n, ch->gain, out));
+    } else if (sampleBits == BFP_BITS) {
+        int sz = 0;
+        for (int i=0; i<n; ) {
+            int k = BFP_PAIRS - ch->bfp_n;
+            if (k > n - i) { k = n - i; }
+            if (k == BFP_PAIRS) {           // a whole block, in place
+                sz += quantize_bfp(&p[2*i], ch->bfp_seq++, out + sz);
+                i  += k;
+                continue;
+            }
+            memcpy(&ch->bfp[2*ch->bfp_n], &p[2*i], 8*k);
+            ch->bfp_n += k;
+            i         += k;
+            if (ch->bfp_n == BFP_PAIRS) {
+                sz += quantize_bfp(ch->bfp, ch->bfp_seq++, out + sz);
+                ch->bfp_n = 0;
+            }
+        }
+        return(sz);
+    }
+    memcpy(out, p, 8 * n);     // two 32-bit floats for IQ == 8 bytes
+    return(8 * n);
+}
 
-float rand_float_co()
+//  bytes quantize_samples() will produce from n more pairs
+
+long wire_bytes(channel_t *ch, int n)
 {
-    Float32_t x;
-    x.i = 0x3f800000 | (rand() & 0x007fffff);
-    return(x.f - 1.0f);
+    if (sampleBits == BFP_BITS) {
+        return((long)((ch->bfp_n + n) / BFP_PAIRS) * BFP_FRAME);
+    }
+    return((long)n * ch->ring.frame);
 }
 
+//  One pass over the usb block, a tile at a time : mix the channel's
+//    offset down to 0 Hz, resample, and quantize straight
+//    into the ring's free space.  Each tile stays in L1 from the
+//    first step to the last.  Unless the ring drops old data from
+//    behind slow readers, a tile that doesn't fit is dropped whole
+//    (RING_DROP_NEWEST) or waited for (RING_BLOCK).
+
+void channel_process(channel_t *ch, const float *p, int n)
+{
+    float   tile[2 * TILE_PAIRS];
+    float   out[2 * TILE_OUT];
+    ring_t  *r       =  &ch->ring;
+    long    contig   =  0;
+    long    written  =  0;
+
+    pthread_mutex_lock(&ch->lock);      // before the ring is looked at
+    uint8_t *w       =  ring_write_ptr(r, &contig);
+    long    space    =  ring_space(r);
+    for (int k=0; k<n; k+=TILE_PAIRS) {
+        int t = n - k;
+        if (t > TILE_PAIRS) { t = TILE_PAIRS; }
+        const float *src = &p[2*k];
+        int m = t;
+        if (ch->offset != 0) {
+            nco_mix(tile, src, t, &ch->nco);
+            src = tile;
+        }
+        if (ch->resamp) {
+            m = resamp_process(&ch->rs, src, t, out);
+            src = out;
+        } else if (ch->decim > 1) {
+            if (src != tile) {
+                memcpy(tile, src, 8*t);
+                src = tile;
+            }
+            iir_filter(tile, 2*t, &ch->iir);
+            m = decimate_iq(tile, t, ch->decim, &ch->decimCntr);
+        }
+        if (m == 0) { continue; }
+        long need = wire_bytes(ch, m);
+        if (written + need > space) {
+            if (r->policy == RING_BLOCK) {
+                ring_commit(r, written);
+                written = 0;
+                w = ring_write_ptr(r, &contig);
+                do {
+                    space = ring_wait_space(r, need, 100, &do_exit);
+                } while (space < need && do_exit == 0);
+            } else {
+                space = ring_space(r);
+            }
+            if (written + need > space) {
+                if (!ch->dropping) {
+                    printf("%s ring full, dropping newest at sample %lld\n",
+                           ch->name,
+                           ring_sample_seq(r)
+                           + written / r->frame * r->frame_pairs);
+                    ch->dropping = 1;
+                }
+                ring_drop(r, need);
+                if (sampleBits == BFP_BITS) {
+                    // keep the pairs that come after the dropped blocks
+                    int left = (ch->bfp_n + m) % BFP_PAIRS;
+                    memcpy(ch->bfp, &src[2*(m - left)], 8*left);
+                    ch->bfp_n    = left;
+                    ch->bfp_seq += need / BFP_FRAME;
+                }
+                continue;
+            }
+        }
+        ch->dropping = 0;
+        if (written + need > contig) {  // only without the mirrored mapping
+            ring_commit(r, written);
+            space  -= written;
+            written = 0;
+            w = ring_write_ptr(r, &contig);
+            if (need > contig) {
+                uint8_t stage[8 * TILE_OUT];
+                int sz = quantize_samples(ch, src, m, stage);
+                ring_write(r, stage, sz);
+                space -= sz;
+                w = ring_write_ptr(r, &contig);
+                continue;
+            }
+        }
+        ring_reserve(r, written + need);    // for readers mid-send
+        written += quantize_samples(ch, src, m, w + written);
+    }
+    ring_commit(r, written);            // readers never block the writer
+    pthread_mutex_unlock(&ch->lock);
+}
+
+//  libairspyhf's transfer thread : copy the block into the pool and
+//    return.  Everything else happens on the dsp worker, so heavier
+//    formats or filters can't stall usb transfers.
+
 int usb_rcv_callback(airspyhf_transfer_t *context)
 {
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    receiver_t *rx =  (receiver_t *)(context->ctx);
     float  *p =  (float *)(context->samples);
     int    n  =  context->sample_count;
-    int       sz ;
 
-    if (sendErrorFlag != 0) { return(-1); }
     if (do_exit != 0) { return(-1); }
-    //
-    if ((sendblockcount % 1000) == 0) {
-        fprintf(stdout,"+"); fflush(stdout);
-    }
-    //
-    if (p != NULL && n > 0) {
-        // fwrite(p, 8, n, file);
-        uint8_t *dataBuffer    =  (uint8_t *)p; 	// unneeded line
-	memcpy(&tmpFPBuf[0], p, 8*n);
-	if (filterFlag != 0) {
-            int order =  12;
-	    iir_fbc(&tmpFPBuf[0], 2*n, order);
-	}
-	p = &tmpFPBuf[0];
-        int    k        =  0;
-        if (sampleBits ==  8) {
-            float  g8  =  gain0; // GAIN8;
-            // gain is typically 64.0
-            // should be 128.0 or 2X larger, so 1-bit missing
-            float rnd0A = rand_float_co();
-            float rnd0B = rand_float_co();
-            for (int i=0; i<2*n; i++) {
-                float x;
-                Float32_t x1;          // for debug hex print
-                x    = p[i];
-                float y = g8 * x;
-                // add triangular noise
-                // for noise filtered rounding
-                float rnd1 = rand_float_co(); // noise with pdf [0..1)
-                float r = rnd1 - (((i&1)==1) ? rnd0A : rnd0B);
-                y = y + r;
-                float ry = roundf(y);
-                acc_r += (y - ry);     // for future noise filtering
-                k = (int)ry;
-                tmpBuf[i] = k + 128;
-                if ((i&1) == 1) {      // round I
-                    rnd0A = rnd1;      // save for next iteration
-                } else {               // round Q
-                    rnd0B = rnd1;      // save for next iteration
+    if (!rx->usb_pinned) {              // first block since the start
+        if (rx->usb_cpu >= 0) { cpu_pin(rx->usb_cpu); }
+        rx->usb_pinned = 1;
+    }
+    while (p != NULL && n > 0) {
+        int t = (n < rx->blockPool.pairs) ? n : rx->blockPool.pairs;
+        float *b = pool_put_ptr(&rx->blockPool);
+        if (b == NULL) { break; }       // full, pool counts the drop
+        memcpy(b, p, 8 * t);
+        pool_put(&rx->blockPool, t);
+        p += 2 * t;
+        n -= t;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    long long ns = 1000000000LL * (t1.tv_sec - t0.tv_sec)
+                   + (t1.tv_nsec - t0.tv_nsec);
+    atomic_fetch_add_explicit(&rx->cbCalls, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&rx->cbNanos, ns, memory_order_relaxed);
+    if (ns > atomic_load_explicit(&rx->cbMaxNanos, memory_order_relaxed)) {
+        atomic_store_explicit(&rx->cbMaxNanos, ns, memory_order_relaxed);
+    }
+    return(0);
+}
+
+//  -P : the playback thread's blocks take the same path
+
+int play_rcv_callback(const float *p, int n, void *ctx)
+{
+    airspyhf_transfer_t t;
+    bzero((char *)&t, sizeof(t));
+    t.ctx          = ctx;
+    t.samples      = (airspyhf_complex_float_t *)p;
+    t.sample_count = n;
+    return(usb_rcv_callback(&t));
+}
+
+void block_peaks(receiver_t *rx, const float *p, int n)
+{
+    float mx = p[0], mn = p[0];
+    for (int i=1; i<2*n; i++) {
+        mx = (p[i] > mx) ? p[i] : mx;
+        mn = (p[i] < mn) ? p[i] : mn;
+    }
+    atomic_store_explicit(&rx->sMax, mx, memory_order_relaxed);
+    atomic_store_explicit(&rx->sMin, mn, memory_order_relaxed);
+}
+
+void *dsp_worker(void *param)
+{
+    receiver_t *rx = (receiver_t *)param;
+    if (rx->dsp_cpu >= 0) { cpu_pin(rx->dsp_cpu); }
+    while (do_exit == 0) {
+        int   n = 0;
+        float *p = pool_get(&rx->blockPool, &n, 100, &do_exit);
+        if (p == NULL) { continue; }
+        if ((rx->sendblockcount % 1000) == 0) {
+            fprintf(stdout,"+"); fflush(stdout);
+        }
+        if (channelMode) {
+            for (int i=0; i<MAX_CLIENTS; i++) {
+                if (rx->channels[i].in_use) {
+                    channel_process(&rx->channels[i], p, n);
                 }
             }
-            // previous rounding
-            /*
-            for (int i=0; i<2*n; i++) {
-                float x = g8 * p[i];
-                int   k = (int)roundf(x);
-                tmpBuf[i] = k + 128;  // 8-bit unsigned DC offset
-            }
-            */
-            dataBuffer = (uint8_t *)(&tmpBuf[0]);
-            sz = 2 * n;
-        } else if (sampleBits == 16) {
-            int16_t *tmp16ptr = (int16_t *)&tmpBuf[0];
-            float  g16  =   64.0 * gain0; // GAIN16;
-            // gain is typically 64.0 * 64.0 = 4096.0
-            // should be 32768.0 or 8X larger, so 3-bits missing
-            for (int i=0; i<2*n; i++) {
-                float x = g16 * p[i];
-                int   k = (int)roundf(x);
-                tmp16ptr[i] = k;
-            }
-            dataBuffer = (uint8_t *)(&tmpBuf[0]);
-            sz = 4 * n;
         } else {
-            sz = 8 * n;    // two 32-bit floats for IQ == 8 bytes
+            channel_process(&rx->chan0, p, n);
         }
-        int wrap = ring_write(dataBuffer, sz);
-        if (wrap != 0) { 
-            // fprintf(stderr, "ring wrap around error %d\n", wrap); // yyy
-            // fflush(stderr);
-	}
-	wrap = 0; 				// yyy yyy
-        if ((do_exit != 0) || (wrap != 0)) { 
-            stop_send_thread = 0;
-	    return(-1); 
-	}
-        totalSamples += n;
+        block_peaks(rx, p, n);
+        recorder_feed(&rx->recorder, p, n);
+        spectrum_feed(&rx->spectrum, p, n);
+        pool_release(&rx->blockPool);
+        atomic_fetch_add_explicit(&rx->totalSamples, n, memory_order_relaxed);
+        rx->sendblockcount += 1;
     }
-    sendblockcount += 1;
-    return(0);
+    return(NULL);
 }
 
+//  Smallest hardware rate that can supply r, or the fastest one
 
-//
-//
-
-typedef struct iirParams {
-    float 	a0;
-    float 	a1;
-    float 	a2;
-    float 	b0;	
-    float 	b1;	
-    float 	b2;	
-    float 	ys_2L;	// saved history
-    float 	ys_1L;
-    float 	ys_0L;	// last output
-    float 	xs_2L;
-    float 	xs_1L;
-    float 	xs_0L;	// last input
-    float 	ys_2R;	// saved history
-    float 	ys_1R;
-    float 	ys_0R;	// last output
-    float 	xs_2R;
-    float 	xs_1R;
-    float 	xs_0R;	// last input
-    float	sr;
-    float	cf;
-    float	q;
-    int32_t 	ftype;
-} iirParams;
-
-void iir_f2(float *s, int n, iirParams *p) // IQ or stereo
-{
-    float	a0, a1, a2, b0, b1, b2;
-    float 	x2L,x1L,x0L,y2L,y1L,y0L;
-    float 	x2R,x1R,x0R,y2R,y1R,y0R;
-    int   	i, k;
-
-    a0 = p->a0 ;
-    a1 = p->a1 ;
-    a2 = p->a2 ;
-    b0 = p->b0 ;
-    b1 = p->b1 ;
-    b2 = p->b2 ;
-    k  = p->ftype;
-
-    x1L = p->xs_1L;			// recover history
-    x0L = p->xs_0L;
-    y1L = p->ys_1L;
-    y0L = p->ys_0L;
-    x1R = p->xs_1R;			// recover history
-    x0R = p->xs_0R;
-    y1R = p->ys_1R;
-    y0R = p->ys_0R;
-    if (k == 1) {			/* type 1 = lowpass  */
-      for (i=0; i<n; i+=2) { 		// +=2 for interleaved
-        x2L = s[i  ]; 
-	y2L = b0 * x2L + b1 * x1L + b2 * x0L - a1 * y1L - a2 * y0L;
-        s[i  ] = y2L;
-        y0L = y1L; y1L = y2L;
-        x0L = x1L; x1L = x2L;
-	//
-        x2R = s[i+1]; 
-	y2R = b0 * x2R + b1 * x1R + b2 * x0R - a1 * y1R - a2 * y0R;
-        s[i+1] = y2R;
-        y0R = y1R; y1R = y2R;
-        x0R = x1R; x1R = x2R;
-      }
-    }
-    p->xs_1L = x1L;		// save history
-    p->xs_0L = x0L;
-    p->ys_1L = y1L;
-    p->ys_0L = y0L;
-    p->xs_1R = x1R;		// save history
-    p->xs_0R = x0R;
-    p->ys_1R = y1R;
-    p->ys_0R = y0R;
-}
-
-void calc_iir_coefs(int ftype, float cf, float q, float sr, iirParams *p)
-{
-    double        w0, alpha;
-    double        b0,b1,b2,a0,a1,a2;
-    double	  g1, dbg;		// dB gain
-    double        y;
-
-    a0 = 0.0;
-    a1 = 0.0;
-    a2 = 0.0;
-    b0 = 0.0;
-    b1 = 0.0;
-    b2 = 0.0;
-    if (ftype == 3) {              // bandpass w/ 0 gain
-	dbg = 0.0;
-	g1 = sqrt(pow(10.0, (dbg / 20.0)));
-        w0 = 2.0 * 3.14159265358979 * cf / sr;
-	alpha = sin(w0)/(2.0 * q);
-	b0 =  alpha;
-	b1 =  0.0;
-	b2 = -alpha;
-	a0 =  1.0 + alpha;
-	a1 = -2.0 * cos(w0);
-	a2 =  1.0 - alpha;
-    } else if (ftype == 1) {  // lowpass
-	dbg = 0.0;
-	g1 = sqrt(pow(10.0, (dbg / 20.0)));
-        w0 = 2.0 * 3.14159265358979 * cf / sr;
-	alpha = sin(w0)/(2.0 * q);
-	if (ftype == 1) y = 1.0 - cos(w0);
-	else            y = 1.0 + cos(w0);
-	b0 =  y / 2.0;
-	b1 =  y;
-	b2 =  y / 2.0;
-	a0 =  1.0 + alpha;
-	a1 = -2.0 * cos(w0);
-	a2 =  1.0 - alpha;
-    }
-    p->a0 = a0;
-    p->a1 = a1/a0;
-    p->a2 = a2/a0;
-    p->b0 = b0/a0;
-    p->b1 = b1/a0;
-    p->b2 = b2/a0;
-    p->ys_1L =  0.0;
-    p->ys_0L =  0.0;
-    p->xs_1L =  0.0;
-    p->xs_0L =  0.0;
-    p->ys_1R =  0.0;
-    p->ys_0R =  0.0;
-    p->xs_1R =  0.0;
-    p->xs_0R =  0.0;
-    p->sr    =  sr;
-    p->cf    =  cf;
-    p->q     =  q;
-    p->ftype =  ftype;
-}
-
-// iir float biquad cascade
-// butterworth biquad cascade
-double bbcascade[36] = {
-  0.70710678, 0.0,0.0, 0.0,0.0,0.0,
-  0.54119610, 1.3065630, 0.0, 0.0,0.0,0.0,
-  0.51763809, 0.70710678, 1.9318517, 0.0,0.0,0.0,
-  0.50979558, 0.60134489, 0.89997622, 2.5629154, 0.0, 0.0,
-  0.50623256, 0.56116312, 0.70710678, 1.1013446, 3.1962266, 0.0,
-  0.50431448, 0.54119610, 0.63023621, 0.82133982, 1.3065630, 3.8306488
-};
+long hardware_rate(receiver_t *rx, long r)
+{
+    long best = 0, top = 0;
+    for (int i=0; i<rx->numSampleRates; i++) {
+        long h = rx->sampleRates[i];
+        if (h > top) { top = h; }
+        if (h >= r && (best == 0 || h < best)) { best = h; }
+    }
+    return((best > 0) ? best : top);
+}
 
-struct iirParams ipbc[36];
+//  The resampler reaches any rate from in_rate.  With -F iir, integer
+//    ratios keep the IIR lowpass and sample dropping path instead.
+//    The old resampler is freed after the callback lets go of it.
 
-void init_ipbc(double sr, double cf)
+int channel_set_rate(channel_t *ch, long in_rate, long out_rate)
 {
-    int i,j;
-    for (j=0;j<6;j++) {
-       for (i=0;i<6;i++) {
-	  int ftype = 0;
-	  int k = 6*j + i;
-	  iirParams *p = &ipbc[k];
-	  float q = bbcascade[k];
-	  if (q > 0.0) { ftype = 1; }	// low pass
-	  calc_iir_coefs(ftype, cf, q, sr, p);
-       }
+    resamp_t rs, old;
+    int      use_rs = 0;
+    int      had_rs = 0;
+    int      decim  = 1;
+
+    if (out_rate != in_rate) {
+        if (iirFilter && (out_rate < in_rate) && ((in_rate % out_rate) == 0)) {
+            decim = in_rate / out_rate;
+        } else {
+            if (resamp_init(&rs, (double)in_rate, (double)out_rate) < 0) {
+                return(-1);
+            }
+            use_rs = 1;
+        }
+    }
+    pthread_mutex_lock(&ch->lock);
+    had_rs = ch->resamp;
+    if (had_rs) { old = ch->rs; }
+    if (use_rs) { ch->rs = rs; }
+    ch->resamp    =  use_rs;
+    ch->rate      =  out_rate;
+    ch->decim     =  decim;
+    ch->decimCntr =  0;
+    if (decim > 1) {
+        iir_cascade_init(&ch->iir, CHANNEL_FILTER_ORDER,
+                         (double)in_rate, 0.4 * (double)out_rate);
     }
+    ch->retune_pos = atomic_load(&ch->ring.wr_pos);
+    pthread_mutex_unlock(&ch->lock);
+    if (had_rs) { resamp_free(&old); }
+    return(0);
 }
 
-void iir_fbc(float *s, int n, int order)
+//  Channel mode : the hardware stays at chanCenter and sampRate,
+//    each client's frequency, rate and gain commands select
+//    and scale its own slice of the capture.
+
+int channel_open(client_t *c)
 {
-    int num_biquads = order / 2;
-    int k = 0;
-    int batch = 4096; // 16384 fits in dcache
-    while (k < n) {
-        int m = batch;
-	if (k + batch > n) { m = n - k; }
-        for (int b=0;b<6;b++) {
-            int j = 6*(num_biquads-1) + b;
-            iirParams *p = &ipbc[j];
-            if (p->ftype == 1) {
-	        iir_f2(&s[k], m, p);
-            }
+    receiver_t *rx = c->rx;
+    channel_t  *ch = &rx->channels[c->id];
+    if (ch->ring.buf == NULL) {
+        if (ring_init(&ch->ring, CHANNEL_RING_ALLOCATION,
+                      ring_frame_bytes()) < 0) {
+            return(-1);
         }
-	k += batch;
+        ch->ring.policy = ringPolicy;
+        ch->ring.frame_pairs = ring_frame_pairs();
     }
+    pthread_mutex_lock(&ch->lock);
+    ch->offset    =  0;
+    ch->rate      =  rx->sampRate;
+    if (ch->resamp) { resamp_free(&ch->rs); }
+    ch->resamp    =  0;
+    ch->decim     =  1;
+    ch->decimCntr =  0;
+    ch->gain      =  rx->gain0;
+    ch->bfp_n     =  0;
+    dither_init(&ch->dither, 0x5eed0000 + c->id);
+    bzero((char *)&ch->nco, sizeof(nco_t));
+    nco_set(&ch->nco, 0.0, rx->sampRate);
+    ch->in_use    =  1;
+    pthread_mutex_unlock(&ch->lock);
+    c->chan = ch;
+    ring_reader_attach(&c->rd, &ch->ring);
+    return(0);
+}
+
+void channel_close(client_t *c)
+{
+    if (c->chan == NULL) { return; }
+    pthread_mutex_lock(&c->chan->lock);
+    c->chan->in_use = 0;
+    pthread_mutex_unlock(&c->chan->lock);
+    c->chan = NULL;
+}
+
+//  the channel's passband must stay inside the usable span
+
+int channel_fits(receiver_t *rx, long offset, long rate)
+{
+    double edge = 0.5 * CHANNEL_USABLE * rx->sampRate;
+    double half = (rate < rx->sampRate) ? 0.5 * rate : 0.0;
+    return((fabs((double)offset) + half) <= edge);
 }
 
-void init_iir()
+void channel_command(client_t *c, int msg, int data)
 {
-    double        sr, bw;
-    sr =  192000.0;
-    bw =   16000.0;
-    	// int type = 1; // lowpass
-        // call calc_iir_coefs(type, bw, q, sr, &pp);
-        //   with 6 sets of 6 coeffs for 2nd to 12th order filtering
-    init_ipbc(sr, bw);
-        // int order =  12;		// set filter order
-        // iir_fbc(&uu[0], n, order);
+    receiver_t *rx = c->rx;
+    channel_t  *ch = c->chan;
+    if (msg == 1) {    // set channel frequency
+        long offset = (long)data - rx->chanCenter;
+        if (!channel_fits(rx, offset, ch->rate)) {
+            printf("client %d: %d Hz is outside the captured span\n",
+                   c->id, data);
+            return;
+        }
+        pthread_mutex_lock(&ch->lock);
+        ch->offset = offset;
+        nco_set(&ch->nco, (double)offset, rx->sampRate);
+        ch->retune_pos = atomic_load(&ch->ring.wr_pos);
+        pthread_mutex_unlock(&ch->lock);
+        printf("client %d: channel offset %ld Hz\n", c->id, offset);
+    } else if (msg == 2) {    // set channel sample rate
+        long r = data;
+        if ((r <= 0) || (r > rx->sampRate)) {
+            printf("client %d: unsupported channel rate %ld\n", c->id, r);
+            return;
+        }
+        if (!channel_fits(rx, ch->offset, r)) {
+            printf("client %d: %ld Hz wide channel does not fit\n",
+                   c->id, r);
+            return;
+        }
+        if (channel_set_rate(ch, rx->sampRate, r) < 0) {
+            printf("client %d: unsupported channel rate %ld\n", c->id, r);
+            return;
+        }
+        printf("client %d: channel rate %ld\n", c->id, r);
+    } else if (msg == 4) {    // gain
+        float g4 = 0.1 * (float)(data) - 12.0; // 10ths of dB, ad hoc offset
+        ch->gain = GAIN8 * pow(10.0, 0.1 * g4);
+        printf("client %d: channel gain multiplier = %f\n", c->id, ch->gain);
+    } else {
+        fprintf(stdout, "message = %d, data = %d\n", msg, data);
+    }
 }
 
-/* eof */
 
 // eof
@@ -0,0 +1,343 @@
+//
+//  hfp_udp.c
+//
+//  UDP output for hfp_tcp, see hfp_udp.h
+//
+//   re-distribution under the BSD 3 clause license permitted
+//
+
+#ifdef __linux__
+#define _GNU_SOURCE             // sendmmsg
+#else
+#define _POSIX_C_SOURCE 200112L
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include "hfp_udp.h"
+
+#if defined(__linux__)
+#define HFP_SENDMMSG
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT     (103)   // linux/udp.h, older libc headers lack it
+#endif
+#ifndef SOL_UDP
+#define SOL_UDP         (17)
+#endif
+#endif
+
+static void udp_header(udp_t *u, uint8_t *h, uint32_t seq)
+{
+    memcpy(h, "HFPU", 4);
+    h[4] = (uint8_t)u->bits;
+    h[5] = 0;
+    h[6] = (uint8_t)(u->payload >> 8);
+    h[7] = (uint8_t)(u->payload     );
+    put_u32(h +  8, seq);
+    put_u32(h + 12, atomic_load_explicit(&u->freq, memory_order_relaxed));
+    put_u32(h + 16, atomic_load_explicit(&u->rate, memory_order_relaxed));
+}
+
+//  host:port, [v6 address]:port or v6address:port (the last colon)
+
+static int udp_resolve(udp_t *u, const char *dest)
+{
+    char host[160];
+    const char *colon = strrchr(dest, ':');
+    if (colon == NULL || colon == dest || colon - dest >= (long)sizeof(host)) {
+        printf("udp: %s is not host:port\n", dest);
+        return(-1);
+    }
+    int n = (int)(colon - dest);
+    if (dest[0] == '[' && dest[n-1] == ']') {
+        memcpy(host, dest + 1, n - 2);
+        host[n-2] = 0;
+    } else {
+        memcpy(host, dest, n);
+        host[n] = 0;
+    }
+    struct addrinfo hints, *res = NULL;
+    bzero((char *)&hints, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags    = AI_NUMERICSERV;
+    int e = getaddrinfo(host, colon + 1, &hints, &res);
+    if (e != 0 || res == NULL) {
+        printf("udp: can't resolve %s, %s\n", dest, gai_strerror(e));
+        return(-1);
+    }
+    memcpy(&u->dest, res->ai_addr, res->ai_addrlen);
+    u->dest_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    if (u->dest.ss_family == AF_INET) {
+        struct sockaddr_in *a = (struct sockaddr_in *)&u->dest;
+        u->multicast = ((ntohl(a->sin_addr.s_addr) >> 28) == 0xe);
+    } else {
+        struct sockaddr_in6 *a = (struct sockaddr_in6 *)&u->dest;
+        u->multicast = IN6_IS_ADDR_MULTICAST(&a->sin6_addr);
+    }
+    return(0);
+}
+
+//  n datagrams of payload bytes at ptr, numbered from seq.
+//    Returns how many went, or -1.
+
+#ifdef HFP_SENDMMSG
+static int udp_send_gso(udp_t *u, const uint8_t *ptr, int n, uint32_t seq)
+{
+    int   dg = UDP_HEADER_BYTES + u->payload;
+    char  ctrl[CMSG_SPACE(sizeof(uint16_t))];
+    for (int i=0; i<n; i++) {
+        uint8_t *d = u->stage + (long)i * dg;
+        udp_header(u, d, seq + i);
+        memcpy(d + UDP_HEADER_BYTES, ptr + (long)i * u->payload, u->payload);
+    }
+    struct iovec  iov = { u->stage, (size_t)n * dg };
+    struct msghdr msg;
+    bzero((char *)&msg, sizeof(msg));
+    bzero(ctrl, sizeof(ctrl));
+    msg.msg_name       = &u->dest;
+    msg.msg_namelen    = u->dest_len;
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type  = UDP_SEGMENT;
+    cm->cmsg_len   = CMSG_LEN(sizeof(uint16_t));
+    uint16_t seg   = (uint16_t)dg;
+    memcpy(CMSG_DATA(cm), &seg, sizeof(seg));
+    atomic_fetch_add_explicit(&u->calls, 1, memory_order_relaxed);
+    if (sendmsg(u->sockfd, &msg, 0) < 0) {
+        if (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT) {
+            printf("udp: no GSO here (%s), using sendmmsg\n", strerror(errno));
+            u->gso = 0;
+        }
+        return(-1);
+    }
+    return(n);
+}
+#endif
+
+static int udp_send_batch(udp_t *u, const uint8_t *ptr, int n, uint32_t seq)
+{
+#ifdef HFP_SENDMMSG
+    if (u->gso) {
+        int k = udp_send_gso(u, ptr, n, seq);
+        if (k >= 0 || u->gso) { return(k); }
+    }
+#endif
+    for (int i=0; i<n; i++) {
+        udp_header(u, u->hdrs + i * UDP_HEADER_BYTES, seq + i);
+    }
+#ifdef HFP_SENDMMSG
+    struct mmsghdr msgs[UDP_BATCH];
+    struct iovec   iov[UDP_BATCH][2];
+    bzero((char *)msgs, n * sizeof(struct mmsghdr));
+    for (int i=0; i<n; i++) {
+        iov[i][0].iov_base = u->hdrs + i * UDP_HEADER_BYTES;
+        iov[i][0].iov_len  = UDP_HEADER_BYTES;
+        iov[i][1].iov_base = (void *)(ptr + (long)i * u->payload);
+        iov[i][1].iov_len  = u->payload;
+        msgs[i].msg_hdr.msg_name    = &u->dest;
+        msgs[i].msg_hdr.msg_namelen = u->dest_len;
+        msgs[i].msg_hdr.msg_iov     = iov[i];
+        msgs[i].msg_hdr.msg_iovlen  = 2;
+    }
+    int sent = 0;
+    while (sent < n) {                  // a blocking socket : all, or an error
+        atomic_fetch_add_explicit(&u->calls, 1, memory_order_relaxed);
+        int k = sendmmsg(u->sockfd, msgs + sent, n - sent, 0);
+        if (k < 0 && errno == EINTR) { continue; }
+        if (k <= 0) { return((sent > 0) ? sent : -1); }
+        sent += k;
+    }
+    return(sent);
+#else
+    for (int i=0; i<n; i++) {           // no sendmmsg : one call each
+        struct iovec  iov[2];
+        struct msghdr msg;
+        bzero((char *)&msg, sizeof(msg));
+        iov[0].iov_base = u->hdrs + i * UDP_HEADER_BYTES;
+        iov[0].iov_len  = UDP_HEADER_BYTES;
+        iov[1].iov_base = (void *)(ptr + (long)i * u->payload);
+        iov[1].iov_len  = u->payload;
+        msg.msg_name    = &u->dest;
+        msg.msg_namelen = u->dest_len;
+        msg.msg_iov     = iov;
+        msg.msg_iovlen  = 2;
+        atomic_fetch_add_explicit(&u->calls, 1, memory_order_relaxed);
+        if (sendmsg(u->sockfd, &msg, 0) < 0) { return((i > 0) ? i : -1); }
+    }
+    return(n);
+#endif
+}
+
+//  sample number at ring position pos, with the writer's drops as
+//    last seen
+
+static long long udp_sample(udp_t *u, long long pos)
+{
+    ring_t *r = u->rd.ring;
+    return(pos / r->frame * r->frame_pairs + u->drops_seen);
+}
+
+//  Sends whole batches as they fill, or whatever whole datagrams are
+//    waiting after wait_ms.  Lapped, or after the writer dropped
+//    samples, it skips on to the next payload boundary so seq keeps
+//    counting payloads of samples from the start.
+
+static void *udp_run(void *param)
+{
+    udp_t     *u      = (udp_t *)param;
+    long long lapped  = 0;
+    int       batch   = UDP_BATCH;
+    if (u->gso) {
+        int k = UDP_GSO_BYTES / (UDP_HEADER_BYTES + u->payload);
+        if (k < batch) { batch = k; }
+    }
+    while (u->stop == 0) {
+        long avail = ring_wait(&u->rd, (long)batch * u->payload, u->wait_ms,
+                               &u->stop);
+        if (avail < u->payload || u->stop) { continue; }
+        uint8_t *ptr = NULL;
+        long n = ring_view(&u->rd, &ptr, (long)batch * u->payload);
+        if (u->rd.lapped != lapped) {
+            lapped = u->rd.lapped;
+            atomic_fetch_add_explicit(&u->dropped, u->rd.last_drop,
+                                      memory_order_relaxed);
+            fprintf(stderr, "udp sender overrun, dropped %lld samples\n",
+                    (long long)u->rd.last_drop);
+            u->realign = 1;
+            continue;
+        }
+        ring_t    *r     = u->rd.ring;
+        long long pos    = atomic_load(&u->rd.rd_pos);
+        long long drops  = atomic_load_explicit(&r->dropped,
+                                                memory_order_acquire);
+        if (drops != u->drops_seen) {   // a gap in the samples, here
+            u->drops_seen = drops;
+            u->realign    = 1;
+        }
+        if (u->realign) {
+            long long off  = (udp_sample(u, pos) - u->base) % u->pairs;
+            long      skip = (off > 0) ? (long)((u->pairs - off)
+                                         / r->frame_pairs * r->frame) : 0;
+            if (skip > n) { continue; } // not written yet
+            atomic_fetch_add_explicit(&u->dropped,
+                                      ring_skip_to(&u->rd, pos + skip),
+                                      memory_order_relaxed);
+            u->realign = 0;
+            continue;
+        }
+        int k = (int)(n / u->payload);
+        if (k <= 0) { continue; }
+        uint32_t  seq = (uint32_t)((udp_sample(u, pos) - u->base) / u->pairs);
+        int sent = udp_send_batch(u, ptr, k, seq);
+        if (sent < k) {
+            // the network said no : those datagrams are lost, not retried
+            atomic_fetch_add_explicit(&u->errors, 1, memory_order_relaxed);
+            sent = k;
+        } else {
+            atomic_fetch_add_explicit(&u->datagrams, sent,
+                                      memory_order_relaxed);
+            atomic_fetch_add_explicit(&u->bytes,
+                (long long)sent * (UDP_HEADER_BYTES + u->payload),
+                memory_order_relaxed);
+        }
+        ring_consume(&u->rd, (long)sent * u->payload);
+    }
+    return(NULL);
+}
+
+//  dest is host:port, unicast or a multicast group (ttl hops).
+//    payload is rounded down to whole frames of src.  bits goes
+//    in the headers; gso asks for UDP_SEGMENT sends (Linux).
+
+int udp_start(udp_t *u, const char *dest, ring_t *src, int payload,
+              int bits, int ttl, int gso, int wait_ms)
+{
+    bzero((char *)u, sizeof(udp_t));
+    strncpy(u->name, dest, sizeof(u->name) - 1);
+    u->payload = payload / src->frame * src->frame;
+    if (u->payload <= 0) { u->payload = src->frame; }
+    u->pairs   = u->payload / src->frame * src->frame_pairs;
+    u->bits    = bits;
+    u->wait_ms = wait_ms;
+#ifdef HFP_SENDMMSG
+    u->gso     = gso;
+#else
+    if (gso) { printf("udp: GSO needs Linux, using sendmsg\n"); }
+#endif
+    if (udp_resolve(u, dest) < 0) { return(-1); }
+    u->hdrs  = (uint8_t *)malloc(UDP_BATCH * UDP_HEADER_BYTES);
+    u->stage = (uint8_t *)malloc(UDP_GSO_BYTES + UDP_HEADER_BYTES
+                                 + UDP_MAX_PAYLOAD);
+    if (u->hdrs == NULL || u->stage == NULL) { return(-1); }
+
+    u->sockfd = socket(u->dest.ss_family, SOCK_DGRAM, 0);
+    if (u->sockfd < 0) {
+        printf("ERROR opening udp socket\n");
+        return(-1);
+    }
+    int sndbuf = UDP_SNDBUF;
+    setsockopt(u->sockfd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    if (u->multicast && u->dest.ss_family == AF_INET) {
+        unsigned char t = (unsigned char)ttl;
+        setsockopt(u->sockfd, IPPROTO_IP, IP_MULTICAST_TTL, &t, sizeof(t));
+    } else if (u->multicast) {
+        setsockopt(u->sockfd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS,
+                   &ttl, sizeof(ttl));
+    }
+
+    ring_reader_attach(&u->rd, src);
+    u->drops_seen = atomic_load(&src->dropped);
+    u->base       = udp_sample(u, atomic_load(&u->rd.rd_pos));
+    if (pthread_create(&u->thread, NULL, udp_run, u) != 0) {
+        printf("could not create udp thread\n");
+        ring_reader_detach(&u->rd);
+        return(-1);
+    }
+    u->on = 1;
+    printf("udp %s to %s, %d byte payloads, %s\n",
+           u->multicast ? "multicast" : "unicast", dest, u->payload,
+           u->gso ? "GSO" :
+#ifdef HFP_SENDMMSG
+           "sendmmsg"
+#else
+           "sendmsg"
+#endif
+           );
+    return(0);
+}
+
+//  what the headers say from now on
+
+void udp_tune(udp_t *u, double freq, double rate)
+{
+    atomic_store(&u->freq, (unsigned int)freq);
+    atomic_store(&u->rate, (unsigned int)rate);
+}
+
+void udp_stop(udp_t *u)
+{
+    if (!u->on) { return; }
+    u->on   = 0;
+    u->stop = 1;
+    pthread_join(u->thread, NULL);
+    ring_reader_detach(&u->rd);
+    close(u->sockfd);
+}
+
+// eof
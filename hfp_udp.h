@@ -0,0 +1,78 @@
+//
+//  hfp_udp.h
+//
+//  UDP output for hfp_tcp : the served stream as fixed size datagrams
+//    to a unicast address or a multicast group, so any number of
+//    listeners on the LAN cost the server the same.
+//
+//    A thread reads the stream's ring like a client and sends up to
+//    UDP_BATCH datagrams per system call : sendmmsg on Linux, with
+//    each payload sent straight from the ring, or with -Ug 1 one
+//    UDP_SEGMENT (GSO) send the kernel splits into datagrams.
+//
+//    Each datagram is a 20 byte header, big endian :
+//      "HFPU", u8 sample bits (as -b, 18 for bfp), u8 0,
+//      u16 payload bytes, u32 seq, u32 frequency Hz, u32 sample rate
+//    then payload bytes of samples, always whole IQ pairs (or bfp
+//    blocks).  seq counts payloads of samples from the start of the
+//    stream, by sample number, so the samples the server's writer
+//    discarded (ring_drop) count as well as those sent.  After any
+//    loss the sender skips on to the next payload boundary, so
+//    datagrams lost on the network, samples the writer dropped, or
+//    samples skipped when the sender fell behind all show up as
+//    missing seq numbers.  A writer's drop is seen when the sender
+//    next looks, so its gap may come up to a batch early.
+//
+//   re-distribution under the BSD 3 clause license permitted
+//
+
+#ifndef HFP_UDP_H
+#define HFP_UDP_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "hfp_ring.h"
+
+#define UDP_HEADER_BYTES    (20)
+#define UDP_PAYLOAD         (1400)      // default, 1420 byte datagrams
+#define UDP_MAX_PAYLOAD     (8952)      // 9000 byte jumbo frames, less headers
+#define UDP_BATCH           (32)        // datagrams per system call
+#define UDP_GSO_BYTES       (65000)     // one GSO send, under 64 KB
+#define UDP_SNDBUF          (4 * 1024 * 1024)
+
+typedef struct udp_t {
+    int             on;
+    int             sockfd;
+    struct sockaddr_storage dest;
+    socklen_t       dest_len;
+    char            name[160];  // as given to -U
+    int             multicast;
+    int             payload;    // bytes, a whole number of ring frames
+    int             bits;       // sample bits, for the header
+    int             gso;        // -Ug 1, and the kernel takes it
+    int             wait_ms;    // send what's there after this long
+    ring_reader_t   rd;
+    int             pairs;      // IQ pairs per payload
+    long long       base;       // sample number of seq 0
+    long long       drops_seen; // the writer's drops, when last looked at
+    int             realign;    // skip to a payload boundary first
+    uint8_t         *hdrs;      // UDP_BATCH headers
+    uint8_t         *stage;     // GSO : headers and payloads, back to back
+    atomic_uint     freq;       // for the headers, set by udp_tune
+    atomic_uint     rate;
+    volatile int    stop;
+    pthread_t       thread;
+    _Atomic long long datagrams;
+    _Atomic long long bytes;    // payload and headers
+    _Atomic long long calls;    // sendmmsg or sendmsg calls
+    _Atomic long long errors;   // failed sends, their datagrams dropped
+    _Atomic long long dropped;  // samples skipped, the sender lapped
+} udp_t;
+
+int     udp_start(udp_t *u, const char *dest, ring_t *src, int payload,
+                  int bits, int ttl, int gso, int wait_ms);
+void    udp_tune(udp_t *u, double freq, double rate);
+void    udp_stop(udp_t *u);
+
+#endif  // HFP_UDP_H